@@ -2,29 +2,35 @@
 #define TIME_H
 
 #include <chrono>
+#include "trace.h"
 
+// Monotonic stopwatch; a named timer also records [start, end] as a trace span
 class Timer
 {
     private:
         using milliseconds_ratio = std::ratio<1, 1000>;
         using duration_millis = std::chrono::duration<double, milliseconds_ratio>;
 
-        std::chrono::_V2::system_clock::time_point m_Start;
+        ENCRYPTO::TraceClock::time_point m_Start;
+        const char* m_Span;
 
     public:
-        Timer()
+        explicit Timer(const char* span=nullptr) : m_Span(span)
         {
-            m_Start = std::chrono::system_clock::now();
+            m_Start = ENCRYPTO::TraceClock::now();
         }
 
         void start()
         {
-            m_Start = std::chrono::system_clock::now();
+            m_Start = ENCRYPTO::TraceClock::now();
         }
 
         double end()
         {
-            duration_millis duration=std::chrono::system_clock::now()-m_Start;
+            auto now=ENCRYPTO::TraceClock::now();
+            if(m_Span && ENCRYPTO::Tracing::Instance().Enabled())
+                ENCRYPTO::Tracing::Instance().Record(m_Span, m_Start, now);
+            duration_millis duration=now-m_Start;
             return duration.count();
         }
 };
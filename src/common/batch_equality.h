@@ -5,29 +5,136 @@
 #include "EzPC/SCI/src/Millionaire/bit-triple-generator.h"
 #include <cmath>
 #include<ctime>
+#include <cstring>
 #include <thread>
+#include <vector>
+#include <immintrin.h>
+#include <stdexcept>
+#include "triple_store.h"
+#include "silent_ot.h"
 
 using namespace sci;
 using namespace std;
 
 static int _size=8;
 
+// Leaf-OT mode when none is given at runtime: WAN sends the last digit through kkot_beta too,
+// saving the extra OT round of the remainder variant at the cost of larger messages.
+#ifndef LEAF_OT_WAN_DEFAULT
+#ifdef WAN_EXEC
+#define LEAF_OT_WAN_DEFAULT true
+#else
+#define LEAF_OT_WAN_DEFAULT false
+#endif
+#endif
+
+// Number of inputs whose digits are extracted together, so each input word is
+// loaded once for all of its digits while the output rows stay in cache.
+static const int _digit_block=256;
+
+/*
+ * Splits data[0..count) into radix-2^beta digits, LSB digit first:
+ * out[i*stride + j] is digit i of data[j]. The last digit uses mask_r when r != 0.
+ */
+inline void decompose_digits(const uint64_t* data, int count, int num_digits, int beta, int r,
+		uint8_t mask_beta, uint8_t mask_r, int stride, uint8_t* out)
+{
+	for(int jb = 0; jb < count; jb += _digit_block) {
+		int end = std::min(count, jb + _digit_block);
+		for(int i = 0; i < num_digits; i++) {
+			uint8_t mask = ((i == num_digits-1) && (r != 0)) ? mask_r : mask_beta;
+			uint8_t* row = out + (size_t)i*stride;
+			int j = jb;
+#ifdef __AVX2__
+			const __m128i shift = _mm_cvtsi32_si128(i*beta);
+			const __m256i vmask = _mm256_set1_epi64x(mask);
+			// low byte of each 64-bit lane to bytes 0,1 of its 128-bit half
+			const __m256i pick = _mm256_setr_epi8(0, 8, -1, -1, -1, -1, -1, -1,
+					-1, -1, -1, -1, -1, -1, -1, -1,
+					0, 8, -1, -1, -1, -1, -1, -1,
+					-1, -1, -1, -1, -1, -1, -1, -1);
+			for(; j + 4 <= end; j += 4) {
+				__m256i v = _mm256_loadu_si256((const __m256i*)(data + j));
+				v = _mm256_and_si256(_mm256_srl_epi64(v, shift), vmask);
+				v = _mm256_shuffle_epi8(v, pick);
+				uint32_t packed = (uint32_t)(uint16_t)_mm256_extract_epi16(v, 0)
+						| ((uint32_t)(uint16_t)_mm256_extract_epi16(v, 8) << 16);
+				memcpy(row + j, &packed, sizeof(packed));
+			}
+#endif
+			for(; j < end; j++)
+				row[j] = (uint8_t)(data[j] >> i*beta) & mask;
+		}
+	}
+}
+
+/*
+ * Packs batch_size rows of 0/1 bytes into one byte per column:
+ * bit m of out[j] is bits[m*row_stride + j].
+ */
+inline void pack_mask_bytes(const uint8_t* bits, int row_stride, int batch_size, int count,
+		uint8_t* out)
+{
+	int j = 0;
+#ifdef __AVX2__
+	for(; j + 32 <= count; j += 32) {
+		__m256i acc = _mm256_setzero_si256();
+		for(int m = 0; m < batch_size; m++) {
+			__m256i v = _mm256_loadu_si256((const __m256i*)(bits + (size_t)m*row_stride + j));
+			// inputs are 0/1, so a 16-bit shift by m < 8 never crosses a byte
+			acc = _mm256_or_si256(acc, _mm256_slli_epi16(v, m));
+		}
+		_mm256_storeu_si256((__m256i*)(out + j), acc);
+	}
+#endif
+	for(; j < count; j++) {
+		uint8_t acc = 0;
+		for(int m = 0; m < batch_size; m++)
+			acc |= bits[(size_t)m*row_stride + j] << m;
+		out[j] = acc;
+	}
+}
+
+/*
+ * One leaf OT message set for a batch of server entries: bit m of ot_messages[k] is
+ * (digits[m] == k) ^ bit m of mask_byte. Every digit is < N, so the one-hot part is a
+ * broadcast of mask_byte followed by batch_size single-byte flips.
+ */
+inline void set_leaf_ot_messages_batch(uint8_t* ot_messages, int N, const uint8_t* digits,
+		int batch_size, uint8_t mask_byte)
+{
+	int k = 0;
+#ifdef __AVX2__
+	const __m256i fill = _mm256_set1_epi8((char)mask_byte);
+	for(; k + 32 <= N; k += 32)
+		_mm256_storeu_si256((__m256i*)(ot_messages + k), fill);
+#endif
+	memset(ot_messages + k, mask_byte, N - k);
+	for(int m = 0; m < batch_size; m++)
+		ot_messages[digits[m]] ^= (uint8_t)(1 << m);
+}
+
 template<typename IO>
 class BatchEquality {
 	public:
 		IO* io1 = nullptr;
     IO* io2 = nullptr;
+		IO* io_and = nullptr; // AND rounds, io1 unless a dedicated channel is given
 		sci::OTPack<IO>* otpack1, *otpack2;
 		TripleGenerator<IO>* triple_gen1, *triple_gen2;
 		int party;
 		int l, r, log_alpha, beta, beta_pow, batch_size, radixArrSize;
 		int num_digits, num_triples_corr, num_triples_std, log_num_digits, num_cmps;
 		int num_triples;
+		bool wan_mode;
 		uint8_t mask_beta, mask_r;
-		Triple* triples_std;
-    uint8_t* leaf_eq;
+		Triple* triples_std = nullptr;
+		ENCRYPTO::BoolTriplePool* pool = nullptr; // preprocessed AND triples, generated online if null
+		ENCRYPTO::SilentOTLane* silent = nullptr; // leaf OTs and triples from silent OT instead of the OTPacks
+    uint8_t* leaf_eq = nullptr;
 		uint8_t* digits;
 		uint8_t** leaf_ot_messages;
+		uint8_t* leaf_ot_buffer;
 
 
 		BatchEquality(int party,
@@ -38,7 +145,9 @@ class BatchEquality {
 				IO* io1,
         IO* io2,
 				sci::OTPack<IO> *otpack1,
-        sci::OTPack<IO> *otpack2)
+        sci::OTPack<IO> *otpack2,
+				IO* io_and = nullptr,
+				bool wan_mode = LEAF_OT_WAN_DEFAULT)
 		{
 			assert(log_radix_base <= 8);
 			assert(bitlength <= 64);
@@ -49,8 +158,10 @@ class BatchEquality {
 			this->otpack1 = otpack1;
       this->io2 = io2;
       this->otpack2 = otpack2;
+			this->io_and = io_and ? io_and : io1;
 			this->batch_size = batch_size;
 			this->num_cmps = num_cmps;
+			this->wan_mode = wan_mode;
 			this->triple_gen1 = new TripleGenerator<IO>(party, io1, otpack1);
       this->triple_gen2 = new TripleGenerator<IO>(3-party, io2, otpack2);
 			configure();
@@ -74,6 +185,8 @@ class BatchEquality {
 		{
 			delete triple_gen1;
       delete triple_gen2;
+			delete triples_std;
+			delete[] leaf_eq;
 		}
 
 		void setLeafMessages(uint64_t* data) {
@@ -87,37 +200,30 @@ class BatchEquality {
 			digits = new uint8_t[num_digits*radixArrSize];
 			leaf_eq = new uint8_t[num_digits*batch_size*num_cmps];
 
-			for(int i = 0; i < num_digits; i++) // Stored from LSB to MSB
-				for(int j = 0; j < radixArrSize; j++)
-					if ((i == num_digits-1) && (r != 0))
-						digits[i*radixArrSize+j] = (uint8_t)(data[j] >> i*beta) & mask_r;
-					else
-						digits[i*radixArrSize+j] = (uint8_t)(data[j] >> i*beta) & mask_beta;
+			decompose_digits(data, radixArrSize, num_digits, beta, r, mask_beta, mask_r,
+					radixArrSize, digits);
 
 			if(party==sci::ALICE) {
+				// One contiguous slab, row (i*num_cmps+j) holds the beta_pow messages of digit i, cmp j
 				leaf_ot_messages = new uint8_t*[num_digits*num_cmps];
+				leaf_ot_buffer = new uint8_t[(size_t)num_digits*num_cmps*beta_pow];
 				for(int i = 0; i < num_digits*num_cmps; i++)
-					leaf_ot_messages[i] = new uint8_t[beta_pow];
+					leaf_ot_messages[i] = leaf_ot_buffer + (size_t)i*beta_pow;
 
 				// Set Leaf OT messages
 				triple_gen1->prg->random_bool((bool*)leaf_eq, batch_size*num_digits*num_cmps);
+				uint8_t* mask_bytes = new uint8_t[num_cmps];
 				for(int i = 0; i < num_digits; i++) {
+					pack_mask_bytes(leaf_eq + i*num_cmps, num_digits*num_cmps, batch_size, num_cmps,
+							mask_bytes);
+					int N = beta_pow;
+					if (!wan_mode && i == (num_digits - 1) && (r > 0))
+						N = 1 << r;
 					for(int j = 0; j < num_cmps; j++) {
-						if (i == (num_digits - 1) && (r > 0)){
-#ifdef WAN_EXEC
-							set_leaf_ot_messages(leaf_ot_messages[i*num_cmps+j], digits,
-									beta_pow, leaf_eq, i, j);
-#else
-							set_leaf_ot_messages(leaf_ot_messages[i*num_cmps+j], digits,
-									1 << r, leaf_eq, i, j);
-#endif
-						}
-						else{
-							set_leaf_ot_messages(leaf_ot_messages[i*num_cmps+j], digits,
-									beta_pow, leaf_eq, i, j);
-						}
+						set_leaf_ot_messages(leaf_ot_messages[i*num_cmps+j], digits, N, mask_bytes[j], i, j);
 					}
 				}
+				delete[] mask_bytes;
 			}
 
 		}
@@ -129,10 +235,16 @@ class BatchEquality {
 			{
 
 				// Perform Leaf OTs
-#ifdef WAN_EXEC
-				otpack1->kkot_beta->send(leaf_ot_messages, num_cmps*(num_digits), _size);
-#else
-				if (r == 1) {
+				if (silent) {
+					bool split = !wan_mode && r != 0;
+					silent->LeafSend(leaf_ot_messages, num_cmps*(num_digits - split), beta);
+					if (split)
+						silent->LeafSend(leaf_ot_messages+num_cmps*(num_digits-1), num_cmps, r);
+				}
+				else if (wan_mode) {
+					otpack1->kkot_beta->send(leaf_ot_messages, num_cmps*(num_digits), _size);
+				}
+				else if (r == 1) {
 					otpack1->kkot_beta->send(leaf_ot_messages, num_cmps*(num_digits-1), _size);
 					otpack1->iknp_straight->send(leaf_ot_messages+num_cmps*(num_digits-1), num_cmps, _size);
 				}
@@ -154,19 +266,24 @@ class BatchEquality {
 				else {
 					otpack1->kkot_beta->send(leaf_ot_messages, num_cmps*num_digits, _size);
 				}
-#endif
 				// Cleanup
-				for(int i = 0; i < num_digits*num_cmps; i++)
-					delete[] leaf_ot_messages[i];
+				delete[] leaf_ot_buffer;
 				delete[] leaf_ot_messages;
 			}
 			else // party = sci::BOB
 			{ //triple_gen1->generate(3-party, triples_std, _16KKOT_to_4OT);
 				// Perform Leaf OTs
-#ifdef WAN_EXEC
-				otpack1->kkot_beta->recv(leaf_eq, digits, num_cmps*(num_digits), _size);
-#else
-				if (r == 1) {
+				if (silent) {
+					bool split = !wan_mode && r != 0;
+					silent->LeafRecv(leaf_eq, digits, num_cmps*(num_digits - split), beta);
+					if (split)
+						silent->LeafRecv(leaf_eq+num_cmps*(num_digits-1), digits+num_cmps*(num_digits-1),
+								num_cmps, r);
+				}
+				else if (wan_mode) {
+					otpack1->kkot_beta->recv(leaf_eq, digits, num_cmps*(num_digits), _size);
+				}
+				else if (r == 1) {
 					otpack1->kkot_beta->recv(leaf_eq, digits, num_cmps*(num_digits-1), _size);
 					otpack1->iknp_straight->recv(leaf_eq+num_cmps*(num_digits-1),
 							digits+num_cmps*(num_digits-1), num_cmps, _size);
@@ -192,7 +309,6 @@ class BatchEquality {
 				else {
 					otpack1->kkot_beta->recv(leaf_eq, digits, num_cmps*(num_digits), _size);
 				}
-#endif
 
 				// Extract equality result from leaf_res_cmp
 				for(int i = 0; i < num_digits*num_cmps; i++) {
@@ -218,16 +334,12 @@ class BatchEquality {
 		void set_leaf_ot_messages(uint8_t* ot_messages,
 				uint8_t* digits,
 				int N,
-				uint8_t* mask_bytes,
+				uint8_t mask_byte,
 				int i,
 				int j)
 		{
-			for(int k = 0; k < N; k++) {
-				ot_messages[k] = 0;
-				for(int m=0; m < batch_size; m++) {
-					ot_messages[k] = ot_messages[k] | (((digits[i*radixArrSize + j*batch_size + m] == k) ^ mask_bytes[m*num_digits*num_cmps + i*num_cmps+j]) << m);
-				}
-			}
+			set_leaf_ot_messages_batch(ot_messages, N, digits + i*radixArrSize + j*batch_size,
+					batch_size, mask_byte);
 		}
 
 		/**************************************************************************************************
@@ -235,9 +347,45 @@ class BatchEquality {
 		 **************************************************************************************************/
 
     void generate_triples() {
+      if (pool != nullptr && take_pooled_triples())
+        return;
+      if (silent != nullptr) {
+        silent->BoolTriples(triples_std);
+        return;
+      }
       triple_gen2->generate(3-party, triples_std, _16KKOT_to_4OT);
     }
 
+		/*
+		 * Fills triples_std from the pool when both parties can serve the whole block from the
+		 * same cursor. The check costs one exchange on io2, the channel the triple generation
+		 * would otherwise use; if either pool is missing or short, both fall back to generating.
+		 */
+		bool take_pooled_triples() {
+			uint64_t bytes = triples_std->num_bytes;
+			uint64_t mine[2] = {pool->Available() >= bytes, pool->Next()}, theirs[2];
+			if (party == sci::ALICE) {
+				io2->send_data(mine, sizeof(mine));
+				io2->flush();
+				io2->recv_data(theirs, sizeof(theirs));
+			} else {
+				io2->recv_data(theirs, sizeof(theirs));
+				io2->send_data(mine, sizeof(mine));
+				io2->flush();
+			}
+			if (!mine[0] || !theirs[0])
+				return false;
+			if (mine[1] != theirs[1])
+				throw std::runtime_error("Boolean triple pools out of sync");
+			std::vector<ENCRYPTO::PackedBoolTriples> packed = pool->Take(bytes);
+			for (uint64_t i = 0; i < bytes; i++) {
+				triples_std->ai[i] = packed[i].a;
+				triples_std->bi[i] = packed[i].b;
+				triples_std->ci[i] = packed[i].c;
+			}
+			return true;
+		}
+
 		void traverse_and_compute_ANDs(uint8_t* res_shares){
 			//clock_gettime(CLOCK_MONOTONIC, &start);
 			// Combine leaf OT results in a bottom-up fashion
@@ -269,17 +417,17 @@ class BatchEquality {
 
 				if(party == sci::ALICE)
 				{
-					io1->send_data(ei, comm_size);
-					io1->send_data(fi, comm_size);
-					io1->recv_data(e, comm_size);
-					io1->recv_data(f, comm_size);
+					io_and->send_data(ei, comm_size);
+					io_and->send_data(fi, comm_size);
+					io_and->recv_data(e, comm_size);
+					io_and->recv_data(f, comm_size);
 				}
 				else // party = sci::BOB
 				{
-					io1->recv_data(e, comm_size);
-					io1->recv_data(f, comm_size);
-					io1->send_data(ei, comm_size);
-					io1->send_data(fi, comm_size);
+					io_and->recv_data(e, comm_size);
+					io_and->recv_data(f, comm_size);
+					io_and->send_data(ei, comm_size);
+					io_and->send_data(fi, comm_size);
 				}
 
 				for(int i = 0; i < comm_size; i++) {
@@ -344,4 +492,97 @@ void perform_batch_equality(uint64_t* inputs, BatchEquality<NetIO>* compare, uin
     compare->traverse_and_compute_ANDs(res_shares);
 }
 
+void offline_batch_equality_thread(BatchEquality<NetIO>* compare) {
+    std::thread triples_thread(generate_triples_thread, compare);
+    compare->computeLeafOTs();
+    triples_thread.join();
+}
+
+/*
+ * Streams the comparisons through BatchEquality in blocks of chunk_cmps. The AND rounds of
+ * block i run on ioArr[2] while the leaf OTs (ioArr[0]) and triples (ioArr[1]) of block i+1
+ * are in flight, so at most two blocks of leaf buffers and triples are alive at a time.
+ */
+void perform_batch_equality_chunked(uint64_t* inputs, int party, int l, int b, int batch_size,
+    int num_cmps, int chunk_cmps, sci::NetIO** ioArr, sci::OTPack<sci::NetIO>** otpackArr,
+    uint8_t* res_shares, bool wan_mode = LEAF_OT_WAN_DEFAULT,
+    ENCRYPTO::BoolTriplePool* pool = nullptr, ENCRYPTO::SilentOTLane* silent = nullptr) {
+    chunk_cmps = std::max(8, (chunk_cmps/8)*8);
+    // ALICE holds batch_size entries per comparison, BOB one
+    int stride = (party == sci::ALICE) ? batch_size : 1;
+
+    auto make_block = [&](int offset) {
+      int lnum_cmps = std::min(chunk_cmps, num_cmps - offset);
+      BatchEquality<NetIO>* compare = new BatchEquality<NetIO>(party, l, b, batch_size, lnum_cmps,
+          ioArr[0], ioArr[1], otpackArr[0], otpackArr[1], ioArr[2], wan_mode);
+      compare->pool = pool;
+      compare->silent = silent;
+      compare->setLeafMessages(inputs + (size_t)offset*stride);
+      return compare;
+    };
+
+    BatchEquality<NetIO>* current = make_block(0);
+    std::thread offline(offline_batch_equality_thread, current);
+    for (int offset = 0; offset < num_cmps; offset += chunk_cmps) {
+      offline.join();
+      BatchEquality<NetIO>* next = nullptr;
+      if (offset + chunk_cmps < num_cmps) {
+        next = make_block(offset + chunk_cmps);
+        offline = std::thread(offline_batch_equality_thread, next);
+      }
+      current->traverse_and_compute_ANDs(res_shares + offset);
+      delete current;
+      current = next;
+    }
+}
+
+void batch_equality_lane(uint64_t* inputs, int party, int l, int b, int batch_size, int lnum_cmps,
+    int chunk_cmps, sci::NetIO** io, sci::OTPack<sci::NetIO>** otpack, uint8_t* res_shares,
+    bool wan_mode = LEAF_OT_WAN_DEFAULT, ENCRYPTO::BoolTriplePool* pool = nullptr,
+    ENCRYPTO::SilentOTLane* silent = nullptr) {
+    if (lnum_cmps <= 0) return;
+    if (chunk_cmps > 0) {
+      perform_batch_equality_chunked(inputs, party, l, b, batch_size, lnum_cmps, chunk_cmps, io,
+          otpack, res_shares, wan_mode, pool, silent);
+    } else {
+      BatchEquality<NetIO>* compare = new BatchEquality<NetIO>(party, l, b, batch_size, lnum_cmps,
+          io[0], io[1], otpack[0], otpack[1], nullptr, wan_mode);
+      compare->pool = pool;
+      compare->silent = silent;
+      perform_batch_equality(inputs, compare, res_shares);
+      delete compare;
+    }
+}
+
+/*
+ * Splits num_cmps (in multiples of 8) across `lanes` independent BatchEquality instances.
+ * Lane t owns ioArr[t*ios_per_lane ...] and otpackArr[2*t], otpackArr[2*t+1], and writes its
+ * slice of res_shares, so the merged result needs no extra pass. pools, if given, holds the
+ * preprocessed AND triples of each lane, silent the silent-OT backend of each lane.
+ */
+void perform_batch_equality_lanes(uint64_t* inputs, int party, int l, int b, int batch_size,
+    int num_cmps, int chunk_cmps, int lanes, sci::NetIO** ioArr, int ios_per_lane,
+    sci::OTPack<sci::NetIO>** otpackArr, uint8_t* res_shares, bool wan_mode = LEAF_OT_WAN_DEFAULT,
+    ENCRYPTO::BoolTriplePool* pools = nullptr, ENCRYPTO::SilentOTLane* silent = nullptr) {
+    if (lanes <= 1) {
+      batch_equality_lane(inputs, party, l, b, batch_size, num_cmps, chunk_cmps, ioArr, otpackArr,
+          res_shares, wan_mode, pools, silent);
+      return;
+    }
+
+    int stride = (party == sci::ALICE) ? batch_size : 1;
+    int lane_cmps = (num_cmps/(8*lanes))*8;
+    std::vector<std::thread> lane_threads;
+    for (int t = 0; t < lanes; ++t) {
+      int offset = t*lane_cmps;
+      int lnum_cmps = (t == lanes - 1) ? num_cmps - offset : lane_cmps;
+      lane_threads.emplace_back(batch_equality_lane, inputs + (size_t)offset*stride, party, l, b,
+          batch_size, lnum_cmps, chunk_cmps, ioArr + t*ios_per_lane, otpackArr + 2*t,
+          res_shares + offset, wan_mode, pools ? pools + t : nullptr, silent ? silent + t : nullptr);
+    }
+    for (auto& t : lane_threads) {
+      t.join();
+    }
+}
+
 #endif //BATCHEQUALITY_H__
@@ -0,0 +1,45 @@
+#ifndef BENCH_STATS_H__
+#define BENCH_STATS_H__
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+// Summary statistics and JSON quoting shared by dmsp2cq_bench and dmsp2cq_microbench
+
+namespace ENCRYPTO {
+
+struct BenchSummary {
+  double mean, p50, p95, stddev, min, max;
+};
+
+// Sample standard deviation, nearest-rank p95
+inline BenchSummary Summarize(std::vector<double> values) {
+  BenchSummary s{};
+  if (values.empty()) return s;
+  std::sort(values.begin(), values.end());
+  size_t n = values.size();
+  for (double v : values) s.mean += v;
+  s.mean /= n;
+  for (double v : values) s.stddev += (v - s.mean) * (v - s.mean);
+  s.stddev = n > 1 ? std::sqrt(s.stddev / (n - 1)) : 0;
+  s.p50 = n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+  s.p95 = values[(size_t)std::ceil(0.95 * n) - 1];
+  s.min = values.front();
+  s.max = values.back();
+  return s;
+}
+
+inline std::string JsonString(const std::string &s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') out += '\\';
+    out += c;
+  }
+  return out + "\"";
+}
+
+}  // namespace ENCRYPTO
+
+#endif  // BENCH_STATS_H__
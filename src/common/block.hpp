@@ -22,4 +22,40 @@ inline std::string blockToHex(const osuCrypto::block& blk) {
   return ss.str();
 }
 
+template<class T>
+std::vector<T> flatten(const std::vector<std::vector<T>>& data) {
+    std::vector<T> flat;
+    for (const auto& bucket : data) {
+        flat.insert(flat.end(), bucket.begin(), bucket.end());
+    }
+    return flat;
+}
+
+// KKRT receiver outputs, one per OT, as the 64-bit values the protocol compares
+inline std::vector<uint64_t> fromClientOprfData(const std::vector<osuCrypto::block>& data,uint64_t size)
+{
+  std::vector<std::vector<uint64_t>> client_simple_table1(size);
+
+  // std::cout << "Number of OTs (outer vector size): " << data.size() << std::endl;
+  for (size_t i = 0; i < data.size() && i < size; ++i) {
+      std::vector<uint64_t> xor_result = blockToUint64Xor(data[i]);  
+      client_simple_table1[i].insert(client_simple_table1[i].end(), xor_result.begin(), xor_result.end());
+      
+  }
+  return flatten(client_simple_table1);
+}
+
+// KKRT sender outputs, per bin
+inline std::vector<std::vector<uint64_t>> fromServerOprfBins(const std::vector<std::vector<osuCrypto::block>>& data)
+{
+  std::vector<std::vector<uint64_t>> bins(data.size());
+
+  for (size_t i = 0; i < data.size(); ++i) {
+    bins[i].reserve(data[i].size());
+    for (const auto &blk : data[i])
+      bins[i].push_back(blockToUint64Xor(blk)[0]);
+  }
+  return bins;
+}
+
 #endif
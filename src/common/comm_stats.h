@@ -0,0 +1,185 @@
+#ifndef COMM_STATS_H__
+#define COMM_STATS_H__
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/*
+ * Communication of one node per protocol phase and link.
+ *
+ * Every node thread starts a CommMeter over its transports and moves it through the phases with
+ * EnterCommPhase(). Bytes are read from the transports' own counters at each phase change, so
+ * they are exact whichever library issued the calls. Messages and rounds are counted where the
+ * calls pass through this code: CSocketTransport on the node socket, and the in-process handoffs
+ * between the nodes of one party (LINK_LOCAL), which go over the network once every node runs on
+ * its own machine. SCI's NetIO counts its rounds itself; the libOTe channels only expose bytes.
+ * A round is a send that follows a receive on the same link. The receiving side of the socket
+ * and SCI links is completed from the peer's counters after the run.
+ */
+
+namespace ENCRYPTO {
+
+enum CommPhase : int {
+  COMM_SETUP,      // key exchanges, base OTs, Paillier data
+  COMM_OPRF1,      // first OPRF of every node
+  COMM_OPRF2,      // OPRF of the center over all nodes
+  COMM_HINT,       // OPPRF hint of the PSM3 front end
+  COMM_COMPARE,    // PSM3 batch equality
+  COMM_MATCH,      // PSM1/PSM2 matching by the leader
+  COMM_AGGREGATE,  // PSM3 result multiplication and sums
+  COMM_PHASES
+};
+
+enum CommLink : int {
+  LINK_SOCKET,  // node CSocket
+  LINK_OPRF,    // libOTe channel of the OPRFs
+  LINK_SCI,     // SCI NetIOs and the silent-OT channels
+  LINK_LOCAL,   // handoffs between the nodes of one party
+  COMM_LINKS
+};
+
+static const char *const COMM_PHASE_NAMES[] = {"setup", "oprf1",   "oprf2",    "hint",
+                                               "compare", "match", "aggregate"};
+static const char *const COMM_LINK_NAMES[] = {"socket", "oprf", "sci", "local"};
+static const bool COMM_LINK_MESSAGES[] = {true, false, false, true};
+static const bool COMM_LINK_ROUNDS[] = {true, false, true, true};
+
+struct CommCounter {
+  uint64_t sent = 0, recv = 0;  // bytes
+  uint64_t sent_msgs = 0, recv_msgs = 0;
+  uint64_t rounds = 0;
+
+  CommCounter &operator+=(const CommCounter &o) {
+    sent += o.sent;
+    recv += o.recv;
+    sent_msgs += o.sent_msgs;
+    recv_msgs += o.recv_msgs;
+    rounds += o.rounds;
+    return *this;
+  }
+
+  bool Empty() const { return sent == 0 && recv == 0 && sent_msgs == 0 && recv_msgs == 0 && rounds == 0; }
+};
+
+struct CommReport {
+  CommCounter counters[COMM_PHASES][COMM_LINKS];
+
+  CommCounter Link(int link) const {
+    CommCounter total;
+    for (int p = 0; p < COMM_PHASES; p++) total += counters[p][link];
+    return total;
+  }
+
+  CommCounter Total() const {
+    CommCounter total;
+    for (int l = 0; l < COMM_LINKS; l++) total += Link(l);
+    return total;
+  }
+
+  CommReport &operator+=(const CommReport &o) {
+    for (int p = 0; p < COMM_PHASES; p++)
+      for (int l = 0; l < COMM_LINKS; l++) counters[p][l] += o.counters[p][l];
+    return *this;
+  }
+};
+
+// Cumulative counters of one transport
+struct CommSample {
+  uint64_t sent, recv, rounds;
+};
+
+class CommMeter {
+ public:
+  // Adds a transport; read() is sampled at every phase change
+  void AddSource(CommLink link, std::function<CommSample()> read) {
+    sources_.push_back({link, std::move(read), {0, 0, 0}});
+  }
+
+  // Starts in COMM_SETUP; CSocketTransport and the local handoffs of this thread report here
+  void Start() {
+    report_ = CommReport();
+    phase_ = COMM_SETUP;
+    for (auto &s : sources_) s.mark = s.read();
+    for (auto &d : last_) d = NONE;
+    Current() = this;
+  }
+
+  void Enter(CommPhase phase) {
+    Settle();
+    phase_ = phase;
+  }
+
+  const CommReport &Finish() {
+    Settle();
+    if (Current() == this) Current() = nullptr;
+    return report_;
+  }
+
+  // A write or read of the node socket; the bytes come from the socket counters
+  void SocketWrite() { Sent(LINK_SOCKET, 0); }
+  void SocketRead() { last_[LINK_SOCKET] = RECEIVED; }
+
+  void LocalSend(uint64_t bytes) { Sent(LINK_LOCAL, bytes); }
+  void LocalRecv(uint64_t bytes) {
+    CommCounter &c = report_.counters[phase_][LINK_LOCAL];
+    c.recv += bytes;
+    c.recv_msgs++;
+    last_[LINK_LOCAL] = RECEIVED;
+  }
+
+  static CommMeter *&Current() {
+    static thread_local CommMeter *meter = nullptr;
+    return meter;
+  }
+
+ private:
+  enum Direction { NONE, SENT, RECEIVED };
+
+  struct Source {
+    CommLink link;
+    std::function<CommSample()> read;
+    CommSample mark;
+  };
+
+  void Sent(CommLink link, uint64_t bytes) {
+    CommCounter &c = report_.counters[phase_][link];
+    c.sent += bytes;
+    c.sent_msgs++;
+    if (last_[link] != SENT) c.rounds++;
+    last_[link] = SENT;
+  }
+
+  void Settle() {
+    for (auto &s : sources_) {
+      CommSample now = s.read();
+      CommCounter &c = report_.counters[phase_][s.link];
+      c.sent += now.sent - s.mark.sent;
+      c.recv += now.recv - s.mark.recv;
+      c.rounds += now.rounds - s.mark.rounds;
+      s.mark = now;
+    }
+  }
+
+  std::vector<Source> sources_;
+  CommReport report_;
+  int phase_ = COMM_SETUP;
+  Direction last_[COMM_LINKS] = {NONE, NONE, NONE, NONE};
+};
+
+inline void EnterCommPhase(CommPhase phase) {
+  if (CommMeter *meter = CommMeter::Current()) meter->Enter(phase);
+}
+
+// In-process handoffs, counted by the sending and by the receiving node
+inline void CountLocalSend(uint64_t bytes) {
+  if (CommMeter *meter = CommMeter::Current()) meter->LocalSend(bytes);
+}
+
+inline void CountLocalRecv(uint64_t bytes) {
+  if (CommMeter *meter = CommMeter::Current()) meter->LocalRecv(bytes);
+}
+
+}  // namespace ENCRYPTO
+
+#endif  // COMM_STATS_H__
@@ -1,3 +1,5 @@
+#include "comm_stats.h"
+
 
 namespace ENCRYPTO {
 
@@ -14,26 +16,50 @@ struct PsiAnalyticsContext {
   uint64_t snbins;
   uint64_t nfuns;  // number of hash functions in the hash table
   uint64_t radix;
+  uint64_t oprf_chunk;  // server elements per KKRT encode chunk of PSM1/PSM2, 0 = the whole table
+  uint64_t psm3_chunk;  // comparisons per pipelined BatchEquality block, 0 = unchunked
+  uint64_t psm3_threads;  // BatchEquality lanes, each with its own NetIOs and OTPacks
+  bool psm3_wan;  // leaf OTs send the last digit through kkot_beta as well
+  bool psm3_autotune;  // pick radix, psm3_wan and psm3_chunk from a link measurement
+  bool psm3_perm_hash;  // permutation-based hashing front end, compares bitlen - log2(nbins) + 1 bits
+  bool psm3_opprf;  // table-based OPPRF front end, one programmed value per bin instead of its entries
   double epsilon;
   uint64_t ffuns;
   // uint64_t fbins;
   double fepsilon;
   std::string address;
+  std::string otpack_cache;  // directory of persisted OTPack setups, empty = always run base OTs
+  uint64_t peer_id;  // LocalPartyId of the other party, what the caches and triple stores are keyed on
+  std::string triple_store;  // directory of preprocessed Beaver triples, empty = dealt online
+  uint64_t preprocess_triples;  // > 0: only deal and store this many triples per node pair
+  uint64_t preprocess_bool_triples;  // > 0: only fill the boolean AND triple pool of every PSM3 lane
+  std::string trace_dump;  // directory of the binary trace dump, empty = off
+  uint32_t trace_stages;  // TraceStage mask of the stages to dump
+  std::string trace_json;  // Chrome trace of the per-node timing spans, empty = off
+  std::string dataset;  // mapped input file (dataset.h), empty = the built-in synthetic inputs
+  uint64_t memory_budget;  // bytes per party process (memory_budget.h), 0 = unlimited
+  std::string spill_dir;  // directory of the external-memory stages' files
+  std::string store_dir;  // PSM1/PSM2 server state updated from a log (update_store.h), empty = rebuilt per query
+  std::string oprf_cache;  // OPRF_DH server keys and encoded elements (dh_oprf.h), empty = fresh keys per run
+  std::string net_profile;  // link the client emulates towards the server (NetProfile), empty = direct
 
-  std::vector<uint64_t> sci_io_start;
   uint64_t index;
   uint64_t n;
   uint64_t g;
 
-  uint64_t sentBytesOPRF;
-  uint64_t recvBytesOPRF;
-  uint64_t sentBytesHint;
-  uint64_t recvBytesHint;
-  uint64_t sentBytesSCI;
-  uint64_t recvBytesSCI;
+  CommReport comm;  // bytes, messages and rounds of the query per phase and link
+
+  struct {
+    bool done;
+    double rtt;
+    double mbps;
+    double estimate;
+  } tuning;
 
-  uint64_t sentBytes;
-  uint64_t recvBytes;
+  enum {
+    OT_IKNP,  // SCI OTPacks (IKNP / KKOT extension)
+    OT_SILENT  // libOTe silent OT, derandomized for the leaf OTs and AND triples
+  } ot_backend;
 
   enum {
     PSM1,
@@ -41,6 +67,11 @@ struct PsiAnalyticsContext {
     PSM3
   } psm_type;
 
+  enum {
+    OPRF_KKRT,  // KKRT OT-based OPRF, the server encodes its table under a fresh key every query
+    OPRF_DH  // key-reusable DH OPRF, the server's encoded table is cached across queries
+  } oprf_mode;
+
   struct {
     double vrf;
     // double hashing;
@@ -58,6 +89,8 @@ struct PsiAnalyticsContext {
     double search;
     double wholeoprf;
     double addtime;
+    double update;  // applying the store's log and encrypting its new values
+    double oprf_encode;  // OPRF_DH: encoding the server elements missing from the cache
   } timings;
 };
 
@@ -0,0 +1,278 @@
+#ifndef DATASET_H__
+#define DATASET_H__
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+ * Binary input datasets, mapped read-only and shared by all node threads of a party.
+ *
+ * Layout (native byte order, i.e. little endian on the machines we run on):
+ *   DatasetHeader                 32 bytes
+ *   uint64_t offsets[partitions+1]  record index where partition i starts; the last is `records`
+ *   zero padding to a multiple of 64 bytes
+ *   records                       8 bytes: element; 16 bytes: element, value
+ * Partition i holds the elements of node i; a file with one partition gives every node the same
+ * elements. The value of a 16-byte record is what PSM2 adds up for a matching element.
+ *
+ * Opening a dataset only maps it, so it takes constant time and the resident memory is the
+ * pages the nodes actually read.
+ */
+
+namespace ENCRYPTO {
+
+static const char DATASET_MAGIC[8] = {'D', 'M', 'S', 'P', 'D', 'S', '1', '\0'};
+static const uint32_t DATASET_VERSION = 1;
+
+struct DatasetHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;  // 8 or 16
+  uint64_t partitions;
+  uint64_t records;
+};
+static_assert(sizeof(DatasetHeader) == 32, "DatasetHeader is part of the file format");
+
+// Byte offset of the first record
+inline uint64_t DatasetDataOffset(uint64_t partitions) {
+  uint64_t end = sizeof(DatasetHeader) + (partitions + 1) * sizeof(uint64_t);
+  return (end + 63) / 64 * 64;
+}
+
+/*
+ * Read-only view of uint64_t words, every stride-th one: the elements of a partition, its
+ * values, or a whole std::vector. Copying a view never copies the words.
+ */
+class InputView {
+ public:
+  class const_iterator {
+   public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = uint64_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const uint64_t *;
+    using reference = const uint64_t &;
+
+    const_iterator() = default;
+    const_iterator(const uint64_t *p, size_t stride) : p_(p), stride_(stride) {}
+
+    reference operator*() const { return *p_; }
+    reference operator[](difference_type n) const { return p_[n * (difference_type)stride_]; }
+    const_iterator &operator++() { return *this += 1; }
+    const_iterator operator++(int) {
+      const_iterator it = *this;
+      *this += 1;
+      return it;
+    }
+    const_iterator &operator--() { return *this -= 1; }
+    const_iterator operator--(int) {
+      const_iterator it = *this;
+      *this -= 1;
+      return it;
+    }
+    const_iterator &operator+=(difference_type n) {
+      p_ += n * (difference_type)stride_;
+      return *this;
+    }
+    const_iterator &operator-=(difference_type n) { return *this += -n; }
+    const_iterator operator+(difference_type n) const { return const_iterator(*this) += n; }
+    const_iterator operator-(difference_type n) const { return const_iterator(*this) -= n; }
+    difference_type operator-(const const_iterator &o) const { return (p_ - o.p_) / (difference_type)stride_; }
+    bool operator==(const const_iterator &o) const { return p_ == o.p_; }
+    bool operator!=(const const_iterator &o) const { return p_ != o.p_; }
+    bool operator<(const const_iterator &o) const { return p_ < o.p_; }
+    bool operator>(const const_iterator &o) const { return p_ > o.p_; }
+    bool operator<=(const const_iterator &o) const { return p_ <= o.p_; }
+    bool operator>=(const const_iterator &o) const { return p_ >= o.p_; }
+
+   private:
+    const uint64_t *p_ = nullptr;
+    size_t stride_ = 1;
+  };
+
+  InputView() = default;
+  InputView(const uint64_t *data, size_t size, size_t stride = 1) : data_(data), size_(size), stride_(stride) {}
+  InputView(const std::vector<uint64_t> &v) : data_(v.data()), size_(v.size()) {}
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  uint64_t operator[](size_t i) const { return data_[i * stride_]; }
+  const_iterator begin() const { return const_iterator(data_, stride_); }
+  const_iterator end() const { return const_iterator(data_ + size_ * stride_, stride_); }
+
+  // The first n words, or all of them
+  InputView first(size_t n) const { return InputView(data_, n < size_ ? n : size_, stride_); }
+
+ private:
+  const uint64_t *data_ = nullptr;
+  size_t size_ = 0;
+  size_t stride_ = 1;
+};
+
+// What one node runs on; values is empty unless the dataset has 16-byte records
+struct NodeInputs {
+  InputView elements;
+  InputView values;
+};
+
+class Dataset {
+ public:
+  Dataset() = default;
+  explicit Dataset(const std::string &path) { Open(path); }
+  Dataset(const Dataset &) = delete;
+  Dataset &operator=(const Dataset &) = delete;
+  ~Dataset() { Close(); }
+
+  // Maps path read-only; throws std::runtime_error if it is missing or not a valid dataset
+  void Open(const std::string &path) {
+    Close();
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Cannot open dataset " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(DatasetHeader)) {
+      close(fd);
+      throw std::runtime_error("Dataset " + path + " is too short");
+    }
+    length_ = st.st_size;
+    map_ = mmap(nullptr, length_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map_ == MAP_FAILED) {
+      map_ = nullptr;
+      throw std::runtime_error("Cannot map dataset " + path);
+    }
+
+    header_ = static_cast<const DatasetHeader *>(map_);
+    try {
+      if (std::memcmp(header_->magic, DATASET_MAGIC, sizeof(DATASET_MAGIC)) != 0)
+        throw std::runtime_error("not a dataset");
+      if (header_->version != DATASET_VERSION) throw std::runtime_error("unsupported version");
+      if (header_->record_size != 8 && header_->record_size != 16) throw std::runtime_error("bad record size");
+      uint64_t data = DatasetDataOffset(header_->partitions);
+      if (header_->partitions == 0 || data > length_ ||
+          header_->records > (length_ - data) / header_->record_size)
+        throw std::runtime_error("truncated");
+      offsets_ = reinterpret_cast<const uint64_t *>(static_cast<const char *>(map_) + sizeof(DatasetHeader));
+      for (uint64_t p = 0; p < header_->partitions; p++)
+        if (offsets_[p] > offsets_[p + 1]) throw std::runtime_error("partition offsets out of order");
+      if (offsets_[0] != 0 || offsets_[header_->partitions] != header_->records)
+        throw std::runtime_error("partition offsets do not cover the records");
+      records_ = reinterpret_cast<const uint64_t *>(static_cast<const char *>(map_) + data);
+    } catch (const std::runtime_error &e) {
+      Close();
+      throw std::runtime_error("Dataset " + path + ": " + e.what());
+    }
+  }
+
+  void Close() {
+    if (map_) munmap(map_, length_);
+    map_ = nullptr;
+    header_ = nullptr;
+    offsets_ = records_ = nullptr;
+    length_ = 0;
+  }
+
+  bool IsOpen() const { return map_ != nullptr; }
+  uint64_t Partitions() const { return header_->partitions; }
+  uint64_t Records() const { return header_->records; }
+  uint32_t RecordSize() const { return header_->record_size; }
+  uint64_t PartitionSize(uint64_t p) const { return offsets_[p + 1] - offsets_[p]; }
+
+  InputView Elements(uint64_t p) const { return InputView(Word(p), PartitionSize(p), Stride()); }
+
+  InputView Values(uint64_t p) const {
+    if (header_->record_size != 16) return InputView();
+    return InputView(Word(p) + 1, PartitionSize(p), Stride());
+  }
+
+  NodeInputs Partition(uint64_t p) const { return {Elements(p), Values(p)}; }
+
+ private:
+  size_t Stride() const { return header_->record_size / sizeof(uint64_t); }
+  const uint64_t *Word(uint64_t p) const { return records_ + offsets_[p] * Stride(); }
+
+  void *map_ = nullptr;
+  size_t length_ = 0;
+  const DatasetHeader *header_ = nullptr;
+  const uint64_t *offsets_ = nullptr;
+  const uint64_t *records_ = nullptr;
+};
+
+/*
+ * Streams a dataset to disk partition by partition, so generating one never holds it in memory.
+ * Call BeginPartition() before the records of every partition, then Close().
+ */
+class DatasetWriter {
+ public:
+  DatasetWriter(const std::string &path, uint32_t record_size, uint64_t partitions)
+      : path_(path), record_size_(record_size), partitions_(partitions) {
+    if (record_size != 8 && record_size != 16) throw std::invalid_argument("Record size must be 8 or 16");
+    if (partitions == 0) throw std::invalid_argument("A dataset needs at least one partition");
+    file_ = std::fopen(path.c_str(), "wb");
+    if (!file_) throw std::runtime_error("Cannot create dataset " + path);
+    std::vector<char> head(DatasetDataOffset(partitions), 0);
+    Write(head.data(), head.size());
+  }
+
+  DatasetWriter(const DatasetWriter &) = delete;
+  DatasetWriter &operator=(const DatasetWriter &) = delete;
+
+  ~DatasetWriter() {
+    if (file_) std::fclose(file_);
+  }
+
+  void BeginPartition() {
+    if (offsets_.size() == partitions_) throw std::logic_error("More partitions than announced");
+    offsets_.push_back(records_);
+  }
+
+  void Add(uint64_t element, uint64_t value = 0) {
+    uint64_t record[2] = {element, value};
+    Write(record, record_size_);
+    records_++;
+  }
+
+  // Writes the header and the partition offsets; partitions never begun are empty
+  void Close() {
+    while (offsets_.size() < partitions_) offsets_.push_back(records_);
+    offsets_.push_back(records_);
+    DatasetHeader header;
+    std::memcpy(header.magic, DATASET_MAGIC, sizeof(DATASET_MAGIC));
+    header.version = DATASET_VERSION;
+    header.record_size = record_size_;
+    header.partitions = partitions_;
+    header.records = records_;
+    if (std::fseek(file_, 0, SEEK_SET) != 0) throw std::runtime_error("Cannot write dataset " + path_);
+    Write(&header, sizeof(header));
+    Write(offsets_.data(), offsets_.size() * sizeof(uint64_t));
+    int failed = std::fclose(file_);
+    file_ = nullptr;
+    if (failed) throw std::runtime_error("Cannot write dataset " + path_);
+  }
+
+ private:
+  void Write(const void *data, size_t bytes) {
+    if (std::fwrite(data, 1, bytes, file_) != bytes) throw std::runtime_error("Cannot write dataset " + path_);
+  }
+
+  std::string path_;
+  uint32_t record_size_;
+  uint64_t partitions_;
+  uint64_t records_ = 0;
+  std::vector<uint64_t> offsets_;
+  std::FILE *file_ = nullptr;
+};
+
+}  // namespace ENCRYPTO
+
+#endif  // DATASET_H__
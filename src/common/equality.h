@@ -11,6 +11,14 @@
 using namespace sci;
 using namespace std;
 
+#ifndef LEAF_OT_WAN_DEFAULT
+#ifdef WAN_EXEC
+#define LEAF_OT_WAN_DEFAULT true
+#else
+#define LEAF_OT_WAN_DEFAULT false
+#endif
+#endif
+
 template<typename IO>
 class Equality {
 	public:
@@ -21,6 +29,7 @@ class Equality {
 		int l, r, log_alpha, beta, beta_pow;
 		int num_digits, num_cmps;
 		int num_triples;
+		bool wan_mode = LEAF_OT_WAN_DEFAULT;
 		uint8_t mask_beta, mask_r;
 		Triple* triples_std;
     uint8_t* leaf_eq;
@@ -92,14 +101,9 @@ class Equality {
 
 				for(int i = 0; i < num_digits; i++) {
 					for(int j = 0; j < num_cmps; j++) {
-						if (i == (num_digits - 1) && (r > 0)){
-#ifdef WAN_EXEC
-							set_leaf_ot_messages(leaf_ot_messages[i*num_cmps+j], digits[i*num_cmps+j],
-									beta_pow, leaf_eq[i*num_cmps+j]);
-#else
+						if (!wan_mode && i == (num_digits - 1) && (r > 0)){
 						  set_leaf_ot_messages(leaf_ot_messages[i*num_cmps+j], digits[i*num_cmps+j],
 									1 << r, leaf_eq[i*num_cmps+j]);
-#endif
 						}
 						else{
 							set_leaf_ot_messages(leaf_ot_messages[i*num_cmps+j], digits[i*num_cmps+j],
@@ -108,10 +112,10 @@ class Equality {
 					}
 				}
 				// Perform Leaf OTs
-#ifdef WAN_EXEC
-				otpack->kkot_beta->send(leaf_ot_messages, num_cmps*(num_digits), 1);
-#else
-				if (r == 1) {
+				if (wan_mode) {
+					otpack->kkot_beta->send(leaf_ot_messages, num_cmps*(num_digits), 1);
+				}
+				else if (r == 1) {
 					otpack->kkot_beta->send(leaf_ot_messages, num_cmps*(num_digits-1), 1);
 					otpack->iknp_straight->send(leaf_ot_messages+num_cmps*(num_digits-1), num_cmps, 1);
 				}
@@ -133,7 +137,6 @@ class Equality {
 				else {
 					otpack->kkot_beta->send(leaf_ot_messages, num_cmps*num_digits, 1);
 				}
-#endif
 				// Cleanup
 				for(int i = 0; i < num_digits*num_cmps; i++)
 					delete[] leaf_ot_messages[i];
@@ -142,10 +145,10 @@ class Equality {
 			else // party = sci::BOB
 			{
 				// Perform Leaf OTs
-#ifdef WAN_EXEC
-				otpack->kkot_beta->recv(leaf_eq, digits, num_cmps*(num_digits), 1);
-#else
-				if (r == 1) {
+				if (wan_mode) {
+					otpack->kkot_beta->recv(leaf_eq, digits, num_cmps*(num_digits), 1);
+				}
+				else if (r == 1) {
 					otpack->kkot_beta->recv(leaf_eq, digits, num_cmps*(num_digits-1), 1);
 					otpack->iknp_straight->recv(leaf_eq+num_cmps*(num_digits-1),
 							digits+num_cmps*(num_digits-1), num_cmps, 1);
@@ -171,7 +174,6 @@ class Equality {
 				else {
 					otpack->kkot_beta->recv(leaf_eq, digits, num_cmps*(num_digits), 1);
 				}
-#endif
 			}
 			// Cleanup
 			delete[] digits;
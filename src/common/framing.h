@@ -0,0 +1,149 @@
+#ifndef FRAMING_H__
+#define FRAMING_H__
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "ENCRYPTO_utils/socket.h"
+#include "comm_stats.h"
+
+/*
+ * Framed, buffered messages for the small control exchanges of the protocol.
+ *
+ * A FramedWriter collects the values of one protocol round and hands them to the transport as
+ * a single write, [u32 payload length][payload], on Flush(). A FramedReader pulls one frame
+ * with at most two reads and serves the values from memory, so a round costs one send and
+ * one receive per side no matter how many fields it carries. The same code runs over the node
+ * CSocket and over SCI NetIOs through the transports below.
+ */
+
+namespace ENCRYPTO {
+
+// Every write is one message on the calling node's CommMeter
+struct CSocketTransport {
+  CSocket *sock;
+
+  explicit CSocketTransport(std::unique_ptr<CSocket> &s) : sock(s.get()) {}
+  void Write(const void *data, std::size_t bytes) {
+    sock->Send(data, bytes);
+    if (CommMeter *meter = CommMeter::Current()) meter->SocketWrite();
+  }
+  void Read(void *data, std::size_t bytes) {
+    sock->Receive(data, bytes);
+    if (CommMeter *meter = CommMeter::Current()) meter->SocketRead();
+  }
+  void Flush() {}
+};
+
+template <typename IO>
+struct NetIOTransport {
+  IO *io;
+
+  explicit NetIOTransport(IO *i) : io(i) {}
+  void Write(const void *data, std::size_t bytes) { io->send_data(data, bytes); }
+  void Read(void *data, std::size_t bytes) { io->recv_data(data, bytes); }
+  void Flush() { io->flush(); }
+};
+
+template <typename Transport>
+class FramedWriter {
+ public:
+  explicit FramedWriter(Transport transport) : transport_(transport) { Reset(); }
+
+  FramedWriter &Put(const void *data, std::size_t bytes) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    buffer_.insert(buffer_.end(), p, p + bytes);
+    return *this;
+  }
+
+  template <typename T>
+  FramedWriter &Put(const T &value) {
+    static_assert(std::is_trivially_copyable<T>::value, "frames carry plain values");
+    return Put(&value, sizeof(T));
+  }
+
+  template <typename T>
+  FramedWriter &PutVector(const std::vector<T> &values) {
+    static_assert(std::is_trivially_copyable<T>::value, "frames carry plain values");
+    Put<uint64_t>(values.size());
+    return Put(values.data(), values.size() * sizeof(T));
+  }
+
+  FramedWriter &PutString(const std::string &str) {
+    Put<uint64_t>(str.size());
+    return Put(str.data(), str.size());
+  }
+
+  // Ends the round: one transport write for header and payload
+  void Flush() {
+    uint32_t length = static_cast<uint32_t>(buffer_.size() - sizeof(uint32_t));
+    std::memcpy(buffer_.data(), &length, sizeof(length));
+    transport_.Write(buffer_.data(), buffer_.size());
+    transport_.Flush();
+    Reset();
+  }
+
+ private:
+  void Reset() { buffer_.assign(sizeof(uint32_t), 0); }
+
+  Transport transport_;
+  std::vector<uint8_t> buffer_;
+};
+
+template <typename Transport>
+class FramedReader {
+ public:
+  explicit FramedReader(Transport transport) : transport_(transport) {}
+
+  // Receives the next frame; the previous one must have been consumed
+  FramedReader &Next() {
+    if (offset_ != buffer_.size()) throw std::runtime_error("FramedReader: unread frame data");
+    uint32_t length = 0;
+    transport_.Read(&length, sizeof(length));
+    buffer_.resize(length);
+    if (length > 0) transport_.Read(buffer_.data(), length);
+    offset_ = 0;
+    return *this;
+  }
+
+  void Get(void *data, std::size_t bytes) {
+    if (bytes > buffer_.size() - offset_) throw std::runtime_error("FramedReader: read past frame");
+    std::memcpy(data, buffer_.data() + offset_, bytes);
+    offset_ += bytes;
+  }
+
+  template <typename T>
+  T Get() {
+    static_assert(std::is_trivially_copyable<T>::value, "frames carry plain values");
+    T value;
+    Get(&value, sizeof(T));
+    return value;
+  }
+
+  template <typename T>
+  std::vector<T> GetVector() {
+    std::vector<T> values(Get<uint64_t>());
+    Get(values.data(), values.size() * sizeof(T));
+    return values;
+  }
+
+  std::string GetString() {
+    std::string str(Get<uint64_t>(), '\0');
+    Get(&str[0], str.size());
+    return str;
+  }
+
+ private:
+  Transport transport_;
+  std::vector<uint8_t> buffer_;
+  std::size_t offset_ = 0;
+};
+
+}  // namespace ENCRYPTO
+
+#endif  // FRAMING_H__
@@ -13,6 +13,17 @@
 #include "config.h"
 #include "batch_equality.h"
 #include "equality.h"
+#include "otpack_cache.h"
+#include "psm3_tuner.h"
+#include "perm_hash.h"
+#include "framing.h"
+#include "match.h"
+#include "memory_budget.h"
+#include "triple_store.h"
+#include "update_store.h"
+#include "ots/dh_oprf.h"
+#include "silent_ot.h"
+#include "trace_dump.h"
 #include <algorithm>
 #include <chrono>
 #include <fstream>
@@ -21,12 +32,16 @@
 #include <memory>
 #include <random>
 #include <ratio>
+#include <sstream>
 #include <unordered_set>
 #include <unordered_map>
 #include <cmath>
+#include <cstring>
+#include <limits>
 #include "table_opprf.h"
 
 #include <openssl/sha.h>
+#include <openssl/x509.h>
 #include <string>
 #include <cstdint>
 #include <numeric>
@@ -41,56 +56,67 @@
 
 namespace ENCRYPTO {  
 
-template<class T>
-std::vector<T> flatten(const std::vector<std::vector<T>>& data) {
-    std::vector<T> flat;
-    for (const auto& bucket : data) {
-        flat.insert(flat.end(), bucket.begin(), bucket.end());
-    }
-    return flat;
-}
-
 uint64_t generate_random_number(uint64_t max_value) {
     static std::mt19937_64 rng(std::random_device{}()); 
     std::uniform_int_distribution<uint64_t> dist(0, max_value);
     return dist(rng);
 }
 
-std::vector<uint64_t> fromClientOprfData(const std::vector<osuCrypto::block>& data,uint64_t size)
+/*
+ * Client query table: cuckoo hashing with nfuns functions into cnbins bins, one element per
+ * bin and the table's dummy in empty bins. Repeated query elements are inserted once; throws
+ * if an element ends up in the stash.
+ */
+std::vector<uint64_t> buildCuckooTable(InputView inputs, const PsiAnalyticsContext& context)
 {
-  std::vector<std::vector<uint64_t>> client_simple_table1(size);
-
-  // std::cout << "Number of OTs (outer vector size): " << data.size() << std::endl;
-  for (size_t i = 0; i < data.size() && i < size; ++i) {
-      std::vector<uint64_t> xor_result = blockToUint64Xor(data[i]);  
-      client_simple_table1[i].insert(client_simple_table1[i].end(), xor_result.begin(), xor_result.end());
-      
+  std::vector<uint64_t> elements(inputs.begin(), inputs.end());
+  std::sort(elements.begin(), elements.end());
+  elements.erase(std::unique(elements.begin(), elements.end()), elements.end());
+
+  CuckooTable cuckoo_table(static_cast<std::size_t>(context.cnbins));
+  cuckoo_table.SetNumOfHashFunctions(context.nfuns);
+  cuckoo_table.Insert(elements);
+  cuckoo_table.MapElements();
+
+  // stashed elements would never be queried and silently drop out of the result
+  if (cuckoo_table.GetStashSize() > 0u) {
+    throw std::runtime_error("buildCuckooTable: stash of size " + std::to_string(cuckoo_table.GetStashSize()) +
+                             ", increase --epsilon or --functions");
   }
-  return flatten(client_simple_table1);
+  return cuckoo_table.AsRawVector();
 }
 
-std::vector<std::vector<uint64_t>> fromServerOprfData(const std::vector<std::vector<osuCrypto::block>>& data,uint64_t sneles=8,uint64_t snbins=1)
+/*
+ * Server side of the same hashing: each of the node's sneles elements goes to all of its
+ * nfuns bins, once per bin even when two functions agree. bin_index[b][k] is the position in
+ * inputs of bins[b][k], i.e. the element's ciphertext in PSM2.
+ */
+std::vector<std::vector<uint64_t>> buildSimpleTable(InputView inputs, const PsiAnalyticsContext& context,
+                                                    std::vector<std::vector<uint32_t>>& bin_index)
 {
-  std::vector<std::vector<uint64_t>> simulated_simple_table_2(snbins);
-
-  size_t input_index1 = 0;
-  // std::cout << "Number of OTs (outer vector size): " << data.size() << std::endl;
-  for (size_t i = 0; i < snbins; ++i) {
-      if (i < data.size()) { 
-        size_t index1 = 0;
-        for (const auto &blk : data[i]) {
-          auto xor_result = blockToUint64Xor(blk);  
-          if (index1 % sneles == 0 && index1 != 0) {//
-                  std::vector<uint64_t> newRow; //
-                  simulated_simple_table_2.push_back(newRow);
-              }
-        
-            simulated_simple_table_2[i].insert(simulated_simple_table_2[i].end(), xor_result.begin(),
-                                              xor_result.end());
-        }
-      }
+  InputView first = inputs.first(context.sneles);
+  std::vector<uint64_t> elements(first.begin(), first.end());
+  std::unordered_map<uint64_t, uint32_t> position;
+  for (size_t i = 0; i < elements.size(); ++i)
+    position.emplace(elements[i], i);
+
+  std::sort(elements.begin(), elements.end());
+  elements.erase(std::unique(elements.begin(), elements.end()), elements.end());
+
+  SimpleTable simple_table(static_cast<std::size_t>(context.cnbins));
+  simple_table.SetNumOfHashFunctions(context.nfuns);
+  simple_table.Insert(elements);
+  simple_table.MapElements();
+  auto bins = simple_table.AsRaw2DVector();
+
+  bin_index.assign(bins.size(), {});
+  for (size_t b = 0; b < bins.size(); ++b) {
+    std::sort(bins[b].begin(), bins[b].end());
+    bins[b].erase(std::unique(bins[b].begin(), bins[b].end()), bins[b].end());
+    for (auto v : bins[b])
+      bin_index[b].push_back(position.at(v));
   }
-  return simulated_simple_table_2;
+  return bins;
 }
 
 size_t getSharedCount(const std::vector<bool>& isShared)
@@ -104,21 +130,10 @@ size_t getSharedCount(const std::vector<bool>& isShared)
   return count;
 }
 
-int generateRandomNumber(int min, int max) {
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> distrib(min, max);
-    return distrib(gen);
-}
 
-std::tuple<int, int> splitIntoShares(int number) {
-    int share1 = generateRandomNumber(1, 100);
-    int share2 = number - share1;
-    return std::make_tuple(share1, share2);
-}
-
-
-globalData<std::vector<uint64_t>> serverID;
+// per node: OPRF values of the simple-table bins, and each entry's element position
+globalData<std::vector<std::vector<uint64_t>>> serverID;
+globalData<std::vector<std::vector<uint32_t>>> serverIndex;
 globalData<std::vector<uint64_t>> clientID;
 
 
@@ -131,6 +146,10 @@ globalFlag Cf1,Cf2;
 globalFlag Sf1,Sf2;
 
 
+// --oprf-mode dh: the nodes' OPRF1 tables are with the center for its encoding
+globalFlag Sdh;
+
+
 NTL::ZZ ng[2];
 
 
@@ -170,24 +189,227 @@ size_t secondShared;
 int keyOfShared;
 
 
-// #define DEBUG
+/*
+ * Bit-length and batch of the PSM3 comparisons. With the OPPRF front end each bin compares one
+ * programmed value, wide enough for a false match probability of 2^-OPPRF_STAT_BITS overall;
+ * permutation hashing drops the bits the bin index carries.
+ */
+static void Psm3CompareShape(const PsiAnalyticsContext &context, int &l, int &batch)
+{
+  uint64_t num_cmps = context.nbins + context.nbins % 8;
+  l = (int)context.bitlen;
+  batch = 8;
+  if(context.psm3_perm_hash)
+    l = PermHashParams(context.bitlen, context.nbins).l;
+  if(context.psm3_opprf)
+  {
+    l = std::min(64, OPPRF_STAT_BITS + (int)std::ceil(std::log2(std::max<uint64_t>(num_cmps, 2))));
+    batch = 1;
+  }
+}
+
+/*
+ * Swaps party ids with the peer of this node. The server's address is no key: every client
+ * reaches it from elsewhere, and a server sees it as 0.0.0.0.
+ */
+void ExchangePeerId(std::unique_ptr<CSocket> &sock, PsiAnalyticsContext &context)
+{
+  const std::string& dir=context.otpack_cache.empty()?context.triple_store:context.otpack_cache;
+  FramedWriter<CSocketTransport>(CSocketTransport(sock)).Put(LocalPartyId(dir, context.role)).Flush();
+  FramedReader<CSocketTransport> reader{CSocketTransport(sock)};
+  context.peer_id=reader.Next().Get<uint64_t>();
+}
+
+/*
+ * OTPack of one slot, 2*lane for the leaf OTs and 2*lane+1 for the triples. With --otpack-cache
+ * the pack starts from the setup stored by an earlier run with the same peer.
+ */
+static sci::OTPack<sci::NetIO>* MakeLaneOTPack(sci::NetIO** ioArr, int slot, int party, int b, int l,
+                                               const PsiAnalyticsContext &context)
+{
+  sci::NetIO* io = ioArr[(slot/2)*SCI_IOS_PER_LANE + slot%2];
+  int pack_party = slot%2 == 0 ? party : 3-party;
+  const OTPackPlan plan = slot%2 == 0 ? LeafOTPlan(l, b, context.psm3_wan) : TripleOTPlan();
+  if(context.otpack_cache.empty())
+    return MakePlannedOTPack(io, pack_party, b, l, plan);
+  std::string peer = "peer" + std::to_string(context.peer_id);
+  return MakeOTPack(io, pack_party, b, l, plan,
+                    OTPackCachePath(context.otpack_cache, peer, context.index, slot, pack_party, l, b));
+}
+
+/*
+ * Base OTs for every PSM3 lane. Only the OT flavours BatchEquality uses are built: the leaf
+ * pack gets kkot_beta and the remainder variant for l % b, the triple pack kkot_16. All packs
+ * sit on disjoint NetIOs, so they are set up concurrently.
+ */
+void SetupOTPacks(sci::NetIO** ioArr, sci::OTPack<sci::NetIO>** otpackArr, int lanes, int party, int b, int l,
+                  const PsiAnalyticsContext &context)
+{
+  auto make_pack = [&](int slot)
+  {
+    otpackArr[slot] = MakeLaneOTPack(ioArr, slot, party, b, l, context);
+  };
+
+  std::vector<std::thread> pack_threads;
+  for(int slot=1; slot<2*lanes; slot++)
+    pack_threads.emplace_back(make_pack, slot);
+  make_pack(0);
+  for(auto& t : pack_threads)
+    t.join();
+}
 
-void run_circuit_dmsp2cq(const std::vector<std::uint64_t> &inputs, PsiAnalyticsContext &context, std::unique_ptr<CSocket> &sock,osuCrypto::Channel &chl)
+static std::string BoolTriplePoolPath(const PsiAnalyticsContext &context, int lane)
+{
+  std::string peer = "peer" + std::to_string(context.peer_id);
+  return BoolTriplePool::Path(context.triple_store, peer,
+                              std::to_string(context.index) + "_" + std::to_string(lane), context.role);
+}
+
+/*
+ * Offline phase of the boolean triple pool: every lane runs the 16-KKOT triple generation of
+ * BatchEquality for context.preprocess_bool_triples triples on its triple NetIO and stores the
+ * packed shares, replacing any earlier pool of that lane.
+ */
+void PreprocessBoolTriples(PsiAnalyticsContext &context, sci::NetIO** ioArr)
+{
+  int party = context.role == SERVER ? 1 : 2;
+  int l = (int)context.bitlen, b = (int)context.radix, batch;
+  Psm3CompareShape(context, l, batch);
+  uint64_t bytes = (context.preprocess_bool_triples + 7)/8;
+
+  auto fill_lane = [&](int lane)
+  {
+    sci::OTPack<sci::NetIO>* otpack = MakeLaneOTPack(ioArr, 2*lane+1, party, b, l, context);
+    sci::TripleGenerator<sci::NetIO> gen(3-party, ioArr[lane*SCI_IOS_PER_LANE+1], otpack);
+    sci::Triple triples(8*bytes, true);
+    gen.generate(3-party, &triples, sci::_16KKOT_to_4OT);
+
+    std::vector<PackedBoolTriples> packed(bytes);
+    for(uint64_t i=0; i<bytes; i++)
+      packed[i] = {triples.ai[i], triples.bi[i], triples.ci[i]};
+    std::string path = BoolTriplePoolPath(context, lane);
+    if(!BoolTriplePool::Write(path, context.role, packed))
+      std::cerr << "Failed to write boolean triple pool " << path << "\n";
+    delete otpack;
+  };
+
+  std::vector<std::thread> lane_threads;
+  for(int lane=1; lane<(int)context.psm3_threads; lane++)
+    lane_threads.emplace_back(fill_lane, lane);
+  fill_lane(0);
+  for(auto& t : lane_threads)
+    t.join();
+}
+
+/*
+ * Sizes of the data the nodes of one party hand each other in memory, counted as LINK_LOCAL
+ */
+static uint64_t BinBytes(const std::vector<std::vector<uint64_t>> &bins)
+{
+  uint64_t bytes=0;
+  for(const auto& bin : bins)
+    bytes+=bin.size()*sizeof(uint64_t);
+  return bytes;
+}
+
+static uint64_t IndexBytes(const std::vector<std::vector<uint32_t>> &index)
+{
+  uint64_t bytes=0;
+  for(const auto& bin : index)
+    bytes+=bin.size()*sizeof(uint32_t);
+  return bytes;
+}
+
+static uint64_t CiphertextBytes(const std::vector<NTL::ZZ> &data)
+{
+  uint64_t bytes=0;
+  for(const auto& c : data)
+    bytes+=NTL::NumBytes(c);
+  return bytes;
+}
+
+static uint64_t PublicKeyBytes(EVP_PKEY *key)
+{
+  int bytes=i2d_PUBKEY(key, nullptr);
+  return bytes>0?bytes:0;
+}
+
+/*
+ * Server tables spilled under --memory-budget: one dataset per node and OPRF with a partition
+ * per bin, in 16-byte records {value, element position} for PSM2
+ */
+static std::string SpillPath(const PsiAnalyticsContext &context, uint64_t node, const char *oprf)
+{
+  // the node ports of a run start at port-index, so runs side by side use different files
+  return context.spill_dir+"/dmsp2cq_"+to_string(context.port-context.index)+"_"+oprf+"_"+to_string(node)+".bins";
+}
+
+struct SpilledBins
+{
+  const Dataset &table;
+  InputView operator[](size_t b) const { return table.Elements(b); }
+};
+
+struct SpilledIndex
+{
+  const Dataset &table;
+  InputView operator[](size_t b) const { return table.Values(b); }
+};
+
+static std::vector<std::vector<uint64_t>> LoadSpilledBins(const Dataset &table)
+{
+  std::vector<std::vector<uint64_t>> bins(table.Partitions());
+  for(size_t b=0;b<bins.size();b++)
+    bins[b].assign(table.Elements(b).begin(),table.Elements(b).end());
+  return bins;
+}
+
+/*
+ * --oprf-mode dh: replaces every entry of tables by its OPRF value under this node's key. Values
+ * of entries a query encoded before come from the node's cache; only the others are encoded.
+ */
+static void DhEncodeTables(const std::vector<std::vector<std::vector<uint64_t>>*> &tables, const DhOprfKey &key,
+                           const PsiAnalyticsContext &context, bool second_oprf)
+{
+  std::vector<uint64_t> used;
+  for(const auto* table : tables)
+    for(const auto& bin : *table)
+      used.insert(used.end(),bin.begin(),bin.end());
+  std::sort(used.begin(),used.end());
+  used.erase(std::unique(used.begin(),used.end()),used.end());
+
+  DhOprfCache cache(context.oprf_cache,context.index,key.Id(),second_oprf);
+  std::vector<uint64_t> missing=cache.Missing(used);
+  cache.Add(missing,key.Evaluate(missing,second_oprf));
+  for(auto* table : tables)
+    for(auto& bin : *table)
+      for(auto& x : bin)
+        x=cache.Get(x);
+  cache.Save(used);
+
+  #ifdef DEBUG
+
+  std::ostringstream line;
+  line<<"Server "<<context.index<<" OPRF cache: "<<used.size()<<" elements, encoded "<<missing.size()<<"\n";
+  std::cout<<line.str();
+
+  #endif
+}
+
+void run_circuit_dmsp2cq(InputView inputs, InputView values, PsiAnalyticsContext &context, std::unique_ptr<CSocket> &sock,osuCrypto::Channel &chl)
 {
   Timer totalTime;
-  Timer psmTime;
+  Timer psmTime("psm");
 
   bool isLeader=context.index==0?true:false;
   bool isCenter=context.index==context.n-1?true:false;
 
   if (context.role == CLIENT)
   {
-    Timer computationTime;
+    Timer computationTime("hashing");
 
-    std::vector<std::vector<uint64_t>> simulated_cuckoo_table(context.cnbins);
-    for (auto i = 0ull; i < inputs.size(); ++i) {
-        simulated_cuckoo_table[i % context.cnbins].push_back(inputs[i]);
-    }
+    std::vector<uint64_t> cuckoo_table = buildCuckooTable(inputs, context);
+    MemCharge tableCharge(MEM_TABLES, cuckoo_table.size()*sizeof(uint64_t));
 
     context.timings.hint_computation=computationTime.end();
     
@@ -202,32 +424,27 @@ void run_circuit_dmsp2cq(const std::vector<std::uint64_t> &inputs, PsiAnalyticsC
         ng[1]=paillier->getG();
         std::stringstream ss;
         ss << ng[0]<<"|"<<ng[1];
-        std::string str=ss.str();
-        uint64_t len=str.size();
-        sock->Send(&len,sizeof(uint64_t));
-        sock->Send(str.data(),sizeof(char)*len);
+        FramedWriter<CSocketTransport>(CSocketTransport(sock)).PutString(ss.str()).Flush();
       }
     }
       psmTime.start();
-    std::vector<uint64_t> simulated_simple_table_1 = flatten(simulated_cuckoo_table);
+    EnterCommPhase(COMM_OPRF1);
     if(!isCenter)
     {
-      auto oprf_value = ot_receiver(simulated_simple_table_1, chl, context);
-
-      auto data=fromClientOprfData(oprf_value,context.cnbins);
+      std::vector<uint64_t> data;
+      if(context.oprf_mode == PsiAnalyticsContext::OPRF_DH)
+        data=dh_oprf_receiver(cuckoo_table, chl, context);
+      else
+      {
+        auto oprf_value = ot_receiver(cuckoo_table, chl, context, context.cnbins);
+        data=fromClientOprfData(oprf_value,context.cnbins);
+      }
 
       clientID.add(data,context.index);
+      CountLocalSend(data.size()*sizeof(uint64_t));
 
-      #ifdef DEBUG
-
-      // write to file
-
-      std::vector<std::vector<uint64_t>> tmp;
-      tmp.push_back(fromClientOprfData(oprf_value,1));
-
-      writeToCSV(tmp,"Client_Oprf1_"+to_string(context.index)+".csv");
-
-      #endif
+      if(TraceEnabled(TRACE_OPRF1))
+        TraceSubmit(TRACE_OPRF1,context.index,"Client_Oprf1_"+to_string(context.index),std::move(data));
 
       #if 0
 
@@ -241,27 +458,32 @@ void run_circuit_dmsp2cq(const std::vector<std::uint64_t> &inputs, PsiAnalyticsC
     }
     waitFor(Cf1,[&]()
     {
-      clientID.add(simulated_simple_table_1,context.index);
+      clientID.add(cuckoo_table,context.index);
     },isCenter,context.n-1);
+    EnterCommPhase(COMM_OPRF2);
     if(isCenter)
     {
-      auto oprf_value = ot_receiver(flatten(clientID.data()), chl, context,context.n);
-      
-      std::vector<std::vector<uint64_t>> data;
-
-      for(const auto& i : oprf_value)
-        data.push_back(blockToUint64Xor(i));
+      for(int i=0;i<context.n-1;i++)
+        CountLocalRecv(context.cnbins*sizeof(uint64_t));
 
-      for(int i=0;i<data.size();i++)
-        clientID.add(data[i],i);
-
-      #ifdef DEBUG
-
-      // write to file
+      // OT index i*cnbins+b: bin b of node i
+      std::vector<uint64_t> data;
+      if(context.oprf_mode == PsiAnalyticsContext::OPRF_DH)
+        data=dh_oprf_receiver(flatten(clientID.data()), chl, context, true);
+      else
+      {
+        auto oprf_value = ot_receiver(flatten(clientID.data()), chl, context, context.n*context.cnbins, true);
+        data=fromClientOprfData(oprf_value,oprf_value.size());
+      }
 
-      writeToCSV(clientID.data(),"Client_Oprf2_"+to_string(context.index)+".csv");
+      for(int i=0;i<context.n;i++)
+        clientID.add(std::vector<uint64_t>(data.begin()+i*context.cnbins,data.begin()+(i+1)*context.cnbins),i);
+      // the leader matches on the OPRF2 values of all nodes
+      if(!isLeader)
+        CountLocalSend(data.size()*sizeof(uint64_t));
 
-      #endif
+      if(TraceEnabled(TRACE_OPRF2))
+        TraceSubmit(TRACE_OPRF2,context.index,"Client_Oprf2_"+to_string(context.index),clientID.data());
     }
     else
     {
@@ -282,26 +504,22 @@ void run_circuit_dmsp2cq(const std::vector<std::uint64_t> &inputs, PsiAnalyticsC
     if(isLeader)
     {
       auto data=flatten(clientID.data());
-      sock->Send(data.data(),sizeof(uint64_t)*context.n*context.cnbins);
+      if(!isCenter)
+        CountLocalRecv(data.size()*sizeof(uint64_t));
+      EnterCommPhase(COMM_MATCH);
+      CSocketTransport(sock).Write(data.data(),sizeof(uint64_t)*context.n*context.cnbins);
       if(context.psm_type == PsiAnalyticsContext::PSM1)
       {
-        uint64_t num;
-        sock->Receive(&num,sizeof(num));
+        FramedReader<CSocketTransport> reader{CSocketTransport(sock)};
+        uint64_t num=reader.Next().Get<uint64_t>();
 
         std::cout<<"Leader Client Recv num : "<<num<<"\n";
       
       }
       else if(context.psm_type == PsiAnalyticsContext::PSM2)
       {
-        uint64_t len;
-        sock->Receive(&len,sizeof(uint64_t));
-
-        char* str=new char[len];
-        sock->Receive(str,sizeof(char)*len);
-
-        std::string sum_str(str);
-
-        delete[] str;
+        FramedReader<CSocketTransport> reader{CSocketTransport(sock)};
+        std::string sum_str=reader.Next().GetString();
 
         NTL::ZZ sum=NTL::conv<NTL::ZZ>(sum_str.c_str());
 
@@ -310,7 +528,7 @@ void run_circuit_dmsp2cq(const std::vector<std::uint64_t> &inputs, PsiAnalyticsC
         std::cout<<"Leader Client Recv sum : "<<sum<<"\n";
 
         #endif
-        Timer decryptTime;
+        Timer decryptTime("decrypt");
 
         NTL::ZZ original_sum=Paillier::decryptNumber(sum,paillier->getN(),paillier->getLambda(),paillier->getLambdaInverse());
         
@@ -328,34 +546,100 @@ void run_circuit_dmsp2cq(const std::vector<std::uint64_t> &inputs, PsiAnalyticsC
   }
   else
   {//server
-    Timer computationTime;
-
-    std::vector<std::vector<uint64_t>> simulated_simple_table_1(context.snbins);
-    size_t input_index = 0;
-    for (size_t i = 0; i < context.snbins && input_index < inputs.size(); ++i) {
-        //for (size_t j = 0; j < i % 3 + 2 && input_index < inputs.size(); ++j)
-        for (size_t j = 0; j < context.sneles;++j) {
-          simulated_simple_table_1[i].push_back(inputs[input_index++]);
-        }
+    Timer computationTime("hashing");
+
+    // every node takes the same decision from the set sizes, the center and the leader rely on it
+    const bool psm2=context.psm_type == PsiAnalyticsContext::PSM2;
+    // the DH mode encodes the tables in place before the query, they are not spilled
+    const bool dh=context.oprf_mode == PsiAnalyticsContext::OPRF_DH;
+    const bool spill=!dh && MemoryBudget::Instance().Exceeds(MEM_TABLES,
+        context.n*context.sneles*context.nfuns*(sizeof(uint64_t)+(psm2?sizeof(uint32_t):0)));
+    if(spill)
+      MemoryBudget::Instance().MarkExternal(MEM_TABLES);
+
+    std::vector<std::vector<uint32_t>> bin_index;
+    std::vector<std::vector<uint64_t>> simple_table;
+    // with a store, only what its log changed since the last query is hashed (and encrypted)
+    std::unique_ptr<NodeStore> store;
+    context.timings.update=0;
+    if(!context.store_dir.empty())
+    {
+      Timer updateTime("update");
+      store.reset(new NodeStore(context.store_dir, context.index, context.cnbins, context.nfuns));
+      store->Sync(inputs.first(context.sneles), values.first(context.sneles));
+      store->TakeTable(simple_table, bin_index);
+      context.timings.update=updateTime.end();
     }
+    else
+      simple_table = buildSimpleTable(inputs, context, bin_index);
+    MemCharge tableCharge(MEM_TABLES, BinBytes(simple_table)+IndexBytes(bin_index));
+    const uint64_t indexBytes=IndexBytes(bin_index);
+    // spilled, the positions go to the spill files with the OPRF values
+    if(!spill)
+      serverIndex.add(std::move(bin_index), context.index);
+    MemCharge cipherCharge(MEM_CIPHERTEXTS);
 
     context.timings.hint_computation=computationTime.end();
 
-    Timer encryptTime;
+    // DH mode: the tables are encoded under the nodes' long-lived keys before the client's OPRF
+    // runs, from the caches as far as they reach; the query only answers blinded points
+    std::unique_ptr<DhOprfKey> dhKey;
+    context.timings.oprf_encode=0;
+    if(dh)
+    {
+      Timer encodeTime("oprf_encode");
+      dhKey.reset(new DhOprfKey(context.oprf_cache, context.index));
+      if(!isCenter)
+      {
+        DhEncodeTables({&simple_table}, *dhKey, context, false);
+        CountLocalSend(BinBytes(simple_table));
+        if(TraceEnabled(TRACE_OPRF1))
+          TraceSubmit(TRACE_OPRF1,context.index,"Server_Oprf1_"+to_string(context.index),simple_table);
+        serverID.add(std::move(simple_table),context.index);
+        Sdh++;
+      }
+      waitFor(Sdh,[&]()
+      {
+        // the center's own entries go into OPRF2 as they are, as on the client side
+        std::vector<std::vector<std::vector<uint64_t>>*> tables;
+        uint64_t bytes=0;
+        for(int i=0;i<context.n;i++)
+          if(i!=context.index)
+          {
+            tables.push_back(&serverID.at(i));
+            bytes+=BinBytes(serverID.at(i));
+          }
+        tables.push_back(&simple_table);
+        CountLocalRecv(bytes);
+        DhEncodeTables(tables, *dhKey, context, true);
+        serverID.add(std::move(simple_table),context.index);
+
+        if(!isLeader)
+        {
+          bytes=0;
+          for(int i=0;i<context.n;i++)
+            bytes+=BinBytes(serverID.at(i));
+          CountLocalSend(bytes);
+        }
+        if(TraceEnabled(TRACE_OPRF2))
+        {
+          std::vector<std::vector<uint64_t>> data;
+          for(int i=0;i<context.n;i++)
+            data.insert(data.end(),serverID.at(i).begin(),serverID.at(i).end());
+          TraceSubmit(TRACE_OPRF2,context.index,"Server_Oprf2_"+to_string(context.index),std::move(data));
+        }
+      },isCenter,context.n-1);
+      context.timings.oprf_encode=encodeTime.end();
+    }
+
+    Timer encryptTime("encrypt");
     if(context.psm_type == PsiAnalyticsContext::PSM2)
     {
       if(isLeader)
       {
-        uint64_t len;
-        sock->Receive(&len,sizeof(uint64_t));
-
         // n g
-        char* str=new char[len];
-        sock->Receive(str,sizeof(char)*len);
-        
-        std::string ng_str(str);
-
-        delete[] str;
+        FramedReader<CSocketTransport> reader{CSocketTransport(sock)};
+        std::string ng_str=reader.Next().GetString();
         uint64_t i=ng_str.find('|');
         const std::string& n_str=ng_str.substr(0,i);
         const std::string& g_str=ng_str.substr(i+1,std::string::npos);
@@ -379,6 +663,16 @@ void run_circuit_dmsp2cq(const std::vector<std::uint64_t> &inputs, PsiAnalyticsC
         
       waitFor(Sf2_Ng,[=](){},isCenter,context.n-1);
 
+      // the leader passes the client's public key on to the other nodes
+      uint64_t ngBytes=NTL::NumBytes(ng[0])+NTL::NumBytes(ng[1]);
+      if(isLeader)
+      {
+        for(int i=1;i<context.n;i++)
+          CountLocalSend(ngBytes);
+      }
+      else
+        CountLocalRecv(ngBytes);
+
       #if 0
 
       std::cout<<"Server "<<to_string(context.index)<<" ng:"<<ng[0]<<" "<<ng[1]<<"\n";
@@ -387,7 +681,37 @@ void run_circuit_dmsp2cq(const std::vector<std::uint64_t> &inputs, PsiAnalyticsC
       std::vector<NTL::ZZ> encryptData;
       #if 1
 
-      if(!fileExists("Server_Data_EncryptData_"+to_string(context.index)+".csv"))
+      if(store)
+      {
+        Timer updateTime("update");
+        encryptData=store->Ciphertexts(ng[0],[&](const std::vector<uint64_t>& plain)
+        {
+          std::vector<NTL::ZZ> numbers(plain.size());
+          for(size_t i=0;i<plain.size();i++)
+            numbers[i]=NTL::conv<NTL::ZZ>(plain[i]);
+          return Paillier::encrypt(numbers,ng[0],ng[1]);
+        });
+        context.timings.update+=updateTime.end();
+
+        #ifdef DEBUG
+
+        const StoreStats& stats=store->Stats();
+        std::ostringstream line;
+        line<<"Server "<<context.index<<" store: "<<stats.live<<" elements, +"<<stats.added<<" -"<<stats.deleted
+            <<(stats.rebuilt?" rebuilt":"")<<(stats.compacted?" compacted":"")<<", encrypted "<<stats.encrypted<<"\n";
+        std::cout<<line.str();
+
+        #endif
+      }
+      else if(!values.empty())
+      {
+        // the dataset's values, not cached: they change with the dataset
+        std::vector<NTL::ZZ> numbers(context.sneles);
+        for(size_t i=0;i<numbers.size();i++)
+          numbers[i]=i<values.size()?NTL::conv<NTL::ZZ>(values[i]):NTL::ZZ(0);
+        encryptData=Paillier::encrypt(numbers,ng[0],ng[1]);
+      }
+      else if(!fileExists("Server_Data_EncryptData_"+to_string(context.index)+".csv"))
       {
         std::vector<NTL::ZZ> numbers=Paillier::numbers(context.sneles);
         encryptData=Paillier::encrypt(numbers,ng[0],ng[1]);
@@ -416,9 +740,14 @@ void run_circuit_dmsp2cq(const std::vector<std::uint64_t> &inputs, PsiAnalyticsC
       #endif
 
       #endif
+      const uint64_t cipherBytes=CiphertextBytes(encryptData);
+      cipherCharge.Set(cipherBytes);
       Timer addtime;
-      serverData.add(encryptData, context.index);
+      serverData.add(std::move(encryptData), context.index);
       context.timings.addtime=addtime.end();
+      // ciphertexts and their bin positions go to the leader
+      if(!isLeader)
+        CountLocalSend(cipherBytes+(spill?0:indexBytes));
       context.timings.encrypt=encryptTime.end();
 
     }
@@ -430,29 +759,39 @@ void run_circuit_dmsp2cq(const std::vector<std::uint64_t> &inputs, PsiAnalyticsC
     waitFor(
         Sf2,
         [&]() {
-          dataOfPsm2=serverData.data();
+          dataOfPsm2=serverData.take();
+          if(context.psm_type == PsiAnalyticsContext::PSM2)
+          {
+            for(int i=1;i<context.n;i++)
+              CountLocalRecv(CiphertextBytes(dataOfPsm2[i])+(spill?0:IndexBytes(serverIndex.getByPos(i))));
+          }
         },
         isLeader, context.n);
 
-    Timer wholeoprf;
+    Timer wholeoprf("oprf");
     psmTime.start();
-    if(!isCenter)
+    EnterCommPhase(COMM_OPRF1);
+    if(dh)
     {
-      auto oprf_value = ot_sender(simulated_simple_table_1, chl, context);
-
-      auto raw_data=fromServerOprfData(oprf_value,context.sneles,1);
-
-      #ifdef DEBUG
-
-      // write to file
-
-      writeToCSV(raw_data,"Server_Oprf1_"+to_string(context.index)+".csv");
-
-      #endif
+      if(!isCenter)
+        dh_oprf_sender(*dhKey, chl, context, context.cnbins);
+    }
+    else if(!isCenter && !spill)
+    {
+      // the outputs replace the table bin by bin, it is not read after its OPRF
+      ot_sender_stream([&](size_t b) -> InputView { return simple_table[b]; },
+                       [&](size_t first, std::vector<std::vector<uint64_t>>& out)
+                       {
+                         for(size_t k=0;k<out.size();k++)
+                           simple_table[first+k]=std::move(out[k]);
+                       },
+                       chl, context, context.cnbins);
 
-      auto data=raw_data[0];
+      CountLocalSend(BinBytes(simple_table));
 
-      serverID.add(data,context.index);
+      if(TraceEnabled(TRACE_OPRF1))
+        TraceSubmit(TRACE_OPRF1,context.index,"Server_Oprf1_"+to_string(context.index),simple_table);
+      serverID.add(std::move(simple_table),context.index);
 
       #ifdef DEBUG
 
@@ -464,24 +803,144 @@ void run_circuit_dmsp2cq(const std::vector<std::uint64_t> &inputs, PsiAnalyticsC
 
       #endif
     }
-    waitFor(Sf1,[&]()
-    {
-      serverID.add(simulated_simple_table_1[0],context.index);
-    },isCenter,context.n-1);
-    if(isCenter)
+    else if(!isCenter)
     {
-      auto oprf_value = ot_sender(serverID.data(), chl, context, context.n);
-
-      //
-      auto data=fromServerOprfData(oprf_value,context.sneles,context.sneles);
+      // the outputs go to this node's spill file as they are encoded
+      DatasetWriter writer(SpillPath(context,context.index,"oprf1"),psm2?16:8,context.cnbins);
+      uint64_t entries=0;
+      ot_sender_stream([&](size_t b) -> InputView { return simple_table[b]; },
+                       [&](size_t first, std::vector<std::vector<uint64_t>>& out)
+                       {
+                         for(size_t k=0;k<out.size();k++)
+                         {
+                           writer.BeginPartition();
+                           for(size_t j=0;j<out[k].size();j++)
+                             writer.Add(out[k][j],psm2?bin_index[first+k][j]:0);
+                           entries+=out[k].size();
+                         }
+                       },
+                       chl, context, context.cnbins);
+      writer.Close();
+      std::vector<std::vector<uint64_t>>().swap(simple_table);
+      std::vector<std::vector<uint32_t>>().swap(bin_index);
+      tableCharge.Set(0);
+
+      CountLocalSend(entries*sizeof(uint64_t));
+
+      if(TraceEnabled(TRACE_OPRF1))
+        TraceSubmit(TRACE_OPRF1,context.index,"Server_Oprf1_"+to_string(context.index),
+                    LoadSpilledBins(Dataset(SpillPath(context,context.index,"oprf1"))));
 
-      #ifdef DEBUG
-
-      writeToCSV(data,"Server_Oprf2_"+to_string(context.index)+".csv");
+      Sf1++;
+    }
+    if(!dh)
+      waitFor(Sf1,[&]()
+      {
+        if(!spill)
+          serverID.add(std::move(simple_table),context.index);
+      },isCenter,context.n-1);
+    EnterCommPhase(COMM_OPRF2);
+    if(dh)
+    {
+      // the tables are all in serverID already, no node waits for the center
+      if(isCenter)
+        dh_oprf_sender(*dhKey, chl, context, context.n*context.cnbins, true);
+    }
+    else if(isCenter && !spill)
+    {
+      // OT index i*cnbins+b: bin b of node i, as on the client side. The other nodes wait on Sf2,
+      // so the bins are encoded and overwritten in place in serverID
+      uint64_t bytes=0;
+      for(int i=0;i<context.n;i++)
+        if(i!=context.index)
+          bytes+=BinBytes(serverID.at(i));
+      CountLocalRecv(bytes);
+
+      auto bin=[&](size_t ot) -> std::vector<uint64_t>& { return serverID.at(ot/context.cnbins)[ot%context.cnbins]; };
+      ot_sender_stream(bin,
+                       [&](size_t first, std::vector<std::vector<uint64_t>>& out)
+                       {
+                         for(size_t k=0;k<out.size();k++)
+                           bin(first+k)=std::move(out[k]);
+                       },
+                       chl, context, context.n*context.cnbins, true);
+
+      if(!isLeader)
+      {
+        bytes=0;
+        for(int i=0;i<context.n;i++)
+          bytes+=BinBytes(serverID.at(i));
+        CountLocalSend(bytes);
+      }
 
-      #endif
-      for(int i=0;i<data.size();i++)
-        serverID.add(data[i],i);
+      if(TraceEnabled(TRACE_OPRF2))
+      {
+        std::vector<std::vector<uint64_t>> data;
+        for(int i=0;i<context.n;i++)
+          data.insert(data.end(),serverID.at(i).begin(),serverID.at(i).end());
+        TraceSubmit(TRACE_OPRF2,context.index,"Server_Oprf2_"+to_string(context.index),std::move(data));
+      }
+    }
+    else if(isCenter)
+    {
+      // from the OPRF1 spill files to the OPRF2 ones; only the center's own table is in memory,
+      // and at most the two nodes a chunk spans are mapped at a time
+      std::vector<std::unique_ptr<Dataset>> oprf1(context.n);
+      std::unique_ptr<DatasetWriter> oprf2;
+      uint64_t bytes=0;
+      auto bin=[&](size_t ot) -> InputView
+      {
+        size_t i=ot/context.cnbins, b=ot%context.cnbins;
+        if(i==context.index)
+          return simple_table[b];
+        if(!oprf1[i])
+        {
+          oprf1[i].reset(new Dataset(SpillPath(context,i,"oprf1")));
+          CountLocalRecv(oprf1[i]->Records()*sizeof(uint64_t));
+        }
+        return oprf1[i]->Elements(b);
+      };
+      ot_sender_stream(bin,
+                       [&](size_t first, std::vector<std::vector<uint64_t>>& out)
+                       {
+                         for(size_t k=0;k<out.size();k++)
+                         {
+                           size_t i=(first+k)/context.cnbins, b=(first+k)%context.cnbins;
+                           if(b==0)
+                             oprf2.reset(new DatasetWriter(SpillPath(context,i,"oprf2"),psm2?16:8,context.cnbins));
+                           oprf2->BeginPartition();
+                           for(size_t j=0;j<out[k].size();j++)
+                             oprf2->Add(out[k][j],!psm2?0:i==context.index?bin_index[b][j]:oprf1[i]->Values(b)[j]);
+                           bytes+=out[k].size()*sizeof(uint64_t);
+                           if(b==context.cnbins-1)
+                           {
+                             oprf2->Close();
+                             if(oprf1[i])
+                             {
+                               oprf1[i].reset();
+                               std::remove(SpillPath(context,i,"oprf1").c_str());
+                             }
+                           }
+                         }
+                       },
+                       chl, context, context.n*context.cnbins, true);
+      std::vector<std::vector<uint64_t>>().swap(simple_table);
+      std::vector<std::vector<uint32_t>>().swap(bin_index);
+      tableCharge.Set(0);
+
+      if(!isLeader)
+        CountLocalSend(bytes);
+
+      if(TraceEnabled(TRACE_OPRF2))
+      {
+        std::vector<std::vector<uint64_t>> data;
+        for(int i=0;i<context.n;i++)
+        {
+          auto bins=LoadSpilledBins(Dataset(SpillPath(context,i,"oprf2")));
+          data.insert(data.end(),bins.begin(),bins.end());
+        }
+        TraceSubmit(TRACE_OPRF2,context.index,"Server_Oprf2_"+to_string(context.index),std::move(data));
+      }
     }
     else
     {
@@ -495,45 +954,61 @@ void run_circuit_dmsp2cq(const std::vector<std::uint64_t> &inputs, PsiAnalyticsC
 
       #endif
     }
-    waitFor(Sf2,[=]()
-    {
-      // 
-    },isCenter,context.n-1);
+    if(!dh)
+      waitFor(Sf2,[=]()
+      {
+        // 
+      },isCenter,context.n-1);
 
     context.timings.wholeoprf=wholeoprf.end();
     if(isLeader)
     {
       std::vector<uint64_t> dataOfClient(context.n*context.cnbins);
-      std::vector<std::vector<uint64_t>> dataOfServer=serverID.data();
-
-      sock->Receive(dataOfClient.data(),sizeof(uint64_t)*context.cnbins*context.n);
+      MemCharge matchCharge(MEM_MATCH, dataOfClient.size()*sizeof(uint64_t));
+      std::vector<std::vector<std::vector<uint64_t>>> dataOfServer;
+      std::vector<std::vector<std::vector<uint32_t>>> indexOfServer;
+      // spilled, the tables stay mapped and the match reads them node by node
+      std::vector<std::unique_ptr<Dataset>> spilled;
+      uint64_t bytes=0;
+      if(!spill)
+      {
+        dataOfServer=serverID.take();
+        indexOfServer=serverIndex.take();
+        for(const auto& bins : dataOfServer)
+          bytes+=BinBytes(bins);
+      }
+      else
+      {
+        for(int i=0;i<context.n;i++)
+        {
+          spilled.emplace_back(new Dataset(SpillPath(context,i,"oprf2")));
+          bytes+=spilled[i]->Records()*sizeof(uint64_t);
+        }
+      }
+      if(!isCenter)
+        CountLocalRecv(bytes);
+      EnterCommPhase(COMM_MATCH);
 
-      #ifdef DEBUG
+      CSocketTransport(sock).Read(dataOfClient.data(),sizeof(uint64_t)*context.cnbins*context.n);
 
-      writeToCSV(dataOfServer,"Server_All_ID.csv");
-      writeToCSV(serverData.data(),"Server_All_EncryptData.csv");
-      std::vector<std::vector<uint64_t>> tmp;
-      tmp.push_back(dataOfClient);
-      writeToCSV(tmp,"Client_All_ID.csv");
+      if(TraceEnabled(TRACE_MATCH))
+      {
+        for(int i=0;i<context.n;i++)
+          TraceSubmit(TRACE_MATCH,i,"Server_All_ID_"+to_string(i),spill?LoadSpilledBins(*spilled[i]):dataOfServer[i]);
+        TraceSubmit(TRACE_MATCH,context.index,"Client_All_ID",dataOfClient);
+      }
 
-      #endif
+      // A client value can only match in the same node and bin, so only that bin is scanned
       if(context.psm_type == PsiAnalyticsContext::PSM1)
     
       {
-        Timer search;
+        Timer search("match");
         uint64_t count=0;
-
-        for(int i=0;i<dataOfClient.size();i++)
-        {
-          for(int j=0;j<dataOfServer.size();j++)
-          {
-            for(int k=0;k<dataOfServer[j].size();k++)
-            {
-              if(dataOfClient[i]==dataOfServer[j][k])
-                count++;
-            }
-          }
-        }
+        if(!spill)
+          count=CountBinMatches(dataOfServer,dataOfClient,context.cnbins);
+        else
+          for(int i=0;i<context.n;i++)
+            count+=CountNodeMatches(SpilledBins{*spilled[i]},dataOfClient.data()+i*context.cnbins,context.cnbins);
 
 
         std::cout<<"Count : "<<count<<"\n";
@@ -543,29 +1018,22 @@ void run_circuit_dmsp2cq(const std::vector<std::uint64_t> &inputs, PsiAnalyticsC
           num=1;
         else if(count>context.g)
           num=2;
-        sock->Send(&num,sizeof(num));
+        FramedWriter<CSocketTransport>(CSocketTransport(sock)).Put(num).Flush();
         context.timings.search=search.end();
         // std::cout<<"Search Time : "<<context.timings.search<<"\n";
       }
       else if(context.psm_type == PsiAnalyticsContext::PSM2)
       {
-        Timer search;
+        Timer search("match");
 
         NTL::ZZ sum=Paillier::encryptNumber(NTL::ZZ(0), ng[0], ng[1]);
-
-        for(int i=0;i<dataOfClient.size();i++)
-        {
-          for(int j=0;j<dataOfServer.size();j++)
-          {
-            for(int k=0;k<dataOfServer[j].size();k++)
-            {
-              if(dataOfClient[i]==dataOfServer[j][k])
-              {
-                sum = (sum * dataOfPsm2[j][k]) % (ng[0] * ng[0]);
-              }
-            }
-          }
-        }
+        const NTL::ZZ n2=ng[0]*ng[0];
+        if(!spill)
+          sum=MultiplyBinMatches(sum,dataOfServer,indexOfServer,dataOfClient,context.cnbins,dataOfPsm2,n2);
+        else
+          for(int i=0;i<context.n;i++)
+            sum=MultiplyNodeMatches(sum,SpilledBins{*spilled[i]},SpilledIndex{*spilled[i]},
+                                    dataOfClient.data()+i*context.cnbins,context.cnbins,dataOfPsm2[i],n2);
 
         #if 0
 
@@ -576,15 +1044,17 @@ void run_circuit_dmsp2cq(const std::vector<std::uint64_t> &inputs, PsiAnalyticsC
           std::stringstream ss;
           ss << sum;
 
-          std::string str = ss.str();
-          uint64_t len = str.size();
-
-          sock->Send(&len, sizeof(uint64_t));
-          sock->Send(str.c_str(), sizeof(char) * len);
+          FramedWriter<CSocketTransport>(CSocketTransport(sock)).PutString(ss.str()).Flush();
 
           context.timings.search = search.end();
           //std::cout << "Search Time : " << context.timings.search << "\n";
       }
+
+      for(size_t i=0;i<spilled.size();i++)
+      {
+        spilled[i].reset();
+        std::remove(SpillPath(context,i,"oprf2").c_str());
+      }
     }
   }
 
@@ -592,27 +1062,154 @@ void run_circuit_dmsp2cq(const std::vector<std::uint64_t> &inputs, PsiAnalyticsC
   context.timings.total=totalTime.end();
 }
 
-void run_circuit_dmsp2cq3(const std::vector<std::uint64_t> &inputs, PsiAnalyticsContext &context, std::unique_ptr<CSocket> &sock,
-  sci::NetIO* ioArr[2], osuCrypto::Channel &chl)
+/*
+ * Beaver product of the client's result bits x with the server's y for all results of a node
+ * at once. Each input is held by one side only (x = x0 + 0, y = 0 + y1), so the server can
+ * open its masked halves in the same frame that fixes the triples: one frame S->C per result
+ * set, one frame C->S {e0,f0}. With a triple store the server frame names the first stored
+ * triple {index, e1, f1...}; otherwise, or once the store runs dry, it deals them inline
+ * {NO_STORED_TRIPLES, a0, b0, c0, e1, f1...}. Returns this party's additive share of x*y.
+ */
+static const uint64_t NO_STORED_TRIPLES = std::numeric_limits<uint64_t>::max();
+
+static std::vector<int> MultiplyResultBits(std::unique_ptr<CSocket> &sock, bool server, const std::vector<int> &v,
+                                           TripleStore &store, std::mt19937 &rng)
+{
+  TraceSpan span("multiply");
+  size_t count=v.size();
+  std::vector<int> z(count);
+  std::vector<ArithTriple> triples(count), dealt;
+  std::vector<int> masked(2*count), opened(2*count);
+  FramedWriter<CSocketTransport> writer{CSocketTransport(sock)};
+  FramedReader<CSocketTransport> reader{CSocketTransport(sock)};
+
+  if(server)
+  {
+    uint64_t first=NO_STORED_TRIPLES;
+    if(store.Available()>=count)
+    {
+      first=store.Next();
+      triples=store.Take(count);
+    }
+    else
+    {
+      dealt.resize(count);
+      for(size_t i=0; i<count; i++)
+        DealArithTriple(rng, triples[i], dealt[i]);
+    }
+    for(size_t i=0; i<count; i++)
+    {
+      masked[2*i]=-triples[i].a;          // e1 = x1 - a1
+      masked[2*i+1]=v[i]-triples[i].b;    // f1 = y1 - b1
+    }
+    writer.Put(first);
+    if(first==NO_STORED_TRIPLES)
+      writer.PutVector(dealt);
+    writer.PutVector(masked).Flush();
+    opened=reader.Next().GetVector<int>();
+
+    for(size_t i=0; i<count; i++)
+    {
+      int e=opened[2*i]+masked[2*i];
+      int f=opened[2*i+1]+masked[2*i+1];
+      z[i]=triples[i].c+triples[i].a*f+triples[i].b*e;
+    }
+  }
+  else
+  {
+    reader.Next();
+    uint64_t first=reader.Get<uint64_t>();
+    if(first==NO_STORED_TRIPLES)
+    {
+      triples=reader.GetVector<ArithTriple>();
+    }
+    else
+    {
+      if(!store.IsOpen() || store.Next()!=first)
+        throw std::runtime_error("Triple store out of sync with the server (client at "+
+                                 std::to_string(store.Next())+", server at "+std::to_string(first)+")");
+      triples=store.Take(count);
+    }
+    masked=reader.GetVector<int>();
+    for(size_t i=0; i<count; i++)
+    {
+      opened[2*i]=v[i]-triples[i].a;   // e0 = x0 - a0
+      opened[2*i+1]=-triples[i].b;     // f0 = y0 - b0
+    }
+    writer.PutVector(opened).Flush();
+
+    for(size_t i=0; i<count; i++)
+    {
+      int e=opened[2*i]+masked[2*i];
+      int f=opened[2*i+1]+masked[2*i+1];
+      z[i]=triples[i].c+triples[i].a*f+triples[i].b*e+e*f;
+    }
+  }
+  return z;
+}
+
+static std::string TripleStorePath(const PsiAnalyticsContext &context)
+{
+  std::string peer = "peer" + std::to_string(context.peer_id);
+  return TripleStore::Path(context.triple_store, peer, std::to_string(context.index), context.role);
+}
+
+/*
+ * Offline phase of --triple-store: the server node deals context.preprocess_triples triples to
+ * its client node in one frame and both persist their shares, replacing any earlier batch.
+ */
+void PreprocessTriples(std::unique_ptr<CSocket> &sock, PsiAnalyticsContext &context)
+{
+  std::vector<ArithTriple> mine(context.preprocess_triples), theirs;
+  if(context.role==SERVER)
+  {
+    std::mt19937 rng(std::random_device{}());
+    theirs.resize(mine.size());
+    for(size_t i=0; i<mine.size(); i++)
+      DealArithTriple(rng, mine[i], theirs[i]);
+    FramedWriter<CSocketTransport>(CSocketTransport(sock)).PutVector(theirs).Flush();
+  }
+  else
+  {
+    FramedReader<CSocketTransport> reader{CSocketTransport(sock)};
+    mine=reader.Next().GetVector<ArithTriple>();
+  }
+
+  std::string path=TripleStorePath(context);
+  if(!TripleStore::Write(path, context.role, mine))
+    throw std::runtime_error("Failed to write triple store "+path);
+}
+
+void run_circuit_dmsp2cq3(InputView inputs, PsiAnalyticsContext &context, std::unique_ptr<CSocket> &sock,
+  sci::NetIO** ioArr, osuCrypto::Channel &chl, std::vector<osuCrypto::Channel> &silentChls)
 {
   Timer totalTime;
-  Timer psmTime;
+  Timer psmTime("psm");
   bool isLeader=context.index==0?true:false;
   std::vector<uint64_t> client_of_bins;
   std::vector<uint64_t> server_of_bins;
 
-  int batch_size=8;
+  int batch_size=8;  // server entries per bin
   int party=2;
   if(context.role == 0) {
     party=1;
   }
   
-  sci::OTPack<sci::NetIO> *otpackArr[2];
+  int lanes = (int)context.psm3_threads;
+  std::vector<sci::OTPack<sci::NetIO>*> otpackArr(2*lanes);
 
   //Config
   int l= (int)context.bitlen;
   int b= (int)context.radix;
 
+  // with permutation hashing the bin index carries k bits of each element
+  PermHashLayout perm;
+  if(context.psm3_perm_hash)
+    perm = PermHashParams(context.bitlen, context.nbins);
+  int cmp_batch;
+  Psm3CompareShape(context, l, cmp_batch);
+  uint64_t mask_l = l == 64 ? ~0ull : (1ull << l) - 1;
+
   int num_cmps, rmdr;
   rmdr = context.nbins % 8;
   num_cmps = context.nbins + rmdr;
@@ -620,18 +1217,44 @@ void run_circuit_dmsp2cq3(const std::vector<std::uint64_t> &inputs, PsiAnalytics
   uint64_t value;
   if(context.role == 0) {
     pad = batch_size*rmdr;
-    value = S_CONST;
+    value = context.psm3_perm_hash ? perm.server_dummy : S_CONST;
   } else {
     pad = rmdr;
-    value = C_CONST;
+    value = context.psm3_perm_hash ? perm.client_dummy : C_CONST;
   }
   uint8_t* res_shares=new uint8_t[num_cmps];
   std::vector<int> keys(context.n);
 
+  // BatchEquality of all lanes, two blocks per lane when chunked
+  uint64_t lane_cmps = (num_cmps + lanes - 1) / lanes;
+  uint64_t live_cmps = context.psm3_chunk ? std::min<uint64_t>(2 * context.psm3_chunk, lane_cmps) : lane_cmps;
+  MemCharge binsCharge(MEM_BINS);
+  MemCharge compareCharge(MEM_COMPARE);
+
+  // preprocessed AND triples of each lane; BatchEquality generates them if a pool is missing
+  std::vector<BoolTriplePool> pools(context.triple_store.empty() ? 0 : lanes);
+  for(int t=0; t<(int)pools.size(); t++)
+    pools[t].Open(BoolTriplePoolPath(context, t), context.role);
+
+  // with the silent backend every lane takes its leaf OTs and triples from silentChls[2t], [2t+1]
+  std::vector<SilentOTLane> silent;
+  if(context.ot_backend == PsiAnalyticsContext::OT_SILENT)
+    for(int t=0; t<lanes; t++)
+      silent.emplace_back(party, silentChls[2*t], silentChls[2*t+1]);
+
   if (context.role == CLIENT) {
 
-    Timer computationTime;
+    Timer computationTime("hashing");
 
+    if(context.psm3_perm_hash)
+    {
+      // NegotiatePSM3PermHash sized nbins so that nothing overflows
+      if(PermHashBins(inputs, perm, context.nbins, 1, perm.client_dummy, client_of_bins) != 0)
+        throw std::logic_error("PSM3 client element dropped by permutation hashing");
+      client_of_bins.resize(num_cmps, value);
+    }
+    else
+    {
     client_of_bins.reserve(num_cmps);
     for (int i = 0; i < context.nbins; i++) 
     {
@@ -644,8 +1267,7 @@ void run_circuit_dmsp2cq3(const std::vector<std::uint64_t> &inputs, PsiAnalytics
       }
     }
 
-    for(int i=0; i<pad; i++) {
-      client_of_bins[context.nbins+i]=value;
+    client_of_bins.resize(context.nbins+pad, value);
     }
 
     context.timings.hint_computation=computationTime.end();
@@ -657,30 +1279,60 @@ void run_circuit_dmsp2cq3(const std::vector<std::uint64_t> &inputs, PsiAnalytics
     std::cout << "The Client "<<to_string(context.index) <<"'s value of pad is " << pad << std::endl;
     std::cout << "The Client "<<to_string(context.index) <<"'s size of context.nbins is: " << context.nbins << std::endl;
 
-    std::vector<std::vector<uint64_t>> tmp;
-    tmp.push_back(client_of_bins);
-    writeToCSV(tmp,"clientBins_"+to_string(context.index)+".csv");
-
     #endif
 
-    Timer baseOT;
+    binsCharge.Set(client_of_bins.size()*sizeof(uint64_t));
+
+    if(TraceEnabled(TRACE_BINS))
+      TraceSubmit(TRACE_BINS,context.index,"clientBins_"+to_string(context.index),client_of_bins);
+
+    if(context.psm3_opprf)
+    {
+      // bin b is queried at OT index b; the hint turns the OPRF value into the bin's target
+      std::vector<uint64_t> queries(client_of_bins.begin(), client_of_bins.begin()+context.nbins);
+      EnterCommPhase(COMM_OPRF1);
+      auto keys = ot_receiver(queries, chl, context, context.nbins);
+
+      EnterCommPhase(COMM_HINT);
+      Timer hintTransmission("hint transmission");
+      OpprfHint hint = ReceiveOpprfHint(sock);
+      context.timings.hint_transmission = hintTransmission.end();
+
+      for(int i=0; i<context.nbins; i++)
+        client_of_bins[i] = EvaluateOpprfHint(hint, keys[i]) & mask_l;
+    }
+
+    EnterCommPhase(COMM_SETUP);
+    Timer baseOT("base OT");
 
-    otpackArr[0] = new OTPack<NetIO>(ioArr[0], party, b, l);
-    otpackArr[1] = new OTPack<NetIO>(ioArr[1], 3-party, b, l);
+    if(silent.empty())
+      SetupOTPacks(ioArr, otpackArr.data(), lanes, party, b, l, context);
 
     context.timings.base_ots_sci = baseOT.end();
     
     psmTime.start();
-
-    BatchEquality<NetIO>* compare;
-    compare = new BatchEquality<NetIO>(party, l, b, batch_size, num_cmps, ioArr[0], ioArr[1], otpackArr[0], otpackArr[1]);
-    perform_batch_equality(client_of_bins.data(), compare, res_shares);
+    EnterCommPhase(COMM_COMPARE);
+    compareCharge.Set(lanes * live_cmps * Psm3CompareBytesPerCmp(l, b, cmp_batch));
+
+    perform_batch_equality_lanes(client_of_bins.data(), party, l, b, cmp_batch, num_cmps,
+                                 context.psm3_chunk, lanes, ioArr, SCI_IOS_PER_LANE,
+                                 otpackArr.data(), res_shares, context.psm3_wan,
+                                 pools.empty() ? nullptr : pools.data(),
+                                 silent.empty() ? nullptr : silent.data());
   }
   else
   { 
-    Timer computationTime;
+    Timer computationTime("hashing");
     KA::KA* ka;
 
+    if(context.psm3_perm_hash)
+    {
+      if(PermHashBins(inputs, perm, context.nbins, batch_size, perm.server_dummy, server_of_bins) != 0)
+        throw std::logic_error("PSM3 server element dropped by permutation hashing");
+      server_of_bins.resize(batch_size * num_cmps, value);
+    }
+    else
+    {
     server_of_bins.reserve(batch_size * num_cmps);
     size_t input_index = 0;
     size_t elements_per_row = batch_size; 
@@ -694,8 +1346,7 @@ void run_circuit_dmsp2cq3(const std::vector<std::uint64_t> &inputs, PsiAnalytics
         }
     }
     
-    for(int i=0; i<pad; i++) {
-        server_of_bins[batch_size*context.nbins+i]=value;
+    server_of_bins.resize(batch_size*context.nbins+pad, value);
     }
 
     // std::ofstream outfile4("server_of_bins.csv"+to_string(context.index)+".csv");
@@ -728,6 +1379,18 @@ void run_circuit_dmsp2cq3(const std::vector<std::uint64_t> &inputs, PsiAnalytics
 
     waitFor(Sf_Keys,[&](){},isLeader,context.n);
 
+    // every node sends its DH public key to every other node
+    {
+      std::vector<EVP_PKEY*> publicKeys=serverKeys.data();
+      for(int i=0;i<context.n;i++)
+      {
+        if(i==context.index)
+          continue;
+        CountLocalSend(PublicKeyBytes(publicKeys[context.index]));
+        CountLocalRecv(PublicKeyBytes(publicKeys[i]));
+      }
+    }
+
     while(getSharedCount(isShared[context.index])!=1)
     {
       waitFor2(Sf_Share,
@@ -777,39 +1440,61 @@ void run_circuit_dmsp2cq3(const std::vector<std::uint64_t> &inputs, PsiAnalytics
         }
       });
     }
-    #if 0
-
-    std::vector<std::vector<int>> tmp1;
-    tmp1.push_back(keys);
-
-    writeToCSV(tmp1,"Server_Keys_"+to_string(context.index)+".csv");
-
-    #endif
-
-    #if 1
+    if(TraceEnabled(TRACE_KEYS))
+      TraceSubmit(TRACE_KEYS,context.index,"Server_Keys_"+to_string(context.index),keys);
 
     // std::cout<<"The Server "<<to_string(context.index) <<"'s size of server_of_bins is "<<server_of_bins.size()<<std::endl;
 
     context.timings.hint_computation=computationTime.end();
 
-    std::vector<std::vector<uint64_t>> tmp2;
-    tmp2.push_back(server_of_bins);
-    // writeToCSV(tmp2,"serverBins_"+to_string(context.index)+".csv");
+    binsCharge.Set(server_of_bins.size()*sizeof(uint64_t));
 
-    #endif
+    if(TraceEnabled(TRACE_BINS))
+      TraceSubmit(TRACE_BINS,context.index,"serverBins_"+to_string(context.index),server_of_bins);
+
+    if(context.psm3_opprf)
+    {
+      std::vector<std::vector<uint64_t>> bins(context.nbins);
+      for(int i=0; i<context.nbins; i++)
+        bins[i].assign(server_of_bins.begin()+i*batch_size, server_of_bins.begin()+(i+1)*batch_size);
+      EnterCommPhase(COMM_OPRF1);
+      auto keys = ot_sender(bins, chl, context, context.nbins);
+
+      // one random target per bin, the padding comparisons keep the server dummy
+      Timer hintComputation("hint computation");
+      osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
+      std::vector<uint64_t> targets(num_cmps, value & mask_l);
+      for(int i=0; i<context.nbins; i++)
+        targets[i] = prng.get<uint64_t>() & mask_l;
+      OpprfHint hint = ProgramOpprfHint(keys, std::vector<uint64_t>(targets.begin(), targets.begin()+context.nbins),
+                                        context.ffuns, context.fepsilon);
+      context.timings.hint_computation += hintComputation.end();
+
+      EnterCommPhase(COMM_HINT);
+      Timer hintTransmission("hint transmission");
+      SendOpprfHint(sock, hint);
+      context.timings.hint_transmission = hintTransmission.end();
+
+      server_of_bins = std::move(targets);
+    }
 
-    Timer baseOT;
+    EnterCommPhase(COMM_SETUP);
+    Timer baseOT("base OT");
 
-    otpackArr[0] = new OTPack<NetIO>(ioArr[0], party, b, l);
-    otpackArr[1] = new OTPack<NetIO>(ioArr[1], 3-party, b, l);
+    if(silent.empty())
+      SetupOTPacks(ioArr, otpackArr.data(), lanes, party, b, l, context);
     
     context.timings.base_ots_sci = baseOT.end();
 
     psmTime.start();
+    EnterCommPhase(COMM_COMPARE);
+    compareCharge.Set(lanes * live_cmps * Psm3CompareBytesPerCmp(l, b, cmp_batch));
 
-    BatchEquality<NetIO>* compare;
-    compare = new BatchEquality<NetIO>(party, l, b, batch_size, num_cmps, ioArr[0], ioArr[1], otpackArr[0], otpackArr[1]);
-    perform_batch_equality(server_of_bins.data(), compare, res_shares);
+    perform_batch_equality_lanes(server_of_bins.data(), party, l, b, cmp_batch, num_cmps,
+                                 context.psm3_chunk, lanes, ioArr, SCI_IOS_PER_LANE,
+                                 otpackArr.data(), res_shares, context.psm3_wan,
+                                 pools.empty() ? nullptr : pools.data(),
+                                 silent.empty() ? nullptr : silent.data());
 
     if(isLeader)
     {
@@ -824,162 +1509,80 @@ void run_circuit_dmsp2cq3(const std::vector<std::uint64_t> &inputs, PsiAnalytics
   {
     data[i]=res_shares[i];
   }
-
-  #if 1
-
-  std::vector<std::vector<int>> tmp;
-  tmp.push_back(data);
-  writeToCSV(tmp,"res_share_P_"+to_string(context.role)+"_"+to_string(context.index)+".dat");
-
-  #endif
+  compareCharge.Set(0);
 
   int result=std::accumulate(data.begin(), data.end(), 0, std::bit_xor<>());
+
+  if(TraceEnabled(TRACE_SHARES))
+    TraceSubmit(TRACE_SHARES,context.index,"res_share_P_"+to_string(context.role)+"_"+to_string(context.index),std::move(data));
   context.timings.psm=psmTime.end();
    
 
   // std::cout<<(context.role==SERVER?"Server_":"Client_")<<context.index<<"'s result is "<<result<<"\n";
-  int patchOfA,patchOfB,patchOfC;
-
-  if(context.role==SERVER)
-  {
-    int min = 100;
-    int max = 10000;
-    int a = generateRandomNumber(min, max);
-    int b = generateRandomNumber(min, max);
-    int c = a * b;
-    auto [a0, a1] = splitIntoShares(a);
-    auto [b0, b1] = splitIntoShares(b);
-    auto [c0, c1] = splitIntoShares(c);
-
-    patchOfA=a1;
-    patchOfB=b1;
-    patchOfC=c1;
-
-    sock->Send(&a0,sizeof(int));
-    sock->Send(&b0,sizeof(int));
-    sock->Send(&c0,sizeof(int));
-  }
-  else
-  {
-    sock->Receive(&patchOfA,sizeof(int));
-    sock->Receive(&patchOfB,sizeof(int));
-    sock->Receive(&patchOfC,sizeof(int));
-  }
- int x;
-  int y;
-
-  int x0,x1;
-  int y0,y1;
-  int e0,e1;
-  int f0,f1;
-
-  if(context.role==SERVER)
-  {
-    y=result;
-    y0=0;
-    y1=y;
-    
-    sock->Send(&y0,sizeof(int));
-    sock->Receive(&x1,sizeof(int));
-
-    e1=x1-patchOfA;
-    f1=y1-patchOfB;
-
-    sock->Send(&e1,sizeof(int));
-    sock->Send(&f1,sizeof(int));
-    sock->Receive(&e0,sizeof(int));
-    sock->Receive(&f0,sizeof(int));
-  }
-  else
-  {
-    x=result;
-    x0=x;
-    x1=0;
-
-    sock->Receive(&y0,sizeof(int));
-    sock->Send(&x1,sizeof(int));
-
-    e0=x0-patchOfA;
-    f0=y0-patchOfB;
-
-    sock->Receive(&e1,sizeof(int));
-    sock->Receive(&f1,sizeof(int));
-    sock->Send(&e0,sizeof(int));
-    sock->Send(&f0,sizeof(int));
-  }
-  int e = e0 + e1;
-  int f = f0 + f1;
-
-  int z0,z1;
-  int endOfX,endOfY;
+  TraceSpan aggregate("aggregate");
+  EnterCommPhase(COMM_AGGREGATE);
+  std::vector<int> results{result};
+  TripleStore store;
+  std::mt19937 rng;
+  if(!context.triple_store.empty() && !store.Open(TripleStorePath(context), context.role))
+    std::cerr<<"No triple store at "<<TripleStorePath(context)<<", dealing triples online\n";
+  // only seeded when triples are dealt on the query path
+  if(store.Available()<results.size())
+    rng.seed(std::random_device{}());
+
+  // x ^ y = x + y - 2xy, so each side turns its bit into an additive share with its half of xy
+  std::vector<int> z = MultiplyResultBits(sock, context.role==SERVER, results, store, rng);
+  int endOf=0;
+  for(size_t i=0; i<results.size(); i++)
+    endOf += results[i] - 2*z[i];
 
   if(context.role==SERVER)
   {
-    z1=patchOfC+patchOfA*f+patchOfB*e;
-    endOfY=y-2*z1;
-    endOfY=std::accumulate(keys.begin(),keys.end(),endOfY);
+    endOf=std::accumulate(keys.begin(),keys.end(),endOf);
 
-    serverResult.add(endOfY,context.index);
+    serverResult.add(endOf,context.index);
+    if(!isLeader)
+      CountLocalSend(sizeof(int));
 
     Sf_Result++;
 
     waitFor(Sf_Result,[&]()
     {
       const auto& data=serverResult.data();
-      endOfY=std::accumulate(data.begin(),data.end(),0);
+      endOf=std::accumulate(data.begin(),data.end(),0);
+      for(int i=1;i<context.n;i++)
+        CountLocalRecv(sizeof(int));
     },isLeader,context.n);
   }
   else
   {
-    z0=patchOfC+patchOfA*f+patchOfB*e+e*f;
-    endOfX=x-2*z0;
-
-    clientResult.add(endOfX,context.index);
+    clientResult.add(endOf,context.index);
+    if(!isLeader)
+      CountLocalSend(sizeof(int));
 
     Cf_Result++;
 
     waitFor(Cf_Result,[&]()
     {
       const auto& data=clientResult.data();
-      endOfX=std::accumulate(data.begin(),data.end(),0);
+      endOf=std::accumulate(data.begin(),data.end(),0);
+      for(int i=1;i<context.n;i++)
+        CountLocalRecv(sizeof(int));
     },isLeader,context.n);
   }
 
-
-  
   #if 1
 
   if(isLeader)
   {
-    if(context.role==SERVER)
-    {
-      sock->Send(&z1,sizeof(int));
-      sock->Send(&endOfY,sizeof(int));
-      sock->Receive(&z0,sizeof(int));
-      sock->Receive(&endOfX,sizeof(int));
-    }
-    else
-    {
-      sock->Receive(&z1,sizeof(int));
-      sock->Receive(&endOfY,sizeof(int));
-      sock->Send(&z0,sizeof(int));
-      sock->Send(&endOfX,sizeof(int));
-    }
-    // int xy = z0 + z1;
-    // std::cout<<"z0 is"<<z0<<std::endl;
-    // std::cout<<"z1 is"<<z1<<std::endl;
-    // std::cout << "x: " << x << ", y: " << y << ", x * y = " << xy << std::endl;
-    //std::cout<<" Test Result is "<<endOfX+endOfY<<std::endl;
+    // {z, endOf} of the leader in one frame each way, sent before either side receives
+    int mine[2]={z[0],endOf}, theirs[2];
+    FramedWriter<CSocketTransport>(CSocketTransport(sock)).Put(mine).Flush();
+    FramedReader<CSocketTransport> reader{CSocketTransport(sock)};
+    reader.Next().Get(theirs,sizeof(theirs));
+    //std::cout<<" Test Result is "<<mine[1]+theirs[1]<<std::endl;
   }
 
-  #if 0
-
-  std::cout<<(context.role==SERVER?"Server":"Client")<<" "<<to_string(context.index)<< "Shares of a: patchOfA = " << patchOfA << std::endl;
-  std::cout<<(context.role==SERVER?"Server":"Client")<<" "<<to_string(context.index)<< "Shares of b: patchOfB = " << patchOfB << std::endl;
-  std::cout<<(context.role==SERVER?"Server":"Client")<<" "<<to_string(context.index)<< "Shares of c: patchOfC = " << patchOfC << std::endl;
-
-  #endif
-
   #endif
 
   context.timings.total=totalTime.end();
@@ -998,6 +1601,181 @@ std::unique_ptr<CSocket> EstablishConnection(const std::string &address, uint16_
   return socket;
 }
 
+/*
+ * Link probe on the node socket: minimum of a few 1-byte ping-pongs for the RTT, then a bulk
+ * transfer acknowledged by the peer for the bandwidth. The server drives, the client echoes.
+ */
+static LinkEstimate MeasureLink(std::unique_ptr<CSocket> &sock, bool initiator)
+{
+  const int pings = 8;
+  const size_t probe_bytes = 1 << 20;
+  LinkEstimate link;
+  uint8_t b = 0;
+  std::vector<uint8_t> probe(probe_bytes);
+
+  if(!initiator)
+  {
+    for(int i=0; i<pings; i++)
+    {
+      sock->Receive(&b, 1);
+      sock->Send(&b, 1);
+    }
+    sock->Receive(probe.data(), probe_bytes);
+    sock->Send(&b, 1);
+    return link;
+  }
+
+  link.rtt_ms = std::numeric_limits<double>::infinity();
+  for(int i=0; i<pings; i++)
+  {
+    Timer ping;
+    sock->Send(&b, 1);
+    sock->Receive(&b, 1);
+    link.rtt_ms = std::min(link.rtt_ms, ping.end());
+  }
+  Timer bulk;
+  sock->Send(probe.data(), probe_bytes);
+  sock->Receive(&b, 1);
+  double ms = std::max(bulk.end() - link.rtt_ms, 1e-3);
+  link.mbps = probe_bytes * 8 / (ms * 1000);
+  return link;
+}
+
+/*
+ * --psm3-autotune: the server measures the link, evaluates the PSM3 cost model over radix,
+ * leaf-OT mode and chunk size, and sends its choice to the client so both build matching
+ * OTPacks and NetIOs. The batch is not tuned: it is the number of server entries per bin
+ * packed into one leaf-OT message (8, or 1 with the OPPRF front end).
+ *
+ * Node 0 alone measures and tunes, over its own link; the other server nodes wait for its choice
+ * and pass it on, so all nodes run the same configuration.
+ */
+static uint64_t tunedConfig[6];
+static globalFlag Sf_Tune;
+
+void AutotunePSM3(std::unique_ptr<CSocket> &sock, PsiAnalyticsContext &context)
+{
+  TraceSpan span("autotune");
+  const bool tuner=context.index == 0;
+  uint64_t msg[5];
+  if(context.role == SERVER)
+  {
+    if(tuner)
+    {
+      LinkEstimate link = MeasureLink(sock, true);
+      uint64_t num_cmps = context.nbins + context.nbins % 8;
+      int l, batch;
+      Psm3CompareShape(context, l, batch);
+      Psm3Config config = Psm3Autotune(link, l, batch, num_cmps, (int)context.psm3_threads);
+      tunedConfig[0] = config.radix;
+      tunedConfig[1] = config.wan;
+      tunedConfig[2] = config.chunk;
+      memcpy(&tunedConfig[3], &link.rtt_ms, sizeof(double));
+      memcpy(&tunedConfig[4], &link.mbps, sizeof(double));
+      memcpy(&tunedConfig[5], &config.estimate_ms, sizeof(double));
+    }
+    else
+      Sf_Tune++;
+    waitFor(Sf_Tune,[](){},tuner,context.n-1);
+    memcpy(msg, tunedConfig, sizeof(msg));
+    FramedWriter<CSocketTransport>(CSocketTransport(sock)).Put(msg).Flush();
+    memcpy(&context.tuning.estimate, &tunedConfig[5], sizeof(double));
+  }
+  else
+  {
+    if(tuner)
+      MeasureLink(sock, false);
+    FramedReader<CSocketTransport> reader{CSocketTransport(sock)};
+    reader.Next().Get(msg, sizeof(msg));
+    context.tuning.estimate = 0;
+  }
+  context.radix = msg[0];
+  context.psm3_wan = msg[1] != 0;
+  context.psm3_chunk = msg[2];
+  memcpy(&context.tuning.rtt, &msg[3], sizeof(double));
+  memcpy(&context.tuning.mbps, &msg[4], sizeof(double));
+  context.tuning.done = true;
+}
+
+/*
+ * --psm3-perm-hash gives a client bin one slot and a server bin 8, so elements colliding past
+ * that would be dropped, and their matches with them. Both sides find the fewest doublings of
+ * nbins, up to PERM_HASH_MAX_GROWTH, that fit all of theirs, the node pairs agree on the
+ * largest, and every node runs with that many bins. The run fails if no such nbins exists.
+ */
+static const int PERM_HASH_MAX_GROWTH = 4;
+static globalData<int> permGrowth;
+static globalFlag Sf_Perm, Cf_Perm;
+
+void NegotiatePSM3PermHash(std::unique_ptr<CSocket> &sock, InputView inputs, PsiAnalyticsContext &context)
+{
+  std::vector<uint64_t> bins;
+  int mine = 0;
+  for(; mine <= PERM_HASH_MAX_GROWTH; mine++)
+  {
+    uint64_t nbins = context.nbins << mine;
+    PermHashLayout perm = PermHashParams(context.bitlen, nbins);
+    size_t overflow = context.role == SERVER
+                          ? PermHashBins(inputs, perm, nbins, 8, perm.server_dummy, bins)
+                          : PermHashBins(inputs, perm, nbins, 1, perm.client_dummy, bins);
+    if(overflow == 0)
+      break;
+  }
+  int theirs = 0;
+  FramedWriter<CSocketTransport>(CSocketTransport(sock)).Put(mine).Flush();
+  FramedReader<CSocketTransport> reader{CSocketTransport(sock)};
+  reader.Next().Get(&theirs, sizeof(theirs));
+
+  // both parties see the same pair maxima, so their node-wide maxima agree too
+  const bool isLeader=context.index == 0;
+  globalFlag &flag = context.role == SERVER ? Sf_Perm : Cf_Perm;
+  permGrowth.add(std::max(mine, theirs), context.role*context.n + context.index);
+  if(!isLeader)
+    flag++;
+  waitFor(flag,[](){},isLeader,context.n-1);
+  int growth = 0;
+  for(uint64_t i=0; i<context.n; i++)
+    growth = std::max(growth, permGrowth.getByPos(context.role*context.n + i));
+
+  if(growth > PERM_HASH_MAX_GROWTH)
+    throw std::runtime_error("--psm3-perm-hash: elements still collide in " +
+                             std::to_string(context.nbins << PERM_HASH_MAX_GROWTH) +
+                             " bins, run PSM3 without it or with a larger --epsilon");
+  context.nbins <<= growth;
+}
+
+/*
+ * --memory-budget for PSM3: each side sends the largest chunk whose BatchEquality blocks fit its
+ * compare share, split over the nodes and lanes of the process, and both run the smaller one so
+ * the chunked NetIOs match. Runs on every PSM3 node, the peer may have a budget when this side
+ * has none.
+ */
+void BudgetPSM3Chunk(std::unique_ptr<CSocket> &sock, PsiAnalyticsContext &context)
+{
+  MemoryBudget &budget = MemoryBudget::Instance();
+  uint64_t mine = 0, theirs = 0;
+  if(budget.Budget())
+  {
+    int l, batch;
+    Psm3CompareShape(context, l, batch);
+    uint64_t num_cmps = context.nbins + context.nbins % 8;
+    uint64_t lane_cmps = (num_cmps + context.psm3_threads - 1) / context.psm3_threads;
+    double lane_bytes = (double)budget.Share(MEM_COMPARE) / (context.n * context.psm3_threads);
+    if(lane_cmps * Psm3CompareBytesPerCmp(l, (int)context.radix, batch) > lane_bytes)
+      mine = Psm3ChunkForBytes(lane_bytes, l, (int)context.radix, batch);
+  }
+  FramedWriter<CSocketTransport>(CSocketTransport(sock)).Put(mine).Flush();
+  FramedReader<CSocketTransport> reader{CSocketTransport(sock)};
+  reader.Next().Get(&theirs, sizeof(theirs));
+
+  uint64_t limit = mine == 0 ? theirs : theirs == 0 ? mine : std::min(mine, theirs);
+  if(limit > 0 && (context.psm3_chunk == 0 || context.psm3_chunk > limit))
+  {
+    context.psm3_chunk = limit;
+    budget.MarkExternal(MEM_COMPARE);
+  }
+}
+
 /*
  * Print Timings
  */
@@ -1010,10 +1788,17 @@ void PrintTimings(const PsiAnalyticsContext &context)
   if(context.psm_type != PsiAnalyticsContext::PSM3)
   {
     std::cout << "Time for OPRF1 " << context.timings.oprf1 << " ms\n";
-    std::cout << "Time for OPRF2 " << context.timings.oprf2 << " ms\n";
+    std::cout << "Time for OPRF2 " << context.timings.oprf2 << " ms"
+              << (context.oprf_mode == PsiAnalyticsContext::OPRF_DH ? " (DH OPRF)" : "") << "\n";
+    if(context.role==SERVER && context.oprf_mode == PsiAnalyticsContext::OPRF_DH)
+      std::cout << "Time for OPRF cache encode " << context.timings.oprf_encode << " ms\n";
   }
   
   std::cout << "Time for hint computation " << context.timings.hint_computation << " ms\n";
+  if(context.psm_type == PsiAnalyticsContext::PSM3 && context.psm3_opprf)
+    std::cout << "Time for hint transmission " << context.timings.hint_transmission << " ms\n";
+  if(context.role==SERVER && !context.store_dir.empty() && context.psm_type != PsiAnalyticsContext::PSM3)
+    std::cout << "Time for store update " << context.timings.update << " ms\n";
   if(context.psm_type == PsiAnalyticsContext::PSM2)
   {
     if(context.role==SERVER)
@@ -1026,153 +1811,130 @@ void PrintTimings(const PsiAnalyticsContext &context)
     }
   }
   // std::cout << "Timing for base OT " << context.timings.base_ots_libote<< " ms\n";
+  if(context.psm_type == PsiAnalyticsContext::PSM3)
+  {
+    std::cout << "PSM3 config: radix " << context.radix << ", " << (context.psm3_wan ? "WAN" : "LAN")
+              << " leaf OTs, chunk " << context.psm3_chunk << ", lanes " << context.psm3_threads
+              << ", " << (context.ot_backend == PsiAnalyticsContext::OT_SILENT ? "silent" : "IKNP") << " OT";
+    if(context.tuning.done)
+    {
+      std::cout << " (autotuned: rtt " << context.tuning.rtt << " ms, " << context.tuning.mbps << " Mbps";
+      if(context.role == SERVER)
+        std::cout << ", estimate " << context.tuning.estimate << " ms";
+      std::cout << ")";
+    }
+    std::cout << "\n";
+  }
   std::cout << "Timing for PSM " << context.timings.psm<< " ms\n";
   std::cout << "Total runtime " << context.timings.total<< " ms\n";
   std::cout << "Total runtime w/o base OTs:" << context.timings.totalWithoutOT<< " ms\n";
 }
 
 /*
- * Clear communication counts for new execution
+ * Meter the query from here on: the node socket and the OPRF channel, and for PSM3 the SCI
+ * NetIOs and the silent-OT channels
  */
-
-void ResetCommunication(std::unique_ptr<CSocket> &sock, osuCrypto::Channel &chl, PsiAnalyticsContext &context) {
-    chl.resetStats();
-    sock->ResetSndCnt();
-    sock->ResetRcvCnt();
+void ResetCommunication(CommMeter &meter, std::unique_ptr<CSocket> &sock, osuCrypto::Channel &chl, PsiAnalyticsContext &context) {
+    std::vector<osuCrypto::Channel> noChannels;
+    ResetCommunication(meter, sock, chl, nullptr, noChannels, context);
 }
 
-void ResetCommunication(std::unique_ptr<CSocket> &sock, osuCrypto::Channel &chl, sci::NetIO* ioArr[2], PsiAnalyticsContext &context) {
-    chl.resetStats();
-    sock->ResetSndCnt();
-    sock->ResetRcvCnt();
-    context.sci_io_start.resize(2);
-		for(int i=0; i<2; i++) {
-				context.sci_io_start[i] = ioArr[i]->counter;
-		}
+void ResetCommunication(CommMeter &meter, std::unique_ptr<CSocket> &sock, osuCrypto::Channel &chl, sci::NetIO** ioArr,
+                        std::vector<osuCrypto::Channel> &silentChls, PsiAnalyticsContext &context) {
+    CSocket* s = sock.get();
+    meter.AddSource(LINK_SOCKET, [s]() { return CommSample{s->getSndCnt(), s->getRcvCnt(), 0}; });
+    osuCrypto::Channel* oprf = &chl;
+    meter.AddSource(LINK_OPRF, [oprf]() { return CommSample{oprf->getTotalDataSent(), oprf->getTotalDataRecv(), 0}; });
+    for(int i=0; ioArr && i<SCI_IOS_PER_LANE*(int)context.psm3_threads; i++) {
+        sci::NetIO* io = ioArr[i];
+        if(io)
+            meter.AddSource(LINK_SCI, [io]() { return CommSample{io->counter, 0, io->num_rounds}; });
+    }
+    // silent-OT traffic counts as SCI traffic, it replaces the OTPack extension
+    for(auto& c : silentChls) {
+        osuCrypto::Channel* silent = &c;
+        meter.AddSource(LINK_SCI, [silent]() { return CommSample{silent->getTotalDataSent(), 0, 0}; });
+    }
+    meter.Start();
 }
 
 /*
- * Measure communication
+ * Stop metering. SCI only counts what it sends and a message is one socket write, so the
+ * peer's sent SCI bytes and socket messages of every phase are what this side received.
  */
-void AccumulateCommunicationPSI(std::unique_ptr<CSocket> &sock, osuCrypto::Channel &chl, PsiAnalyticsContext &context) {
-
-  context.sentBytesOPRF = chl.getTotalDataSent();
-  context.recvBytesOPRF = chl.getTotalDataRecv();
+void AccumulateCommunicationPSI(CommMeter &meter, std::unique_ptr<CSocket> &sock, PsiAnalyticsContext &context) {
+  context.comm = meter.Finish();
 
-  context.sentBytesHint = sock->getSndCnt();
-  context.recvBytesHint = sock->getRcvCnt();
-  if(context.role==SERVER)
+  std::vector<uint64_t> mine(2*COMM_PHASES);
+  for(int p=0; p<COMM_PHASES; p++)
   {
-    if(context.index!=context.n-1)
-    {
-      context.sentBytesHint+=sizeof(osuCrypto::block)*context.sneles;
-      if(context.psm_type==context.PSM2)
-        context.sentBytesHint+=sizeof(char) * 528*context.sneles;
-      if (context.index == 0)
-      {
-        context.recvBytesHint += sizeof(osuCrypto::block) * context.sneles * context.n;
-        if (context.psm_type == context.PSM2)
-        {
-          context.recvBytesHint += sizeof(char) * 528 * context.sneles * context.n;
-          context.recvBytesHint -= sizeof(uint64_t) * 2 + sizeof(char) * (2*context.bitlen+1);
-        }
-      }
-    }
-    else 
-    {
-      context.recvBytesHint+=sizeof(osuCrypto::block)*context.sneles*(context.n-1);
-      context.sentBytesHint+=sizeof(osuCrypto::block)*context.sneles*context.n;
-      if(context.psm_type==context.PSM2)
-      {
-        context.recvBytesHint+=sizeof(char) * 528*context.sneles*(context.n-1);
-        context.sentBytesHint+=sizeof(char) * 528*context.sneles*context.n;
-      }
-    }
+    mine[2*p] = context.comm.counters[p][LINK_SCI].sent;
+    mine[2*p+1] = context.comm.counters[p][LINK_SOCKET].sent_msgs;
   }
-  else
+  FramedWriter<CSocketTransport>(CSocketTransport(sock)).PutVector(mine).Flush();
+  FramedReader<CSocketTransport> reader{CSocketTransport(sock)};
+  std::vector<uint64_t> theirs = reader.Next().GetVector<uint64_t>();
+  if(theirs.size() != mine.size())
+    throw std::runtime_error("Communication counters of the peer do not match");
+  for(int p=0; p<COMM_PHASES; p++)
   {
-    if(context.index==0 && context.psm_type==context.PSM2)
-    {
-      context.sentBytesHint -= sizeof(uint64_t) * 2 + sizeof(char) * (2*context.bitlen+1);
-    }
-  }
-
-  context.sentBytesSCI = 0;
-  context.recvBytesSCI = 0;
-
-  //Send SCI Communication
-  if (context.role == CLIENT) {
-    sock->Receive(&context.recvBytesSCI, sizeof(uint64_t));
-    sock->Send(&context.sentBytesSCI, sizeof(uint64_t));
-  } else {
-    sock->Send(&context.sentBytesSCI, sizeof(uint64_t));
-    sock->Receive(&context.recvBytesSCI, sizeof(uint64_t));
+    context.comm.counters[p][LINK_SCI].recv += theirs[2*p];
+    context.comm.counters[p][LINK_SOCKET].recv_msgs += theirs[2*p+1];
   }
 }
 
-void AccumulateCommunicationPSI(std::unique_ptr<CSocket> &sock, osuCrypto::Channel &chl, sci::NetIO* ioArr[2], PsiAnalyticsContext &context) {
-
-  context.sentBytesOPRF = chl.getTotalDataSent();
-  context.recvBytesOPRF = chl.getTotalDataRecv();
-
-  context.sentBytesHint = sock->getSndCnt();
-  context.recvBytesHint = sock->getRcvCnt();
+/*
+ * Print communication: totals per link, then every phase and link that carried data
+ */
+static void PrintCommReport(const std::string &who, const CommReport &report)
+{
+  const double MB = 1.0*(1ULL<<20);
+  const char* labels[COMM_LINKS] = {"Hint", "OPRF", "CryptFlow2", "Local"};
+  const int order[COMM_LINKS] = {LINK_OPRF, LINK_SOCKET, LINK_SCI, LINK_LOCAL};
 
-  if(context.role==SERVER)
+  std::cout<<who<<": Communication Statistics: "<<std::endl;
+  for(int link : order)
   {
-    context.sentBytes-=sizeof(int)*3;
+    CommCounter c = report.Link(link);
+    std::cout<<who<<": Sent Data "<<labels[link]<<" (MB): "<<c.sent/MB<<std::endl;
+    std::cout<<who<<": Received Data "<<labels[link]<<" (MB): "<<c.recv/MB<<std::endl;
   }
-  else
+  CommCounter total = report.Total();
+  std::cout<<who<<": Total Sent Data (MB): "<<total.sent/MB<<std::endl;
+  std::cout<<who<<": Total Received Data (MB): "<<total.recv/MB<<std::endl;
+
+  for(int p=0; p<COMM_PHASES; p++)
   {
-    context.recvBytesHint-=sizeof(int)*3;
+    for(int l=0; l<COMM_LINKS; l++)
+    {
+      const CommCounter& c = report.counters[p][l];
+      if(c.Empty())
+        continue;
+      std::cout<<who<<": "<<std::left<<std::setw(10)<<COMM_PHASE_NAMES[p]<<std::setw(7)<<COMM_LINK_NAMES[l]<<std::right
+               <<"sent "<<c.sent<<" B, received "<<c.recv<<" B";
+      if(COMM_LINK_MESSAGES[l])
+        std::cout<<", messages "<<c.sent_msgs<<"/"<<c.recv_msgs;
+      if(COMM_LINK_ROUNDS[l])
+        std::cout<<", rounds "<<c.rounds;
+      std::cout<<std::endl;
+    }
   }
-  context.sentBytesSCI = 0;
-  context.recvBytesSCI = 0;
+}
 
-  for(int i=0; i<2; i++) {
-		context.sentBytesSCI += ioArr[i]->counter - context.sci_io_start[i];
-	}
-  if (context.role == CLIENT) {
-    sock->Receive(&context.recvBytesSCI, sizeof(uint64_t));
-    sock->Send(&context.sentBytesSCI, sizeof(uint64_t));
-  } else {
-    sock->Send(&context.sentBytesSCI, sizeof(uint64_t));
-    sock->Receive(&context.recvBytesSCI, sizeof(uint64_t));
-  }
+void PrintCommunication(PsiAnalyticsContext &context) {
+  PrintCommReport((context.role==SERVER?"Server ":"Client ")+to_string(context.index), context.comm);
 }
 
 /*
- * Print communication
+ * Sum over all nodes of this party; local handoffs appear once on each side
  */
-void PrintCommunication(PsiAnalyticsContext &context) {
-  if (context.index==context.n-1 || context.index==0 || context.index==1)
-  {
-  context.sentBytes = context.sentBytesOPRF + context.sentBytesHint + context.sentBytesSCI;
-  context.recvBytes = context.recvBytesOPRF + context.recvBytesHint + context.recvBytesSCI;
-  std::cout<<(context.role==SERVER?"Server":"Client")<<" "<<to_string(context.index)<< ": Communication Statistics: "<<std::endl;
-  double sentinMB, recvinMB;
-  sentinMB = context.sentBytesOPRF/((1.0*(1ULL<<20)));
-  recvinMB = context.recvBytesOPRF/((1.0*(1ULL<<20)));
-  std::cout<<(context.role==SERVER?"Server":"Client")<<" "<<to_string(context.index)<< ": Sent Data OPRF (MB): "<<sentinMB<<std::endl;
-  std::cout<<(context.role==SERVER?"Server":"Client")<<" "<<to_string(context.index)<< ": Received Data OPRF (MB): "<<recvinMB<<std::endl;
-
-  sentinMB = context.sentBytesHint/((1.0*(1ULL<<20)));
-  recvinMB = context.recvBytesHint/((1.0*(1ULL<<20)));
-  std::cout<<(context.role==SERVER?"Server":"Client")<<" "<<to_string(context.index)<< ": Sent Data Hint (MB): "<<sentinMB<<std::endl;
-  std::cout<<(context.role==SERVER?"Server":"Client")<<" "<<to_string(context.index)<< ": Received Data Hint (MB): "<<recvinMB<<std::endl;
-
-  sentinMB = context.sentBytesSCI/((1.0*(1ULL<<20)));
-  recvinMB = context.recvBytesSCI/((1.0*(1ULL<<20)));
-  std::cout<<(context.role==SERVER?"Server":"Client")<<" "<<to_string(context.index)<< ": Sent Data CryptFlow2 (MB): "<<sentinMB<<std::endl;
-  std::cout<<(context.role==SERVER?"Server":"Client")<<" "<<to_string(context.index)<< ": Received Data CryptFlow2 (MB): "<<recvinMB<<std::endl;
-
-  sentinMB = context.sentBytes/((1.0*(1ULL<<20)));
-  recvinMB = context.recvBytes/((1.0*(1ULL<<20)));
-  std::cout<<(context.role==SERVER?"Server":"Client")<<" "<<to_string(context.index)<< ": Total Sent Data (MB): "<<sentinMB<<std::endl;
-  std::cout<<(context.role==SERVER?"Server":"Client")<<" "<<to_string(context.index)<< ": Total Received Data (MB): "<<recvinMB<<std::endl;
-  }
-  
-  
+void PrintAggregateCommunication(const std::vector<PsiAnalyticsContext> &contexts) {
+  if(contexts.empty())
+    return;
+  CommReport total;
+  for(const auto& c : contexts)
+    total += c.comm;
+  PrintCommReport(std::string(contexts[0].role==SERVER?"Server":"Client")+" (all "+to_string(contexts.size())+" nodes)", total);
 }
 
 }
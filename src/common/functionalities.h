@@ -4,6 +4,7 @@
 #include "abycore/circuit/share.h"
 #include "helpers.h"
 #include "config.h"
+#include "dataset.h"
 #include "EzPC/SCI/src/utils/emp-tool.h"
 #include "ots/ots.h"
 
@@ -11,22 +12,32 @@
 
 #define C_CONST 8459320670953116686
 #define S_CONST 18286333650295995643
+// NetIOs per PSM3 lane: leaf OTs, triples and (chunked mode) AND rounds
+#define SCI_IOS_PER_LANE 3
 namespace ENCRYPTO {
 
-void run_circuit_dmsp2cq(const std::vector<std::uint64_t> &inputs, PsiAnalyticsContext &context, std::unique_ptr<CSocket> &sock, osuCrypto::Channel &chl);
-void run_circuit_dmsp2cq3(const std::vector<std::uint64_t> &inputs, PsiAnalyticsContext &context, std::unique_ptr<CSocket> &sock,sci::NetIO* ioArr[2], osuCrypto::Channel &chl);
+void run_circuit_dmsp2cq(InputView inputs, InputView values, PsiAnalyticsContext &context, std::unique_ptr<CSocket> &sock, osuCrypto::Channel &chl);
+void run_circuit_dmsp2cq3(InputView inputs, PsiAnalyticsContext &context, std::unique_ptr<CSocket> &sock,sci::NetIO** ioArr, osuCrypto::Channel &chl,
+  std::vector<osuCrypto::Channel> &silentChls);
 
 std::unique_ptr<CSocket> EstablishConnection(const std::string &address, uint16_t port,
                                              e_role role);
 
+void ExchangePeerId(std::unique_ptr<CSocket> &sock, PsiAnalyticsContext &context);
+void NegotiatePSM3PermHash(std::unique_ptr<CSocket> &sock, InputView inputs, PsiAnalyticsContext &context);
+void AutotunePSM3(std::unique_ptr<CSocket> &sock, PsiAnalyticsContext &context);
+void BudgetPSM3Chunk(std::unique_ptr<CSocket> &sock, PsiAnalyticsContext &context);
+void PreprocessTriples(std::unique_ptr<CSocket> &sock, PsiAnalyticsContext &context);
+void PreprocessBoolTriples(PsiAnalyticsContext &context, sci::NetIO** ioArr);
+
 std::size_t PlainIntersectionSize(std::vector<std::uint64_t> v1, std::vector<std::uint64_t> v2);
 
 void PrintTimings(const PsiAnalyticsContext &context);
 void PrintCommunication(const PsiAnalyticsContext &context);
 
-void ResetCommunication(std::unique_ptr<CSocket> &sock, osuCrypto::Channel &chl, PsiAnalyticsContext &context);
-void ResetCommunication(std::unique_ptr<CSocket> &sock, osuCrypto::Channel &chl, sci::NetIO* ioArr[2], PsiAnalyticsContext &context);
-void AccumulateCommunicationPSI(std::unique_ptr<CSocket> &sock, osuCrypto::Channel &chl, PsiAnalyticsContext &context);
-void AccumulateCommunicationPSI(std::unique_ptr<CSocket> &sock, osuCrypto::Channel &chl, sci::NetIO* ioArr[2], PsiAnalyticsContext &context);
+void ResetCommunication(CommMeter &meter, std::unique_ptr<CSocket> &sock, osuCrypto::Channel &chl, PsiAnalyticsContext &context);
+void ResetCommunication(CommMeter &meter, std::unique_ptr<CSocket> &sock, osuCrypto::Channel &chl, sci::NetIO** ioArr, std::vector<osuCrypto::Channel> &silentChls, PsiAnalyticsContext &context);
+void AccumulateCommunicationPSI(CommMeter &meter, std::unique_ptr<CSocket> &sock, PsiAnalyticsContext &context);
 void PrintCommunication(PsiAnalyticsContext &context);
+void PrintAggregateCommunication(const std::vector<PsiAnalyticsContext> &contexts);
 }
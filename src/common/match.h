@@ -0,0 +1,62 @@
+#ifndef MATCH_H__
+#define MATCH_H__
+
+#include <NTL/ZZ.h>
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * The leader's match over the OPRF2 values of all nodes. server[i][b] holds the values of bin b
+ * of node i, client[i*nbins + b] the client's value for that bin; a client value can only match
+ * in the same node and bin, so only that bin is scanned.
+ */
+
+namespace ENCRYPTO {
+
+// PSM1, node i alone: bins[b] holds its values of bin b, client its client values from bin 0 on
+template <typename Bins>
+inline uint64_t CountNodeMatches(const Bins &bins, const uint64_t *client, uint64_t nbins) {
+  uint64_t count = 0;
+  for (uint64_t b = 0; b < nbins; b++)
+    for (auto v : bins[b])
+      if (client[b] == v) count++;
+  return count;
+}
+
+// PSM1: number of server values equal to the client's value of their bin
+inline uint64_t CountBinMatches(const std::vector<std::vector<std::vector<uint64_t>>> &server,
+                                const std::vector<uint64_t> &client, uint64_t nbins) {
+  uint64_t count = 0;
+  for (size_t i = 0; i < server.size(); i++) count += CountNodeMatches(server[i], client.data() + i * nbins, nbins);
+  return count;
+}
+
+// PSM2, node i alone: index[b][k] is the position of entry k of bin b in ciphertexts
+template <typename Bins, typename Index>
+inline NTL::ZZ MultiplyNodeMatches(NTL::ZZ sum, const Bins &bins, const Index &index, const uint64_t *client,
+                                   uint64_t nbins, const std::vector<NTL::ZZ> &ciphertexts, const NTL::ZZ &n2) {
+  for (uint64_t b = 0; b < nbins; b++) {
+    const auto &bin = bins[b];
+    for (size_t k = 0; k < bin.size(); k++)
+      if (client[b] == bin[k]) sum = (sum * ciphertexts[index[b][k]]) % n2;
+  }
+  return sum;
+}
+
+/*
+ * PSM2: sum times the Paillier ciphertexts of all matching server entries, mod n2 = n^2.
+ * index[i][b][k] is the position of entry k of that bin in ciphertexts[i].
+ */
+inline NTL::ZZ MultiplyBinMatches(NTL::ZZ sum, const std::vector<std::vector<std::vector<uint64_t>>> &server,
+                                  const std::vector<std::vector<std::vector<uint32_t>>> &index,
+                                  const std::vector<uint64_t> &client, uint64_t nbins,
+                                  const std::vector<std::vector<NTL::ZZ>> &ciphertexts, const NTL::ZZ &n2) {
+  for (size_t i = 0; i < server.size(); i++)
+    sum = MultiplyNodeMatches(sum, server[i], index[i], client.data() + i * nbins, nbins, ciphertexts[i], n2);
+  return sum;
+}
+
+}  // namespace ENCRYPTO
+
+#endif  // MATCH_H__
@@ -0,0 +1,170 @@
+#ifndef MEMORY_BUDGET_H__
+#define MEMORY_BUDGET_H__
+
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <iomanip>
+#include <ios>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+/*
+ * Memory of one party process per protocol stage, against --memory-budget.
+ *
+ * The node threads of a party share the process, so the accounting is process-wide: every node
+ * charges the data it builds to the stage that holds it, with MemCharge, and the peaks are those
+ * of the sum over the nodes. Charges are the sizes of the stage's own buffers as computed where
+ * they are built, not allocator statistics. Files mapped by an external-memory variant are not
+ * charged; the kernel can drop their pages.
+ *
+ * Each stage gets a fixed share of the budget. A stage whose data would not fit its share
+ * switches to its external-memory variant where it has one: the PSM1/PSM2 server spills its
+ * OPRF tables to disk and the leader matches node by node, PSM3 compares in chunks.
+ */
+
+namespace ENCRYPTO {
+
+enum MemStage : int {
+  MEM_TABLES,       // PSM1/PSM2 hash tables and their OPRF values, held until the match
+  MEM_CIPHERTEXTS,  // PSM2 Paillier ciphertexts of the server entries
+  MEM_MATCH,        // PSM1/PSM2 client values the leader matches against
+  MEM_BINS,         // PSM3 padded bins
+  MEM_COMPARE,      // PSM3 BatchEquality leaf buffers and AND triples
+  MEM_STAGES
+};
+
+static const char *const MEM_STAGE_NAMES[] = {"tables", "ciphertexts", "match", "bins", "compare"};
+// the stages of PSM1/PSM2 and those of PSM3 each add up to the whole budget
+static const double MEM_STAGE_SHARES[] = {0.3, 0.6, 0.1, 0.4, 0.6};
+
+struct MemStageReport {
+  uint64_t peak = 0;
+  uint64_t share = 0;  // UINT64_MAX without a budget
+  bool external = false;
+};
+
+class MemoryBudget {
+ public:
+  static MemoryBudget &Instance() {
+    static MemoryBudget budget;
+    return budget;
+  }
+
+  // Starts a run with budget bytes, 0 = unlimited
+  void Configure(uint64_t budget) {
+    budget_ = budget;
+    for (int s = 0; s < MEM_STAGES; s++) {
+      current_[s] = 0;
+      peak_[s] = 0;
+      external_[s] = false;
+    }
+    total_ = 0;
+    total_peak_ = 0;
+  }
+
+  uint64_t Budget() const { return budget_; }
+
+  uint64_t Share(MemStage stage) const {
+    return budget_ ? (uint64_t)(budget_ * MEM_STAGE_SHARES[stage]) : std::numeric_limits<uint64_t>::max();
+  }
+
+  // Whether a stage that holds bytes at once has to take its external-memory variant
+  bool Exceeds(MemStage stage, uint64_t bytes) const { return bytes > Share(stage); }
+
+  void MarkExternal(MemStage stage) { external_[stage] = true; }
+
+  void Charge(MemStage stage, int64_t bytes) {
+    Raise(peak_[stage], current_[stage] += bytes);
+    Raise(total_peak_, total_ += bytes);
+  }
+
+  MemStageReport Report(MemStage stage) const {
+    MemStageReport r;
+    r.peak = peak_[stage];
+    r.share = Share(stage);
+    r.external = external_[stage];
+    return r;
+  }
+
+  uint64_t Peak() const { return total_peak_; }
+
+ private:
+  static void Raise(std::atomic<uint64_t> &peak, uint64_t value) {
+    uint64_t seen = peak.load();
+    while (value > seen && !peak.compare_exchange_weak(seen, value)) {
+    }
+  }
+
+  uint64_t budget_ = 0;
+  std::atomic<uint64_t> current_[MEM_STAGES] = {};
+  std::atomic<uint64_t> peak_[MEM_STAGES] = {};
+  std::atomic<bool> external_[MEM_STAGES] = {};
+  std::atomic<uint64_t> total_{0}, total_peak_{0};
+};
+
+// Charges bytes to a stage while alive
+class MemCharge {
+ public:
+  explicit MemCharge(MemStage stage, uint64_t bytes = 0) : stage_(stage) { Set(bytes); }
+  ~MemCharge() { Set(0); }
+  MemCharge(const MemCharge &) = delete;
+  MemCharge &operator=(const MemCharge &) = delete;
+
+  void Set(uint64_t bytes) {
+    MemoryBudget::Instance().Charge(stage_, (int64_t)bytes - (int64_t)bytes_);
+    bytes_ = bytes;
+  }
+
+ private:
+  MemStage stage_;
+  uint64_t bytes_ = 0;
+};
+
+// "4096", "512K", "64M", "4G", "1T" (powers of 1024); throws std::invalid_argument
+inline uint64_t ParseByteSize(const std::string &text) {
+  size_t end = 0;
+  uint64_t value;
+  try {
+    value = std::stoull(text, &end);
+  } catch (const std::logic_error &) {
+    throw std::invalid_argument("Not a byte size: " + text);
+  }
+  if (end == text.size()) return value;
+  if (end + 1 != text.size()) throw std::invalid_argument("Not a byte size: " + text);
+  switch (std::toupper((unsigned char)text[end])) {
+    case 'T': value <<= 10;  // fall through
+    case 'G': value <<= 10;  // fall through
+    case 'M': value <<= 10;  // fall through
+    case 'K': return value << 10;
+    default: throw std::invalid_argument("Not a byte size: " + text);
+  }
+}
+
+// One line per stage that held data, and the total
+inline void PrintMemoryReport(std::ostream &out) {
+  const MemoryBudget &budget = MemoryBudget::Instance();
+  const double mib = 1 << 20;
+  const std::ios::fmtflags flags = out.flags();
+  const std::streamsize precision = out.precision();
+  out << std::fixed << std::setprecision(1);
+  for (int s = 0; s < MEM_STAGES; s++) {
+    MemStageReport r = budget.Report((MemStage)s);
+    if (r.peak == 0 && !r.external) continue;
+    out << "Memory " << MEM_STAGE_NAMES[s] << ": peak " << r.peak / mib << " MiB";
+    if (budget.Budget()) out << " of " << r.share / mib << " MiB";
+    if (r.external) out << " (external)";
+    out << "\n";
+  }
+  out << "Memory peak " << budget.Peak() / mib << " MiB";
+  if (budget.Budget()) out << " of budget " << budget.Budget() / mib << " MiB";
+  out << "\n";
+  out.flags(flags);
+  out.precision(precision);
+}
+
+}  // namespace ENCRYPTO
+
+#endif  // MEMORY_BUDGET_H__
@@ -0,0 +1,387 @@
+#ifndef NET_EMULATOR_H__
+#define NET_EMULATOR_H__
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Emulated network between the client and the server on one machine, without root and without
+ * tc/netem. The client process listens on a block of ports that mirrors the server's and relays
+ * every connection to the server through delay queues: each chunk leaves when the token bucket
+ * of its node and direction allows it and arrives one-way latency (plus jitter) later, in order.
+ * All transports - the node CSocket, the libOTe session and the SCI NetIOs - only see a client
+ * that connects to other ports on 127.0.0.1, so no protocol code changes.
+ */
+
+namespace ENCRYPTO {
+
+struct NetProfile {
+  std::string name;
+  double latency_ms = 0;  // one way
+  double jitter_ms = 0;   // uniform extra delay in [0, jitter_ms)
+  double mbps = 0;        // per node and direction, 0 = unlimited
+
+  bool Enabled() const { return latency_ms > 0 || jitter_ms > 0 || mbps > 0; }
+};
+
+/*
+ * "lan" (0.1 ms, 1 Gbit/s), "wan" (40 ms, 100 Mbit/s), "none", or "<latency_ms>:<mbps>[:<jitter_ms>]",
+ * e.g. "25:50:2". Throws std::invalid_argument on anything else.
+ */
+inline NetProfile ParseNetProfile(const std::string &spec) {
+  NetProfile profile;
+  profile.name = spec;
+  if (spec.empty() || spec == "none") return profile;
+  if (spec == "lan") {
+    profile.latency_ms = 0.1;
+    profile.mbps = 1000;
+    return profile;
+  }
+  if (spec == "wan") {
+    profile.latency_ms = 40;
+    profile.mbps = 100;
+    return profile;
+  }
+  std::vector<double> values;
+  std::istringstream in(spec);
+  std::string item;
+  while (std::getline(in, item, ':')) {
+    std::istringstream is(item);
+    double v;
+    if (!(is >> v) || !is.eof() || v < 0) throw std::invalid_argument("Bad network profile: " + spec);
+    values.push_back(v);
+  }
+  if (values.size() < 2 || values.size() > 3) throw std::invalid_argument("Bad network profile: " + spec);
+  profile.latency_ms = values[0];
+  profile.mbps = values[1];
+  profile.jitter_ms = values.size() > 2 ? values[2] : 0;
+  return profile;
+}
+
+class NetEmulator {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit NetEmulator(const NetProfile &profile) : profile_(profile), rng_(std::random_device{}()) {}
+
+  ~NetEmulator() { Stop(); }
+
+  /*
+   * Relays 127.0.0.1:listen_port+i to target:target_port+i for i < count. Connections on port
+   * offset i belong to node i % nodes and share its bandwidth with the node's other connections.
+   */
+  void Start(uint16_t listen_port, const std::string &target, uint16_t target_port, uint32_t count,
+             uint32_t nodes) {
+    target_ = target;
+    target_port_ = target_port;
+    buckets_.clear();
+    for (uint32_t i = 0; i < 2 * nodes; i++) buckets_.emplace_back(profile_.mbps * 1e6 / 8);
+    if (pipe(wake_) != 0) throw std::runtime_error("NetEmulator: pipe failed");
+    SetNonBlocking(wake_[0]);
+    for (uint32_t i = 0; i < count; i++) {
+      int fd = socket(AF_INET, SOCK_STREAM, 0);
+      int one = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      sockaddr_in addr{};
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      addr.sin_port = htons(listen_port + i);
+      if (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        close(fd);
+        Stop();
+        throw std::runtime_error("NetEmulator: cannot listen on port " + std::to_string(listen_port + i));
+      }
+      SetNonBlocking(fd);
+      listeners_.push_back({fd, i, i % nodes});
+    }
+    stop_ = false;
+    loop_ = std::thread([this] { Loop(); });
+  }
+
+  void Stop() {
+    stop_ = true;
+    if (loop_.joinable()) {
+      Wake();
+      loop_.join();
+    }
+    for (auto &t : connectors_) t.join();
+    connectors_.clear();
+    for (auto &l : listeners_) close(l.fd);
+    listeners_.clear();
+    for (auto &c : connections_) c->Close();
+    connections_.clear();
+    for (auto &p : pending_) p->Close();
+    pending_.clear();
+    for (int &fd : wake_)
+      if (fd >= 0) {
+        close(fd);
+        fd = -1;
+      }
+  }
+
+ private:
+  static constexpr size_t CHUNK = 16 << 10;       // bytes per read, the pacing granularity
+  static constexpr size_t QUEUE_LIMIT = 8 << 20;  // bytes in flight per direction before reads pause
+
+  // Token bucket with debt: a chunk that overdraws it departs once the debt is paid back
+  class TokenBucket {
+   public:
+    explicit TokenBucket(double rate) : rate_(rate), burst_(std::max<double>(CHUNK, rate * 1e-3)), tokens_(burst_) {}
+
+    Clock::time_point Depart(Clock::time_point now, size_t bytes) {
+      if (rate_ <= 0) return now;
+      tokens_ = std::min(burst_, tokens_ + std::chrono::duration<double>(now - last_).count() * rate_);
+      last_ = now;
+      tokens_ -= bytes;
+      if (tokens_ >= 0) return now;
+      return now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(-tokens_ / rate_));
+    }
+
+   private:
+    double rate_, burst_, tokens_;
+    Clock::time_point last_ = Clock::now();
+  };
+
+  struct Chunk {
+    Clock::time_point due;
+    std::vector<char> data;  // empty = end of stream
+  };
+
+  // One direction of a relayed connection
+  struct Pipe {
+    int from, to;
+    TokenBucket *bucket;
+    std::deque<Chunk> queue;
+    size_t queued = 0, written = 0;  // bytes in the queue, bytes of the front already written
+    bool read_closed = false, write_closed = false;
+    Clock::time_point last_due;
+  };
+
+  struct Connection {
+    int client, server;
+    Pipe up, down;  // client -> server, server -> client
+
+    Connection(int c, int s, TokenBucket *up_bucket, TokenBucket *down_bucket)
+        : client(c), server(s), up{c, s, up_bucket}, down{s, c, down_bucket} {}
+
+    bool Done() const {
+      return (up.read_closed || up.write_closed) && up.queue.empty() && (down.read_closed || down.write_closed) &&
+             down.queue.empty();
+    }
+
+    void Close() {
+      if (client >= 0) close(client);
+      if (server >= 0) close(server);
+      client = server = -1;
+    }
+  };
+
+  struct Listener {
+    int fd;
+    uint32_t offset, node;
+  };
+
+  static void SetNonBlocking(int fd) { fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK); }
+
+  static void NoDelay(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+
+  void Wake() {
+    char c = 0;
+    ssize_t ignored = write(wake_[1], &c, 1);
+    (void)ignored;
+  }
+
+  // The server may not listen yet, so the relay retries like the transports themselves do
+  void ConnectTarget(int client, const Listener &l) {
+    addrinfo hints{}, *res = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    std::string port = std::to_string(target_port_ + l.offset);
+    if (getaddrinfo(target_.c_str(), port.c_str(), &hints, &res) != 0) {
+      close(client);
+      return;
+    }
+    int server = -1;
+    while (!stop_) {
+      server = socket(AF_INET, SOCK_STREAM, 0);
+      if (connect(server, res->ai_addr, res->ai_addrlen) == 0) break;
+      close(server);
+      server = -1;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    freeaddrinfo(res);
+    if (server < 0) {
+      close(client);
+      return;
+    }
+    NoDelay(client);
+    NoDelay(server);
+    SetNonBlocking(client);
+    SetNonBlocking(server);
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      pending_.emplace_back(new Connection(client, server, &buckets_[2 * l.node], &buckets_[2 * l.node + 1]));
+    }
+    Wake();
+  }
+
+  void Read(Pipe &p, Clock::time_point now) {
+    Chunk chunk;
+    chunk.data.resize(CHUNK);
+    ssize_t r = recv(p.from, chunk.data.data(), CHUNK, 0);
+    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+    chunk.data.resize(r > 0 ? r : 0);
+    if (r <= 0) p.read_closed = true;
+
+    Clock::time_point due = p.bucket->Depart(now, chunk.data.size());
+    double delay_ms = profile_.latency_ms;
+    if (profile_.jitter_ms > 0) delay_ms += std::uniform_real_distribution<double>(0, profile_.jitter_ms)(rng_);
+    due += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(delay_ms));
+    // TCP delivers in order, so jitter never lets a chunk overtake the previous one
+    due = std::max(due, p.last_due);
+    p.last_due = due;
+    p.queued += chunk.data.size();
+    chunk.due = due;
+    p.queue.push_back(std::move(chunk));
+  }
+
+  void Deliver(Pipe &p, Clock::time_point now) {
+    while (!p.queue.empty() && p.queue.front().due <= now) {
+      Chunk &front = p.queue.front();
+      if (p.write_closed) {
+        p.queued -= front.data.size();
+        p.queue.pop_front();
+        continue;
+      }
+      if (front.data.empty()) {
+        shutdown(p.to, SHUT_WR);
+        p.write_closed = true;
+        p.queue.pop_front();
+        continue;
+      }
+      ssize_t w = send(p.to, front.data.data() + p.written, front.data.size() - p.written, MSG_NOSIGNAL);
+      if (w < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return;
+        p.write_closed = true;
+        p.written = 0;
+        continue;
+      }
+      p.written += w;
+      if (p.written < front.data.size()) return;
+      p.queued -= front.data.size();
+      p.written = 0;
+      p.queue.pop_front();
+    }
+  }
+
+  void Loop() {
+    std::vector<pollfd> fds;
+    while (!stop_) {
+      Clock::time_point now = Clock::now();
+      Clock::time_point next = now + std::chrono::milliseconds(100);
+      fds.clear();
+      fds.push_back({wake_[0], POLLIN, 0});
+      for (auto &l : listeners_) fds.push_back({l.fd, POLLIN, 0});
+      for (auto &c : connections_)
+        for (Pipe *p : {&c->up, &c->down}) {
+          // POLLHUP and POLLERR come even without events, so an fd with nothing to wait for is
+          // left out (-1); a closed one would otherwise wake every ppoll
+          short events = 0;
+          if (!p->read_closed && p->queued < QUEUE_LIMIT) events |= POLLIN;
+          fds.push_back({events ? p->from : -1, events, 0});
+          events = 0;
+          if (!p->queue.empty()) {
+            if (p->queue.front().due <= now)
+              events |= POLLOUT;
+            else
+              next = std::min(next, p->queue.front().due);
+          }
+          fds.push_back({events ? p->to : -1, events, 0});
+        }
+
+      auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(std::max(next - now, Clock::duration::zero()));
+      timespec timeout{(time_t)(wait.count() / 1000000000), (long)(wait.count() % 1000000000)};
+      if (ppoll(fds.data(), fds.size(), &timeout, nullptr) < 0 && errno != EINTR) break;
+      now = Clock::now();
+
+      size_t k = 0;
+      if (fds[k++].revents & POLLIN) {
+        char buffer[64];
+        while (read(wake_[0], buffer, sizeof(buffer)) > 0) {
+        }
+      }
+      for (auto &l : listeners_) {
+        if (fds[k++].revents & POLLIN) {
+          int client;
+          while ((client = accept(l.fd, nullptr, nullptr)) >= 0) {
+            Listener listener = l;
+            connectors_.emplace_back([this, client, listener] { ConnectTarget(client, listener); });
+          }
+        }
+      }
+      for (auto &c : connections_)
+        for (Pipe *p : {&c->up, &c->down}) {
+          short revents = fds[k++].revents;
+          if (!p->read_closed && (revents & (POLLIN | POLLHUP | POLLERR))) Read(*p, now);
+          k++;
+          Deliver(*p, now);
+        }
+
+      connections_.erase(std::remove_if(connections_.begin(), connections_.end(),
+                                        [](std::unique_ptr<Connection> &c) {
+                                          if (!c->Done()) return false;
+                                          c->Close();
+                                          return true;
+                                        }),
+                         connections_.end());
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      for (auto &p : pending_) {
+        p->up.last_due = p->down.last_due = now;
+        connections_.push_back(std::move(p));
+      }
+      pending_.clear();
+    }
+  }
+
+  NetProfile profile_;
+  std::mt19937_64 rng_;
+  std::string target_;
+  uint16_t target_port_ = 0;
+  std::deque<TokenBucket> buckets_;  // 2 per node: upstream, downstream
+  std::vector<Listener> listeners_;
+  std::vector<std::unique_ptr<Connection>> connections_;
+  std::vector<std::unique_ptr<Connection>> pending_;
+  std::mutex pending_mutex_;
+  std::vector<std::thread> connectors_;
+  std::thread loop_;
+  std::atomic<bool> stop_{true};
+  int wake_[2] = {-1, -1};
+};
+
+}  // namespace ENCRYPTO
+
+#endif  // NET_EMULATOR_H__
@@ -0,0 +1,225 @@
+#ifndef OTPACK_CACHE_H__
+#define OTPACK_CACHE_H__
+
+#include "EzPC/SCI/src/OT/emp-ot.h"
+#include "EzPC/SCI/src/utils/emp-tool.h"
+#include "framing.h"
+#include "otpack_plan.h"
+
+#include <openssl/sha.h>
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+ * Persistent OTPack setup material.
+ *
+ * The base-OT seeds of every OT-extension instance inside an OTPack are written to a local
+ * file after a full setup. A later run loads them instead of running base OTs again, once both
+ * parties have confirmed they hold the two halves of the same setup (matching tag). Each load
+ * re-keys every seed with a fresh nonce chosen by ALICE, so the extension state of a run never
+ * repeats an earlier one while the base-OT correlation is kept.
+ */
+
+namespace ENCRYPTO {
+
+static const uint32_t OTPACK_CACHE_MAGIC = 0x4B50544F;  // "OTPK"
+static const uint32_t OTPACK_CACHE_VERSION = 2;
+
+/*
+ * Identity of this party towards its peers' caches, dir/party_<role>.id, made on first use. The
+ * nodes of a party share it; so do parties of one role that share dir.
+ */
+inline uint64_t LocalPartyId(const std::string &dir, int role) {
+  static std::mutex m;
+  std::lock_guard<std::mutex> lock(m);
+  const std::string path = dir + "/party_" + std::to_string(role) + ".id";
+  uint64_t id = 0;
+  std::ifstream in(path, std::ios::binary);
+  if (in.read(reinterpret_cast<char *>(&id), sizeof(id)) && id != 0) return id;
+  std::random_device rd;
+  id = (static_cast<uint64_t>(rd()) << 32) | rd() | 1;
+  const std::string tmp = path + ".tmp";
+  std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char *>(&id), sizeof(id));
+  out.close();
+  if (!out || std::rename(tmp.c_str(), path.c_str()) != 0)
+    throw std::runtime_error("Cannot write party id " + path);
+  return id;
+}
+
+inline std::string OTPackCachePath(const std::string &dir, const std::string &peer, uint64_t index,
+                                   int slot, int party, int l, int b) {
+  std::string key = peer;
+  for (auto &c : key)
+    if (!isalnum(static_cast<unsigned char>(c)) && c != '.') c = '_';
+  return dir + "/otpack_" + key + "_" + std::to_string(index) + "_" + std::to_string(slot) +
+         "_l" + std::to_string(l) + "_r" + std::to_string(b) + "_p" + std::to_string(party) +
+         ".bin";
+}
+
+// H(seed || nonce), truncated to a block
+inline sci::block RefreshSeed(const sci::block &seed, const uint8_t nonce[16]) {
+  uint8_t in[32], out[SHA256_DIGEST_LENGTH];
+  memcpy(in, &seed, 16);
+  memcpy(in + 16, nonce, 16);
+  SHA256(in, sizeof(in), out);
+  sci::block res;
+  memcpy(&res, out, sizeof(res));
+  return res;
+}
+
+template <typename OT>
+void WriteOTSeeds(std::ofstream &out, OT *ot, bool sender) {
+  uint8_t present = ot != nullptr && ot->setup;
+  out.write(reinterpret_cast<const char *>(&present), 1);
+  if (!present) return;
+  uint32_t lambda = ot->lambda;
+  out.write(reinterpret_cast<const char *>(&lambda), sizeof(lambda));
+  out.write(reinterpret_cast<const char *>(ot->k0), sizeof(sci::block) * ot->lambda);
+  if (sender)
+    out.write(reinterpret_cast<const char *>(ot->s), sizeof(bool) * ot->lambda);
+  else
+    out.write(reinterpret_cast<const char *>(ot->k1), sizeof(sci::block) * ot->lambda);
+}
+
+template <typename OT>
+bool LoadOTSeeds(std::ifstream &in, OT *ot, bool sender, const uint8_t nonce[16]) {
+  uint8_t present = 0;
+  in.read(reinterpret_cast<char *>(&present), 1);
+  if (!in || (!present && ot != nullptr)) return false;
+  if (!present) return true;
+  uint32_t lambda = 0;
+  in.read(reinterpret_cast<char *>(&lambda), sizeof(lambda));
+  if (!in) return false;
+  if (ot == nullptr) {
+    // stored but not in this pack's plan
+    in.seekg((sizeof(sci::block) + (sender ? sizeof(bool) : sizeof(sci::block))) * lambda, std::ios::cur);
+    return bool(in);
+  }
+  if (lambda != (uint32_t)ot->lambda) return false;
+
+  std::vector<sci::block> k0(ot->lambda), k1(ot->lambda);
+  std::unique_ptr<bool[]> s(new bool[ot->lambda]);
+  in.read(reinterpret_cast<char *>(k0.data()), sizeof(sci::block) * ot->lambda);
+  if (sender)
+    in.read(reinterpret_cast<char *>(s.get()), sizeof(bool) * ot->lambda);
+  else
+    in.read(reinterpret_cast<char *>(k1.data()), sizeof(sci::block) * ot->lambda);
+  if (!in) return false;
+
+  for (int i = 0; i < ot->lambda; i++) {
+    k0[i] = RefreshSeed(k0[i], nonce);
+    if (!sender) k1[i] = RefreshSeed(k1[i], nonce);
+  }
+  if (sender)
+    ot->setup_send(k0.data(), s.get());
+  else
+    ot->setup_recv(k0.data(), k1.data());
+  return true;
+}
+
+// ALICE acts as OT-extension sender in every instance but iknp_reversed
+template <typename IO, typename F>
+bool ForEachOTInstance(sci::OTPack<IO> *otpack, F f) {
+  bool alice = otpack->party == sci::ALICE;
+  return f(otpack->kkot_beta, alice) && f(otpack->kkot_4, alice) && f(otpack->kkot_8, alice) &&
+         f(otpack->kkot_16, alice) && f(otpack->iknp_straight, alice) &&
+         f(otpack->iknp_reversed, !alice);
+}
+
+template <typename IO>
+bool SaveOTPack(sci::OTPack<IO> *otpack, uint64_t tag, int b, int l, const std::string &path) {
+  std::string tmp = path + ".tmp";
+  std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+  if (!out.is_open()) {
+    std::cerr << "Failed to open file: " << tmp << std::endl;
+    return false;
+  }
+  uint32_t header[5] = {OTPACK_CACHE_MAGIC, OTPACK_CACHE_VERSION, (uint32_t)otpack->party,
+                        (uint32_t)b, (uint32_t)l};
+  out.write(reinterpret_cast<const char *>(header), sizeof(header));
+  out.write(reinterpret_cast<const char *>(&tag), sizeof(tag));
+  ForEachOTInstance(otpack, [&](auto *ot, bool sender) {
+    WriteOTSeeds(out, ot, sender);
+    return true;
+  });
+  out.close();
+  return out.good() && std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+// Tag of the cached setup at path, 0 if there is none usable for (party, b, l)
+inline uint64_t ReadOTPackTag(const std::string &path, int party, int b, int l) {
+  std::ifstream in(path, std::ios::binary);
+  uint32_t header[5];
+  uint64_t tag = 0;
+  in.read(reinterpret_cast<char *>(header), sizeof(header));
+  in.read(reinterpret_cast<char *>(&tag), sizeof(tag));
+  if (!in || header[0] != OTPACK_CACHE_MAGIC || header[1] != OTPACK_CACHE_VERSION ||
+      header[2] != (uint32_t)party || header[3] != (uint32_t)b || header[4] != (uint32_t)l)
+    return 0;
+  return tag;
+}
+
+template <typename IO>
+bool LoadOTPack(sci::OTPack<IO> *otpack, const std::string &path, const uint8_t nonce[16]) {
+  std::ifstream in(path, std::ios::binary);
+  in.seekg(5 * sizeof(uint32_t) + sizeof(uint64_t));
+  return ForEachOTInstance(otpack,
+                           [&](auto *ot, bool sender) { return LoadOTSeeds(in, ot, sender, nonce); });
+}
+
+/*
+ * Builds the instances of plan on io, starting from the setup cached at path when the peer
+ * holds the matching half; otherwise runs their base OTs and caches them for the next run.
+ */
+template <typename IO>
+sci::OTPack<IO> *MakeOTPack(IO *io, int party, int b, int l, const OTPackPlan &plan,
+                            const std::string &path) {
+  FramedWriter<NetIOTransport<IO>> writer{NetIOTransport<IO>(io)};
+  FramedReader<NetIOTransport<IO>> reader{NetIOTransport<IO>(io)};
+  uint64_t tag = ReadOTPackTag(path, party, b, l);
+  writer.Put(tag).Flush();
+  uint64_t peer_tag = reader.Next().template Get<uint64_t>();
+
+  if (tag != 0 && tag == peer_tag) {
+    uint8_t nonce[16];
+    if (party == sci::ALICE) {
+      std::random_device rd;
+      for (auto &x : nonce) x = static_cast<uint8_t>(rd());
+      writer.Put(nonce).Flush();
+    } else {
+      reader.Next().Get(nonce, sizeof(nonce));
+    }
+
+    sci::OTPack<IO> *otpack = new sci::OTPack<IO>(io, party, b, l, false);
+    ReleaseUnplanned(otpack, plan);
+    if (LoadOTPack(otpack, path, nonce)) return otpack;
+    // both sides agreed on the tag, so a local read failure cannot be recovered in-band
+    throw std::runtime_error("Corrupt OTPack cache: " + path);
+  }
+
+  sci::OTPack<IO> *otpack = MakePlannedOTPack(io, party, b, l, plan);
+  if (party == sci::ALICE) {
+    std::random_device rd;
+    tag = (static_cast<uint64_t>(rd()) << 32) | rd() | 1;
+    writer.Put(tag).Flush();
+  } else {
+    tag = reader.Next().template Get<uint64_t>();
+  }
+  SaveOTPack(otpack, tag, b, l, path);
+  return otpack;
+}
+
+}  // namespace ENCRYPTO
+
+#endif  // OTPACK_CACHE_H__
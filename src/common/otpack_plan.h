@@ -0,0 +1,96 @@
+#ifndef OTPACK_PLAN_H__
+#define OTPACK_PLAN_H__
+
+#include "EzPC/SCI/src/OT/emp-ot.h"
+#include "EzPC/SCI/src/utils/emp-tool.h"
+
+/*
+ * Which OT flavours of an OTPack a protocol step actually uses. A stock OTPack runs base OTs
+ * for every KKOT/IKNP variant; PSM3 only ever touches kkot_beta plus one remainder variant for
+ * its leaf OTs, and kkot_16 for its triples, so the rest are never built.
+ */
+
+namespace ENCRYPTO {
+
+struct OTPackPlan {
+  bool kkot_beta = false;
+  bool kkot_4 = false;
+  bool kkot_8 = false;
+  bool kkot_16 = false;
+  bool iknp_straight = false;
+  bool iknp_reversed = false;
+};
+
+// BatchEquality::computeLeafOTs: kkot_beta, plus the variant for the last digit r = l % beta
+// unless WAN mode sends that digit through kkot_beta as well
+inline OTPackPlan LeafOTPlan(int l, int b, bool wan_mode) {
+  OTPackPlan plan;
+  plan.kkot_beta = true;
+  if (!wan_mode) {
+    int r = l % b;
+    plan.iknp_straight = r == 1;
+    plan.kkot_4 = r == 2;
+    plan.kkot_8 = r == 3;
+    plan.kkot_16 = r == 4;
+  }
+  return plan;
+}
+
+// TripleGenerator with _16KKOT_to_4OT
+inline OTPackPlan TripleOTPlan() {
+  OTPackPlan plan;
+  plan.kkot_16 = true;
+  return plan;
+}
+
+template <typename OT>
+void SetupPlannedInstance(OT *&ot, bool needed, bool sender) {
+  if (!needed) {
+    delete ot;
+    ot = nullptr;
+    return;
+  }
+  if (sender)
+    ot->setup_send();
+  else
+    ot->setup_recv();
+}
+
+// Frees the instances a pack built with do_setup = false will not need
+template <typename IO>
+void ReleaseUnplanned(sci::OTPack<IO> *otpack, const OTPackPlan &plan) {
+  auto release = [](auto *&ot, bool needed) {
+    if (!needed) {
+      delete ot;
+      ot = nullptr;
+    }
+  };
+  release(otpack->kkot_beta, plan.kkot_beta);
+  release(otpack->kkot_4, plan.kkot_4);
+  release(otpack->kkot_8, plan.kkot_8);
+  release(otpack->kkot_16, plan.kkot_16);
+  release(otpack->iknp_straight, plan.iknp_straight);
+  release(otpack->iknp_reversed, plan.iknp_reversed);
+}
+
+/*
+ * OTPack with base OTs only for the instances in plan; the others are released and left null.
+ * Instances are set up in a fixed order so both parties stay in step on io.
+ */
+template <typename IO>
+sci::OTPack<IO> *MakePlannedOTPack(IO *io, int party, int b, int l, const OTPackPlan &plan) {
+  sci::OTPack<IO> *otpack = new sci::OTPack<IO>(io, party, b, l, false);
+  bool alice = party == sci::ALICE;
+  SetupPlannedInstance(otpack->kkot_beta, plan.kkot_beta, alice);
+  SetupPlannedInstance(otpack->iknp_straight, plan.iknp_straight, alice);
+  SetupPlannedInstance(otpack->iknp_reversed, plan.iknp_reversed, !alice);
+  SetupPlannedInstance(otpack->kkot_4, plan.kkot_4, alice);
+  SetupPlannedInstance(otpack->kkot_16, plan.kkot_16, alice);
+  SetupPlannedInstance(otpack->kkot_8, plan.kkot_8, alice);
+  io->flush();
+  return otpack;
+}
+
+}  // namespace ENCRYPTO
+
+#endif  // OTPACK_PLAN_H__
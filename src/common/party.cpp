@@ -0,0 +1,607 @@
+#include "party.h"
+
+#include <boost/program_options.hpp>
+#include "functionalities.h"
+#include "ENCRYPTO_utils/connection.h"
+#include "ENCRYPTO_utils/socket.h"
+#include "memory_budget.h"
+#include "net_emulator.h"
+#include "perm_hash.h"
+#include "ots/dh_oprf.h"
+#include "silent_ot.h"
+#include "trace_dump.h"
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "VRF.hpp"
+#include "Timer.hpp"
+#include "utils.hpp"
+
+namespace ENCRYPTO {
+
+static globalData<PsiAnalyticsContext> clientContexts;
+static globalData<PsiAnalyticsContext> serverContexts;
+static std::mutex m;
+static globalFlag flagOfWait;
+
+PsiAnalyticsContext ParsePartyOptions(int argcp, char **argvp) {
+  namespace po = boost::program_options;
+  ENCRYPTO::PsiAnalyticsContext context;
+  po::options_description allowed("Allowed options");
+  std::string type;
+  std::string ot_backend;
+  std::string oprf_mode;
+  std::string trace_stages;
+  std::string memory_budget;
+  // clang-format off
+  allowed.add_options()("help,h", "produce this message")
+  ("role,r",         po::value<decltype(context.role)>(&context.role)->required(),                                  "Role of the node")
+  ("n,n",        po::value<decltype(context.n)>(&context.n)->default_value(10u),                   "Number of server")
+  ("g,g",        po::value<decltype(context.g)>(&context.g)->default_value(5u),                   "g")
+  ("cneles,c",        po::value<decltype(context.cneles)>(&context.cneles)->default_value(1u),                   "Number of server elements")
+  ("sneles,s",        po::value<decltype(context.sneles)>(&context.sneles)->default_value(1024u),                  "Number of server elements")
+  ("bit-length,b",   po::value<decltype(context.bitlen)>(&context.bitlen)->default_value(58u),                  "Bit-length of the elements")
+  ("epsilon,e",      po::value<decltype(context.epsilon)>(&context.epsilon)->default_value(1.0f),                  "Epsilon, a table size multiplier (cuckoo tables use at least 1.27 with 3 functions)")
+  ("hint-epsilon,E",      po::value<decltype(context.fepsilon)>(&context.fepsilon)->default_value(1.27f),       "Epsilon, a hint table size multiplier")
+  ("address,a",      po::value<decltype(context.address)>(&context.address)->default_value("0.0.0.0"),            "IP address of the server")
+  ("port,p",         po::value<decltype(context.port)>(&context.port)->default_value(7777),                         "Port of the server")
+  ("radix,m",    po::value<decltype(context.radix)>(&context.radix)->default_value(5u),                             "Radix in PSM Protocol")
+  ("psm3-threads",    po::value<decltype(context.psm3_threads)>(&context.psm3_threads)->default_value(1u),       "Number of parallel BatchEquality lanes in PSM3")
+  ("otpack-cache",    po::value<decltype(context.otpack_cache)>(&context.otpack_cache)->default_value(""),      "Directory for persisted SCI OTPack setups (empty = disabled)")
+  ("triple-store",    po::value<decltype(context.triple_store)>(&context.triple_store)->default_value(""),      "Directory of preprocessed arithmetic and boolean triples for PSM3 (empty = generated online)")
+  ("preprocess-triples",    po::value<decltype(context.preprocess_triples)>(&context.preprocess_triples)->default_value(0u),  "Only deal and store this many triples per node pair in --triple-store, then exit")
+  ("preprocess-bool-triples",    po::value<decltype(context.preprocess_bool_triples)>(&context.preprocess_bool_triples)->default_value(0u),  "Only generate and store this many BatchEquality AND triples per PSM3 lane in --triple-store, then exit")
+  ("oprf-chunk",    po::value<decltype(context.oprf_chunk)>(&context.oprf_chunk)->default_value(1u << 16),   "Server elements per OPRF encode chunk in PSM1/PSM2, bounds the sender's scratch memory (0 = whole table)")
+  ("psm3-chunk",    po::value<decltype(context.psm3_chunk)>(&context.psm3_chunk)->default_value(0u),            "Comparisons per pipelined BatchEquality block in PSM3 (0 = unchunked)")
+  ("psm3-wan",    po::bool_switch(&context.psm3_wan),                                                               "Send the last digit of PSM3 leaf OTs through kkot_beta (fewer rounds, more bytes)")
+  ("psm3-autotune",    po::bool_switch(&context.psm3_autotune),                                                     "Choose radix, WAN/LAN leaf OTs and chunk size from a link measurement")
+  ("psm3-perm-hash",    po::bool_switch(&context.psm3_perm_hash),                                                   "Place PSM3 elements by permutation-based hashing and compare only the bits not carried by the bin index")
+  ("psm3-opprf",    po::bool_switch(&context.psm3_opprf),                                                       "Reduce each PSM3 bin to one OPPRF-programmed value before the comparison (uses -F/-E)")
+  ("ot-backend",    po::value<std::string>(&ot_backend)->default_value("iknp"),                                 "OT extension for the PSM3 leaf OTs and AND triples {iknp, silent}")
+  ("trace-dump",    po::value<decltype(context.trace_dump)>(&context.trace_dump)->default_value(""),           "Directory for the binary dump of intermediate data, decoded with trace_decode (empty = off)")
+  ("trace-stages",    po::value<std::string>(&trace_stages)->default_value("all"),                             "Stages written to --trace-dump {oprf1, oprf2, match, bins, keys, shares, all}")
+  ("trace-json",    po::value<decltype(context.trace_json)>(&context.trace_json)->default_value(""),           "Write the timing spans of every node as Chrome trace JSON to this file (empty = off)")
+  ("dataset",    po::value<decltype(context.dataset)>(&context.dataset)->default_value(""),                "Binary dataset of this party, made by dataset_gen; node i reads partition i (empty = built-in inputs)")
+  ("memory-budget",    po::value<std::string>(&memory_budget)->default_value("0"),                               "Memory of this party, e.g. 8G; stages over their share spill to --spill-dir or run chunked (0 = unlimited)")
+  ("spill-dir",    po::value<decltype(context.spill_dir)>(&context.spill_dir)->default_value("/tmp"),           "Directory for the tables spilled under --memory-budget")
+  ("store-dir",    po::value<decltype(context.store_dir)>(&context.store_dir)->default_value(""),           "Directory of the servers' persistent PSM1/PSM2 state, updated from the log dmsp2cq_update appends (empty = rebuilt every query)")
+  ("oprf-mode",    po::value<std::string>(&oprf_mode)->default_value("kkrt"),                                  "OPRF of PSM1/PSM2 {kkrt, dh}; dh reuses each server node's key so its encoded set is cached across queries")
+  ("oprf-cache",    po::value<decltype(context.oprf_cache)>(&context.oprf_cache)->default_value(""),          "Directory of the servers' --oprf-mode dh keys and encoded elements (empty = fresh keys, encoded every run)")
+  ("net-profile",    po::value<decltype(context.net_profile)>(&context.net_profile)->default_value(""),        "Emulated client-server link {lan, wan, <latency_ms>:<mbps>[:<jitter_ms>]}, applied by the client (empty = direct)")
+  ("functions,f",    po::value<decltype(context.nfuns)>(&context.nfuns)->default_value(3u),                         "Number of hash functions in hash tables")
+  ("hint-functions,F",    po::value<decltype(context.ffuns)>(&context.ffuns)->default_value(3u),                         "Number of hash functions in hint hash tables")
+  ("psm-type,y",         po::value<std::string>(&type)->default_value("PSM1"),                                   "PSM type {PSM1, PSM2}");
+  // clang-format on
+
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argcp, argvp, allowed), vm);
+    po::notify(vm);
+  } catch (const boost::exception_detail::clone_impl<boost::exception_detail::error_info_injector<
+               boost::program_options::required_option> > &e) {
+    if (!vm.count("help")) {
+      std::cout << e.what() << std::endl;
+      std::cout << allowed << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (vm.count("help")) {
+    std::cout << allowed << "\n";
+    exit(EXIT_SUCCESS);
+  }
+
+  if (type.compare("PSM1") == 0) {
+    context.psm_type = ENCRYPTO::PsiAnalyticsContext::PSM1;
+  } else if (type.compare("PSM2") == 0) {
+    context.psm_type = ENCRYPTO::PsiAnalyticsContext::PSM2;
+  } else if (type.compare("PSM3") == 0) {
+    context.psm_type = ENCRYPTO::PsiAnalyticsContext::PSM3;
+  } 
+   else {
+    std::string error_msg(std::string("Unknown PSM type: " + type));
+    throw std::runtime_error(error_msg.c_str());
+  }
+
+  context.trace_stages = context.trace_dump.empty() ? 0 : ENCRYPTO::ParseTraceStages(trace_stages);
+
+  if (ot_backend == "iknp") {
+    context.ot_backend = ENCRYPTO::PsiAnalyticsContext::OT_IKNP;
+  } else if (ot_backend == "silent") {
+    if (!ENCRYPTO::SILENT_OT_AVAILABLE) {
+      throw std::runtime_error("--ot-backend silent needs libOTe built with ENABLE_SILENTOT");
+    }
+    context.ot_backend = ENCRYPTO::PsiAnalyticsContext::OT_SILENT;
+  } else {
+    throw std::runtime_error("Unknown OT backend: " + ot_backend);
+  }
+
+  if (oprf_mode == "kkrt") {
+    context.oprf_mode = ENCRYPTO::PsiAnalyticsContext::OPRF_KKRT;
+  } else if (oprf_mode == "dh") {
+    if (!ENCRYPTO::DH_OPRF_AVAILABLE) {
+      throw std::runtime_error("--oprf-mode dh needs libOTe built with ENABLE_RELIC");
+    }
+    if (context.psm_type == ENCRYPTO::PsiAnalyticsContext::PSM3) {
+      throw std::runtime_error("--oprf-mode dh applies to PSM1 and PSM2");
+    }
+    context.oprf_mode = ENCRYPTO::PsiAnalyticsContext::OPRF_DH;
+  } else {
+    throw std::runtime_error("Unknown OPRF mode: " + oprf_mode);
+  }
+
+  if (context.psm3_threads == 0) context.psm3_threads = 1;
+  context.memory_budget = ENCRYPTO::ParseByteSize(memory_budget);
+  ENCRYPTO::ParseNetProfile(context.net_profile);
+#ifdef WAN_EXEC
+  context.psm3_wan = true;
+#endif
+  context.tuning.done = false;
+  if ((context.preprocess_triples > 0 || context.preprocess_bool_triples > 0) && context.triple_store.empty()) {
+    throw std::runtime_error("--preprocess-triples and --preprocess-bool-triples need --triple-store");
+  }
+  if (context.preprocess_bool_triples > 0 && context.psm_type != ENCRYPTO::PsiAnalyticsContext::PSM3) {
+    throw std::runtime_error("--preprocess-bool-triples needs --psm-type PSM3");
+  }
+
+  if (context.nfuns < 2 && context.psm_type != ENCRYPTO::PsiAnalyticsContext::PSM3) {
+    throw std::runtime_error("PSM1 and PSM2 need --functions >= 2 for cuckoo hashing");
+  }
+
+  DeriveTableSizes(context);
+  if (context.psm3_perm_hash && context.psm_type == ENCRYPTO::PsiAnalyticsContext::PSM3 &&
+      ENCRYPTO::PermHashCompareBits(context.bitlen, context.nbins) > 64) {
+    throw std::runtime_error("--psm3-perm-hash needs bit-length - log2(bins) + 1 <= 64, use a smaller --bit-length");
+  }
+
+  return context;
+}
+
+/*
+ * Smallest bins-per-element at which cuckoo hashing with nfuns functions still places every
+ * element without a stash: load thresholds of about 0.5, 0.92 and 0.97 for 2, 3 and 4+
+ * functions, with some slack. One function never fits.
+ */
+static double CuckooMinEpsilon(uint64_t nfuns) {
+  if (nfuns >= 4) return 1.09;
+  if (nfuns == 3) return 1.27;
+  return 2.4;
+}
+
+void DeriveTableSizes(PsiAnalyticsContext &context) {
+  // PSM1/PSM2: client cuckoo table and server simple tables share cnbins bins; --epsilon
+  // below the cuckoo threshold is raised to it
+  double cepsilon = std::max(context.epsilon, CuckooMinEpsilon(context.nfuns));
+  context.cnbins = std::max<uint64_t>(1u, std::ceil(context.cneles * cepsilon));
+  context.snbins = context.cnbins;
+  context.nbins = context.sneles * context.epsilon;
+}
+
+/*
+ * Port of the k-th SCI NetIO of a PSM3 lane, in units of n above the node port:
+ * lane 0 keeps n, 2n (and 4n for the AND rounds), 3n is the libOTe session,
+ * further lanes follow from 5n on.
+ */
+static uint16_t sciPort(const ENCRYPTO::PsiAnalyticsContext& context, int lane, int k)
+{
+  static const int lane0[SCI_IOS_PER_LANE] = {1, 2, 4};
+  int slot = lane == 0 ? lane0[k] : 5 + SCI_IOS_PER_LANE*(lane-1) + k;
+  return context.port + slot*context.n;
+}
+
+static void RunNode(ENCRYPTO::PsiAnalyticsContext context,ENCRYPTO::NodeInputs inputs)
+{
+  ENCRYPTO::Tracing::Instance().BindThread(context.role, context.index);
+  Timer setup("setup");
+  std::unique_ptr<CSocket> sock=ENCRYPTO::EstablishConnection(context.address, context.port, static_cast<e_role>(context.role));
+  if((context.psm_type == context.PSM3 || context.preprocess_triples > 0) &&
+     (!context.otpack_cache.empty() || !context.triple_store.empty()))
+    ENCRYPTO::ExchangePeerId(sock, context);
+  if(context.preprocess_triples > 0)
+  {
+    ENCRYPTO::PreprocessTriples(sock, context);
+    if(context.preprocess_bool_triples == 0)
+    {
+      sock->Close();
+      return;
+    }
+  }
+
+  if(context.psm_type == context.PSM3 && context.psm3_perm_hash && context.preprocess_bool_triples == 0)
+    ENCRYPTO::NegotiatePSM3PermHash(sock, inputs.elements, context);
+  if(context.psm_type == context.PSM3 && context.psm3_autotune)
+    ENCRYPTO::AutotunePSM3(sock, context);
+  if(context.psm_type == context.PSM3)
+    ENCRYPTO::BudgetPSM3Chunk(sock, context);
+
+  int lanes = (int)context.psm3_threads;
+  std::vector<sci::NetIO*> ioArr(SCI_IOS_PER_LANE*lanes, nullptr);
+  osuCrypto::IOService ios;
+  osuCrypto::Channel chl;
+  osuCrypto::Session* ep;
+  std::string name = "n"+context.port;
+
+  if(context.role == SERVER)
+  {
+    if(context.psm_type == context.PSM3)
+    {
+      for(int t=0; t<lanes; t++)
+      {
+        ioArr[t*SCI_IOS_PER_LANE] = new sci::NetIO(nullptr, sciPort(context, t, 0),true);
+        ioArr[t*SCI_IOS_PER_LANE+1] = new sci::NetIO(nullptr, sciPort(context, t, 1),true);
+        if(context.psm3_chunk > 0)
+          ioArr[t*SCI_IOS_PER_LANE+2] = new sci::NetIO(nullptr, sciPort(context, t, 2),true);
+      }
+    }
+    
+    ep= new osuCrypto::Session(ios, context.address, context.port + 3*context.n, osuCrypto::SessionMode::Server,
+                          name);
+    chl = ep->addChannel(name, name);
+  }
+  else
+  {
+    if(context.psm_type == context.PSM3)
+    {
+      for(int t=0; t<lanes; t++)
+      {
+        ioArr[t*SCI_IOS_PER_LANE] = new sci::NetIO(context.address.c_str(), sciPort(context, t, 0),true);
+        ioArr[t*SCI_IOS_PER_LANE+1] = new sci::NetIO(context.address.c_str(), sciPort(context, t, 1),true);
+        if(context.psm3_chunk > 0)
+          ioArr[t*SCI_IOS_PER_LANE+2] = new sci::NetIO(context.address.c_str(), sciPort(context, t, 2),true);
+      }
+    }
+    
+    ep = new osuCrypto::Session(ios, context.address, context.port +3*context.n, osuCrypto::SessionMode::Client,
+                          name);
+    chl = ep->addChannel(name, name);
+  }
+
+  // silent OT runs on the libOTe session, one channel for the leaf OTs and one for the triples per lane
+  std::vector<osuCrypto::Channel> silentChls;
+  if(context.psm_type == context.PSM3 && context.ot_backend == context.OT_SILENT)
+  {
+    for(int k=0; k<2*lanes; k++)
+    {
+      std::string chl_name = name + "silent" + std::to_string(k);
+      silentChls.push_back(ep->addChannel(chl_name, chl_name));
+    }
+  }
+
+  setup.end();
+
+  ENCRYPTO::CommMeter meter;
+  if(context.psm_type != context.PSM3)
+  {
+    ResetCommunication(meter, sock, chl, context);
+
+    flagOfWait++;
+    waitFor(flagOfWait,[=](){},context.index==0,context.n);
+
+    {
+      ENCRYPTO::TraceSpan query("query");
+      run_circuit_dmsp2cq(inputs.elements, inputs.values, context, sock, chl);
+    }
+    AccumulateCommunicationPSI(meter, sock, context);
+  }
+  else
+  {
+    ResetCommunication(meter, sock, chl, ioArr.data(), silentChls, context);
+
+    flagOfWait++;
+    waitFor(flagOfWait,[=](){},context.index==0,context.n);
+        
+    if(context.preprocess_bool_triples > 0)
+      ENCRYPTO::PreprocessBoolTriples(context, ioArr.data());
+    else
+    {
+      ENCRYPTO::TraceSpan query("query");
+      run_circuit_dmsp2cq3(inputs.elements, context, sock, ioArr.data(), chl, silentChls);
+    }
+    AccumulateCommunicationPSI(meter, sock, context);
+  }
+    
+  m.lock();
+  PrintCommunication(context);
+  m.unlock();
+
+  if(context.role==SERVER)
+    serverContexts.add(context,context.index);
+  else
+    clientContexts.add(context,context.index);
+
+  sock->Close();
+
+  chl.close();
+  for(auto& c : silentChls)
+    c.close();
+  ep->stop();
+  ios.stop();
+
+  for(auto io : ioArr)
+    delete io;
+  
+  delete ep;
+}
+
+std::vector<uint64_t> DefaultInputs(const PsiAnalyticsContext &context)
+{
+  std::vector<uint64_t> inputs;
+
+  if(context.role == CLIENT) {
+    if (context.psm_type!=context.PSM3)
+    {
+      for (int i = 0; i < context.cneles; i++) {
+      inputs.push_back(8000);
+    }
+    } else if (context.psm_type==context.PSM3) {
+      for (int i = 0; i < context.sneles; i++) {
+        inputs.push_back(8000);
+      }
+    }
+  } else {
+    if (context.psm_type!=context.PSM3)
+    {
+      for (int i = 0; i < context.sneles; i++) {
+        inputs.push_back(2000*i);
+      }
+    } else if (context.psm_type==context.PSM3)
+    {
+      for (int i = 0; i < context.sneles*8; i++)
+      inputs.push_back(i);
+    }
+  }
+  return inputs;
+}
+
+uint32_t PartyPortSpan(const PsiAnalyticsContext &context)
+{
+  return context.n * (5 + SCI_IOS_PER_LANE * context.psm3_threads);
+}
+
+// Node threads only get views, so all of them share one copy of the inputs
+static std::vector<PsiAnalyticsContext> RunNodes(PsiAnalyticsContext context, const std::function<NodeInputs(uint64_t)> &inputs_of)
+{
+  // the client reaches the server through the emulator, which listens on the next port block
+  ENCRYPTO::MemoryBudget::Instance().Configure(context.memory_budget);
+
+  ENCRYPTO::NetEmulator emulator(ENCRYPTO::ParseNetProfile(context.net_profile));
+  if(context.role == CLIENT && ENCRYPTO::ParseNetProfile(context.net_profile).Enabled())
+  {
+    uint32_t span = PartyPortSpan(context);
+    emulator.Start(context.port + span, context.address, context.port, span, context.n);
+    context.address = "127.0.0.1";
+    context.port += span;
+  }
+
+  std::thread* threads[context.n];
+  std::vector<size_t> client_sequence;
+  std::vector<size_t> server_sequence;
+
+  for(int i=0;i<context.n;i++)
+  {
+    client_sequence.push_back(i);
+    if(i!=0&&i!=context.n-1)
+      server_sequence.push_back(i);
+  }
+
+  if(context.role==SERVER)
+  {
+    Timer timer;
+    
+    VRF vrf;
+    std::vector<size_t> seq=vrf.sequence(context.n);
+    int leader_server=seq[0];
+    int center_server=seq[1];
+
+    server_sequence.insert(server_sequence.begin()+leader_server,0);
+    server_sequence.insert(server_sequence.begin()+center_server,context.n-1);
+    
+    context.timings.vrf=timer.end();
+
+    #if 1
+
+    std::cout<<"server_seq:";
+
+    for(auto i:server_sequence)
+    {
+      std::cout<<i<<" ";
+    }
+    std::cout<<"\n";
+
+    #endif
+  }
+  else
+  {
+    #if 0
+
+    std::cout<<"client_seq:";
+
+    for(auto i:client_sequence)
+    {
+      std::cout<<i<<" ";
+    }
+    std::cout<<"\n";
+
+    #endif
+  }
+
+  for(int i=0;i<context.n;i++)
+  {
+    ENCRYPTO::PsiAnalyticsContext tmp_context=context;
+    if(context.role == SERVER)
+    {
+      tmp_context.index=server_sequence[i];
+      tmp_context.port+=server_sequence[i];
+
+      #ifdef DEBUG
+
+      std::cout<<"Server port: "<<i<<" will be run.\n";
+
+      #endif
+    }
+    else
+    {
+      tmp_context.index=client_sequence[i];
+      tmp_context.port+=client_sequence[i];
+
+      #ifdef DEBUG
+
+      std::cout<<"Client port: "<<i<<" will be run.\n";
+
+      #endif
+    }
+    threads[i]=new std::thread(RunNode,tmp_context,inputs_of(tmp_context.index));
+    // std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+  }
+
+  for(int i=0;i<context.n;i++){
+    threads[i]->join();
+    delete threads[i];
+  }
+  emulator.Stop();
+  PrintMemoryReport(std::cout);
+
+  return context.role==SERVER?serverContexts.data():clientContexts.data();
+}
+
+std::vector<PsiAnalyticsContext> RunParty(PsiAnalyticsContext context, const std::vector<uint64_t> &inputs)
+{
+  return RunNodes(context, [&](uint64_t) { return NodeInputs{InputView(inputs), InputView()}; });
+}
+
+std::vector<PsiAnalyticsContext> RunParty(PsiAnalyticsContext context, const Dataset &dataset)
+{
+  if(dataset.Partitions() != 1 && dataset.Partitions() < context.n)
+    throw std::runtime_error("Dataset has "+std::to_string(dataset.Partitions())+" partitions for "+
+                             std::to_string(context.n)+" nodes");
+  return RunNodes(context, [&](uint64_t index) { return dataset.Partition(dataset.Partitions() == 1 ? 0 : index); });
+}
+
+std::vector<PsiAnalyticsContext> RunParty(PsiAnalyticsContext context)
+{
+  if(context.dataset.empty())
+    return RunParty(context, DefaultInputs(context));
+  Dataset dataset(context.dataset);
+  return RunParty(context, dataset);
+}
+
+PsiAnalyticsContext AverageContexts(const std::vector<PsiAnalyticsContext>& contexts)
+{
+  if(contexts.empty())
+    return ENCRYPTO::PsiAnalyticsContext();
+  
+  ENCRYPTO::PsiAnalyticsContext context;
+  context.role=contexts[0].role;
+  context.n=contexts[0].n;
+  context.psm_type=contexts[0].psm_type;
+  // PSM3 configuration as run by node 0
+  context.radix=contexts[0].radix;
+  context.psm3_wan=contexts[0].psm3_wan;
+  context.psm3_chunk=contexts[0].psm3_chunk;
+  context.psm3_threads=contexts[0].psm3_threads;
+  context.tuning=contexts[0].tuning;
+  context.psm3_opprf=contexts[0].psm3_opprf;
+  context.ot_backend=contexts[0].ot_backend;
+  context.store_dir=contexts[0].store_dir;
+  context.timings.update=0;
+  for(const auto& c : contexts)
+    if(c.role==SERVER && c.psm_type!=PsiAnalyticsContext::PSM3 && !c.store_dir.empty())
+      context.timings.update+=c.timings.update/contexts.size();
+  context.oprf_mode=contexts[0].oprf_mode;
+  context.timings.oprf_encode=0;
+  for(const auto& c : contexts)
+    if(c.role==SERVER && c.oprf_mode==PsiAnalyticsContext::OPRF_DH)
+      context.timings.oprf_encode+=c.timings.oprf_encode/contexts.size();
+  context.timings.hint_transmission=0;
+  for(const auto& c : contexts)
+    context.timings.hint_transmission+=context.psm3_opprf?c.timings.hint_transmission/contexts.size():0;
+
+  //std::cout << "**********the context.size() is" << contexts[1].timings.base_ots_libote << std::endl;
+  context.timings.base_ots_libote = 0;
+  // context.timings.base_ots_libote = 0;
+
+  for(int i=0;i<contexts.size();i++)
+  {
+    
+    if (context.psm_type==context.PSM3)
+    {
+      context.timings.psm+= contexts[i].timings.psm;
+    }
+    
+    // std::cout<<"base ots libote is "<<context.timings.base_ots_libote<< std::endl;
+    // std::cout << "the context.size() is" << contexts.size() << std::endl;
+    
+    if(context.psm_type!=context.PSM3)
+    {
+      context.timings.oprf1+=contexts[i].timings.oprf1;
+      if(i!=contexts.size()-1)
+     context.timings.base_ots_libote+=contexts[i].timings.base_ots_libote;
+    }
+
+     if(context.psm_type==context.PSM3)
+  {
+     context.timings.base_ots_sci+=contexts[i].timings.base_ots_sci;
+  }
+
+    context.timings.hint_computation+=contexts[i].timings.hint_computation;
+    if(contexts[i].role==SERVER)
+    {
+      context.timings.encrypt+=contexts[i].timings.encrypt;
+    } 
+    else if(contexts[i].role==CLIENT&&contexts[i].index==0)
+    {
+      context.timings.decrypt=contexts[i].timings.decrypt;
+    }
+
+    #if 1
+
+    if(context.psm_type!=context.PSM3)
+    {
+      m.lock();
+      // std::cout<<(contexts[i].role==SERVER?"Server":"Client")<<" "<<std::to_string(contexts[i].index)<<" "<<contexts[i].timings.base_ots_libote<<"\n";
+      m.unlock();
+    }
+
+    #endif
+
+  }
+
+
+  if(context.psm_type!=context.PSM3)
+  {
+    context.timings.oprf1=context.timings.oprf1/(context.n-1);
+    context.timings.oprf2=contexts[context.n-1].timings.oprf2;
+
+    if(context.psm_type==context.PSM2)
+      context.timings.encrypt=context.timings.encrypt/context.n;
+  
+  
+   context.timings.hint_computation=context.timings.hint_computation/context.n;
+ 
+    context.timings.base_ots_libote=context.timings.base_ots_libote/(context.n-1);
+    // std::cout<<"base ots libote is "<<context.timings.base_ots_libote<< std::endl;
+    context.timings.base_ots_sci=context.timings.base_ots_sci/context.n;
+    // std::cout<<"base_ots_sci time is "<<context.timings.base_ots_sci<<std::endl;
+    // std::cout << "contexts[n-1].base ot time: " << contexts[context.n - 1].timings.base_ots_libote<<"\n"<<std::endl;
+    context.timings.psm = contexts[0].timings.psm;
+    context.timings.total=contexts[0].timings.total;
+    context.timings.addtime=contexts[0].timings.addtime;
+    // std::cout<<"server 0 add time is: "<<context.timings.addtime<<std::endl;
+    context.timings.totalWithoutOT = context.timings.psm - context.timings.base_ots_libote -
+                                     contexts[context.n - 1].timings.base_ots_libote -
+                                     context.timings.base_ots_sci;
+
+    if (context.role == SERVER && context.psm_type == context.PSM2)
+      context.timings.encrypt=context.timings.encrypt/context.n;
+} else if(context.psm_type==context.PSM3){
+  context.timings.psm = context.timings.psm/context.n;
+}
+
+
+  return context;
+}
+
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "config.h"
+#include "dataset.h"
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * One party of a run: the n node threads of the server or of the client in this process.
+ * gcf_p2cq runs one party per process; dmsp2cq_bench forks one process per party.
+ */
+
+namespace ENCRYPTO {
+
+// Command line of gcf_p2cq; exits on --help and on a missing required option
+PsiAnalyticsContext ParsePartyOptions(int argc, char **argv);
+
+// Bin counts that follow from the element counts and epsilon, raised for cuckoo tables
+void DeriveTableSizes(PsiAnalyticsContext &context);
+
+// The synthetic inputs of the evaluation runs
+std::vector<uint64_t> DefaultInputs(const PsiAnalyticsContext &context);
+
+// Ports above context.port that one run uses; with --net-profile the client also listens on the next span
+uint32_t PartyPortSpan(const PsiAnalyticsContext &context);
+
+// Runs all nodes of context.role on context.dataset, or on DefaultInputs() without one, and
+// returns their contexts ordered by node index
+std::vector<PsiAnalyticsContext> RunParty(PsiAnalyticsContext context);
+
+// Every node on the same inputs
+std::vector<PsiAnalyticsContext> RunParty(PsiAnalyticsContext context, const std::vector<uint64_t> &inputs);
+
+// Node i on partition i, or every node on partition 0 of a single-partition dataset
+std::vector<PsiAnalyticsContext> RunParty(PsiAnalyticsContext context, const Dataset &dataset);
+
+// The party-level timings PrintTimings reports
+PsiAnalyticsContext AverageContexts(const std::vector<PsiAnalyticsContext> &contexts);
+
+}
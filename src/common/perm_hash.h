@@ -0,0 +1,93 @@
+#ifndef PERM_HASH_H__
+#define PERM_HASH_H__
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+ * Permutation-based hashing for PSM3.
+ *
+ * With k = floor(log2(nbins)) and an l-bit element x = x_L || x_R (x_L the top k bits), x is
+ * placed in bin x_L ^ h(x_R) and only x_R is stored: bin and x_R together determine x, so two
+ * entries of the same bin are equal iff their elements are. The comparison width drops from l
+ * to l - k + 1 bits; the extra top bit marks dummies, which fill empty slots and never equal a
+ * real entry or a dummy of the other party.
+ */
+
+namespace ENCRYPTO {
+
+struct PermHashLayout {
+  int k = 0;         // bits carried by the bin index
+  int l = 0;         // comparison bit-length, stored bits plus the dummy flag
+  uint64_t mask_x = 0;
+  uint64_t client_dummy = 0;
+  uint64_t server_dummy = 0;
+};
+
+inline int PermHashIndexBits(uint64_t bitlen, uint64_t nbins) {
+  int k = 0;
+  while (k + 1 < 64 && (1ull << (k + 1)) <= nbins) k++;
+  // keep at least one stored bit
+  return std::min<int>(k, (int)bitlen - 1);
+}
+
+// The comparison bit-length l; BatchEquality takes at most 64 bits, and the dummy flag needs one
+inline int PermHashCompareBits(uint64_t bitlen, uint64_t nbins) {
+  return (int)bitlen - PermHashIndexBits(bitlen, nbins) + 1;
+}
+
+inline PermHashLayout PermHashParams(uint64_t bitlen, uint64_t nbins) {
+  if (PermHashCompareBits(bitlen, nbins) > 64)
+    throw std::invalid_argument("Permutation hashing of " + std::to_string(bitlen) + "-bit elements into " +
+                                std::to_string(nbins) + " bins compares more than 64 bits");
+  PermHashLayout layout;
+  layout.k = PermHashIndexBits(bitlen, nbins);
+  int stored = (int)bitlen - layout.k;
+  layout.l = stored + 1;
+  layout.mask_x = bitlen == 64 ? ~0ull : (1ull << bitlen) - 1;
+  layout.client_dummy = 1ull << stored;
+  layout.server_dummy = (1ull << stored) | 1;
+  return layout;
+}
+
+// Public multiply-shift hash of x_R to k bits
+inline uint64_t PermHashH(uint64_t x_r, int k) {
+  return k == 0 ? 0 : (x_r * 0x9E3779B97F4A7C15ull) >> (64 - k);
+}
+
+/*
+ * Places elements (any range of uint64_t) into bins of `capacity` slots, bins[i*capacity + j], filling free slots with
+ * dummy. Repeated elements take one slot. Returns the number of elements that found their bin
+ * full; bins from 2^k up to nbins only ever hold dummies.
+ */
+template <typename Elements>
+inline size_t PermHashBins(const Elements &elements, const PermHashLayout &layout,
+                           size_t nbins, size_t capacity, uint64_t dummy,
+                           std::vector<uint64_t> &bins) {
+  int stored = layout.l - 1;
+  uint64_t mask_r = (1ull << stored) - 1;
+  bins.assign(nbins * capacity, dummy);
+  std::vector<uint32_t> load(nbins, 0);
+  size_t overflow = 0;
+  for (uint64_t x : elements) {
+    x &= layout.mask_x;
+    uint64_t x_r = x & mask_r;
+    uint64_t x_l = stored >= 64 ? 0 : x >> stored;
+    size_t bin = x_l ^ PermHashH(x_r, layout.k);
+    uint64_t *slot = bins.data() + bin * capacity;
+    if (std::find(slot, slot + load[bin], x_r) != slot + load[bin]) continue;
+    if (load[bin] == capacity) {
+      overflow++;
+      continue;
+    }
+    slot[load[bin]++] = x_r;
+  }
+  return overflow;
+}
+
+}  // namespace ENCRYPTO
+
+#endif  // PERM_HASH_H__
@@ -0,0 +1,142 @@
+#ifndef PSM3_TUNER_H__
+#define PSM3_TUNER_H__
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+/*
+ * Cost model for one PSM3 BatchEquality run, used to pick the radix, the leaf-OT mode and the
+ * chunk size from a measured link. Times are in ms. Byte counts follow the SCI protocols
+ * (KKOT column of 256 bits, IKNP of 128 bits, 16-KKOT based bit triples, 2 bits per AND and
+ * direction); the compute constants are rough single-core figures, only the ordering of the
+ * candidates matters.
+ */
+
+namespace ENCRYPTO {
+
+struct Psm3Config {
+  uint64_t radix = 5;
+  bool wan = false;
+  uint64_t chunk = 0;
+  double estimate_ms = 0;
+};
+
+struct LinkEstimate {
+  double rtt_ms = 0;
+  double mbps = 0;
+};
+
+static const double PSM3_NS_PER_OT = 150;       // OT extension, per OT
+static const double PSM3_NS_PER_LEAF_BYTE = 1;  // leaf message construction
+static const double PSM3_NS_PER_AND = 2;        // local AND evaluation
+
+struct Psm3StageCost {
+  double rounds = 0, bytes = 0, cpu_ms = 0;
+
+  double Time(const LinkEstimate &link) const {
+    return rounds * link.rtt_ms + bytes * 8 / (link.mbps * 1000) + cpu_ms;
+  }
+};
+
+// Leaf OTs and triples (offline) for cmps comparisons of batch_size entries
+inline Psm3StageCost Psm3OfflineCost(int l, int beta, bool wan, int batch_size, double cmps) {
+  int digits = (l + beta - 1) / beta, r = l % beta;
+  Psm3StageCost c;
+  double full = wan || r == 0 ? digits : digits - 1;
+  c.bytes = full * cmps * (32 + (1 << beta));
+  c.rounds = 1;
+  if (full < digits) {
+    c.bytes += cmps * ((r == 1 ? 16 : 32) + (1 << r));
+    c.rounds = 2;
+  }
+  double ots = digits * cmps;
+  double triples = (digits - 1) * batch_size * cmps;
+  // two triples per 1-of-16 OT
+  c.bytes += triples / 2 * (32 + 4);
+  ots += triples / 2;
+  c.cpu_ms = (ots * PSM3_NS_PER_OT + full * cmps * (1 << beta) * PSM3_NS_PER_LEAF_BYTE) / 1e6;
+  return c;
+}
+
+// AND tree over the leaf results
+inline Psm3StageCost Psm3OnlineCost(int l, int beta, int batch_size, double cmps) {
+  int digits = (l + beta - 1) / beta;
+  Psm3StageCost c;
+  double ands = (digits - 1) * batch_size * cmps;
+  c.rounds = std::ceil(std::log2(std::max(digits, 1)));
+  c.bytes = ands * 2 / 8 * 2;
+  c.cpu_ms = ands * PSM3_NS_PER_AND / 1e6;
+  return c;
+}
+
+/*
+ * Estimated wall time of one lane; lanes share the link but not the cores. With chunking the
+ * offline phase of block i+1 overlaps the AND rounds of block i.
+ */
+inline double Psm3EstimateMs(const LinkEstimate &link, int l, int beta, bool wan, int batch_size,
+                             uint64_t num_cmps, uint64_t chunk, int lanes) {
+  LinkEstimate lane_link = link;
+  lane_link.mbps = link.mbps / std::max(lanes, 1);
+  double cmps = (double)num_cmps / std::max(lanes, 1);
+  if (chunk == 0 || chunk >= cmps) {
+    return Psm3OfflineCost(l, beta, wan, batch_size, cmps).Time(lane_link) +
+           Psm3OnlineCost(l, beta, batch_size, cmps).Time(lane_link);
+  }
+  double blocks = std::ceil(cmps / chunk);
+  Psm3StageCost off = Psm3OfflineCost(l, beta, wan, batch_size, chunk);
+  Psm3StageCost on = Psm3OnlineCost(l, beta, batch_size, chunk);
+  double step = std::max({off.rounds * lane_link.rtt_ms + off.cpu_ms,
+                          on.rounds * lane_link.rtt_ms + on.cpu_ms,
+                          (off.bytes + on.bytes) * 8 / (lane_link.mbps * 1000)});
+  return off.Time(lane_link) + (blocks - 1) * step + on.Time(lane_link);
+}
+
+/*
+ * Cheapest (radix, leaf-OT mode, chunk) for the link. LAN mode needs a remainder OT for
+ * l % radix, which SCI only has up to 4 bits.
+ */
+inline Psm3Config Psm3Autotune(const LinkEstimate &link, int l, int batch_size, uint64_t num_cmps,
+                               int lanes) {
+  Psm3Config best;
+  best.estimate_ms = std::numeric_limits<double>::infinity();
+  uint64_t lane_cmps = num_cmps / std::max(lanes, 1);
+  for (int beta = 2; beta <= std::min(8, l); beta++) {
+    for (int wan = 0; wan < 2; wan++) {
+      if (!wan && l % beta > 4) continue;
+      for (uint64_t div : {0, 2, 4, 8, 16, 32}) {
+        uint64_t chunk = div == 0 ? 0 : (lane_cmps / div / 8) * 8;
+        if (div != 0 && chunk < 64) continue;
+        double t = Psm3EstimateMs(link, l, beta, wan, batch_size, num_cmps, chunk, lanes);
+        if (t < best.estimate_ms) {
+          best.radix = beta;
+          best.wan = wan;
+          best.chunk = chunk;
+          best.estimate_ms = t;
+        }
+      }
+    }
+  }
+  return best;
+}
+
+/*
+ * Bytes BatchEquality holds per comparison of one block: digits and leaf results, the leaf-OT
+ * messages (sender) and the packed AND triples with the openings of the AND rounds.
+ */
+inline double Psm3CompareBytesPerCmp(int l, int beta, int batch_size) {
+  int digits = (l + beta - 1) / beta;
+  double triples = (double)(digits - 1) * batch_size;
+  return digits * (2.0 * batch_size + (1 << beta) + sizeof(void *)) + triples * 7 / 8;
+}
+
+// Largest chunk, a multiple of 8, whose two live blocks fit in bytes; 8 if none does
+inline uint64_t Psm3ChunkForBytes(double bytes, int l, int beta, int batch_size) {
+  uint64_t chunk = (uint64_t)(bytes / (2 * Psm3CompareBytesPerCmp(l, beta, batch_size))) / 8 * 8;
+  return std::max<uint64_t>(chunk, 8);
+}
+
+}  // namespace ENCRYPTO
+
+#endif  // PSM3_TUNER_H__
@@ -0,0 +1,232 @@
+#ifndef SILENT_OT_H__
+#define SILENT_OT_H__
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "EzPC/SCI/src/Millionaire/bit-triple-generator.h"
+#include "cryptoTools/Common/BitVector.h"
+#include "cryptoTools/Crypto/AES.h"
+#include "cryptoTools/Crypto/PRNG.h"
+#include "cryptoTools/Network/Channel.h"
+#include "libOTe/config.h"
+#ifdef ENABLE_SILENTOT
+#include "libOTe/TwoChooseOne/SilentOtExtReceiver.h"
+#include "libOTe/TwoChooseOne/SilentOtExtSender.h"
+#endif
+
+/*
+ * Silent-OT backend for the PSM3 comparison, selected with --ot-backend silent.
+ *
+ * libOTe's SilentOtExt expands a short base-OT seed into random OTs with communication
+ * sublinear in their number, where SCI's IKNP/KKOT extension sends a 128/256-bit column per OT.
+ * BatchEquality needs chosen-input OTs, so the random OTs are derandomized here:
+ *
+ *  - leaf OTs: a 1-out-of-2^bits OT of byte messages uses `bits` random OTs. The receiver sends
+ *    its random choices XOR its digit (one byte); the sender masks message k with
+ *    H(j, XOR_i s_i[k_i ^ d_i]), of which the receiver knows exactly the key for its digit;
+ *  - AND triples: each triple takes one random OT per direction, a.b = a0.b0 ^ a1.b1 plus the
+ *    two cross terms, each of which is the XOR-sharing a random OT gives for free.
+ *
+ * The leaf OTs and the triples of a lane use separate channels, so a block can run both at once.
+ * Each direction of each channel keeps one silent-OT instance for the whole query and expands
+ * random OTs from it in batches of at least SILENT_ROT_BATCH. Calls draw from the current batch
+ * in order. Both ends draw the same counts, so their batches line up. The base OTs and the
+ * silent setup run once per lane, not once per call.
+ */
+
+namespace ENCRYPTO {
+
+#ifdef ENABLE_SILENTOT
+static const bool SILENT_OT_AVAILABLE = true;
+#else
+static const bool SILENT_OT_AVAILABLE = false;
+#endif
+
+// Smallest number of random OTs one silent expansion makes
+static const size_t SILENT_ROT_BATCH = 1 << 18;
+
+class SilentOTLane {
+ public:
+  // party as in SCI; ALICE is the leaf OT sender, like kkot_beta
+  SilentOTLane(int party, osuCrypto::Channel leaf_chl, osuCrypto::Channel triple_chl)
+      : party_(party), leaf_chl_(leaf_chl), triple_chl_(triple_chl) {}
+
+  // num 1-out-of-2^bits OTs; messages[j] holds the 2^bits byte messages of OT j
+  void LeafSend(uint8_t **messages, int num, int bits) {
+    std::vector<std::array<osuCrypto::block, 2>> rots;
+    SendROTs(leaf_send_, (size_t)num * bits, leaf_chl_, rots);
+    std::vector<uint8_t> flips(num);
+    leaf_chl_.recv(flips.data(), flips.size());
+
+    int N = 1 << bits;
+    std::vector<uint8_t> masked((size_t)num * N);
+    std::vector<osuCrypto::block> keys(N), pads(N);
+    std::array<osuCrypto::block, 8> delta;
+    for (int j = 0; j < num; j++) {
+      const std::array<osuCrypto::block, 2> *s = &rots[(size_t)j * bits];
+      keys[0] = osuCrypto::ZeroBlock;
+      for (int i = 0; i < bits; i++) {
+        keys[0] = keys[0] ^ s[i][(flips[j] >> i) & 1];
+        delta[i] = s[i][0] ^ s[i][1];
+      }
+      // key k differs from key k without its lowest set bit i in the choice of OT i
+      for (int k = 1; k < N; k++) keys[k] = keys[k & (k - 1)] ^ delta[__builtin_ctz(k)];
+      Hash(keys.data(), N, j, pads.data());
+      for (int k = 0; k < N; k++) masked[(size_t)j * N + k] = messages[j][k] ^ LowByte(pads[k]);
+    }
+    leaf_chl_.send(masked.data(), masked.size());
+  }
+
+  void LeafRecv(uint8_t *out, const uint8_t *choices, int num, int bits) {
+    std::vector<uint8_t> rand_choices;
+    std::vector<osuCrypto::block> rots;
+    RecvROTs(leaf_recv_, (size_t)num * bits, leaf_chl_, rand_choices, rots);
+
+    std::vector<uint8_t> flips(num);
+    std::vector<osuCrypto::block> keys(num);
+    for (int j = 0; j < num; j++) {
+      uint8_t c = 0;
+      keys[j] = osuCrypto::ZeroBlock;
+      for (int i = 0; i < bits; i++) {
+        c |= (uint8_t)rand_choices[(size_t)j * bits + i] << i;
+        keys[j] = keys[j] ^ rots[(size_t)j * bits + i];
+      }
+      flips[j] = c ^ choices[j];
+    }
+    leaf_chl_.send(flips.data(), flips.size());
+
+    int N = 1 << bits;
+    std::vector<uint8_t> masked((size_t)num * N);
+    leaf_chl_.recv(masked.data(), masked.size());
+    for (int j = 0; j < num; j++) {
+      osuCrypto::block pad;
+      Hash(&keys[j], 1, j, &pad);
+      out[j] = masked[(size_t)j * N + choices[j]] ^ LowByte(pad);
+    }
+  }
+
+  // Fills a packed SCI triple set
+  void BoolTriples(sci::Triple *triples) {
+    size_t n = 8 * (size_t)triples->num_bytes;
+    std::vector<std::array<osuCrypto::block, 2>> sent;
+    std::vector<osuCrypto::block> received;
+    std::vector<uint8_t> choices;
+    if (party_ == sci::ALICE) {
+      SendROTs(triple_send_, n, triple_chl_, sent);
+      RecvROTs(triple_recv_, n, triple_chl_, choices, received);
+    } else {
+      RecvROTs(triple_recv_, n, triple_chl_, choices, received);
+      SendROTs(triple_send_, n, triple_chl_, sent);
+    }
+
+    for (int byte = 0; byte < triples->num_bytes; byte++) {
+      uint8_t a = 0, b = 0, c = 0;
+      for (int bit = 0; bit < 8; bit++) {
+        size_t t = 8 * (size_t)byte + bit;
+        // sender: u = r0, v = r0 ^ r1; receiver: w = r_choice = u ^ choice.v
+        uint8_t u = LowByte(sent[t][0]) & 1;
+        uint8_t v = u ^ (LowByte(sent[t][1]) & 1);
+        uint8_t w = LowByte(received[t]) & 1;
+        uint8_t ai = (uint8_t)choices[t];
+        a |= ai << bit;
+        b |= v << bit;
+        c |= ((ai & v) ^ u ^ w) << bit;
+      }
+      triples->ai[byte] = a;
+      triples->bi[byte] = b;
+      triples->ci[byte] = c;
+    }
+  }
+
+ private:
+  // Random OTs of one direction of a channel, expanded by one instance and handed out in order
+  struct SenderPool {
+#ifdef ENABLE_SILENTOT
+    std::unique_ptr<osuCrypto::SilentOtExtSender> ot;
+#endif
+    std::vector<std::array<osuCrypto::block, 2>> rots;
+    size_t next = 0;
+  };
+
+  struct ReceiverPool {
+#ifdef ENABLE_SILENTOT
+    std::unique_ptr<osuCrypto::SilentOtExtReceiver> ot;
+#endif
+    std::vector<uint8_t> choices;
+    std::vector<osuCrypto::block> rots;
+    size_t next = 0;
+  };
+
+  static uint8_t LowByte(const osuCrypto::block &b) { return reinterpret_cast<const uint8_t *>(&b)[0]; }
+
+  // Tweaked fixed-key AES hash, H(j, x) = AES(x ^ j) ^ x ^ j
+  static void Hash(const osuCrypto::block *keys, int n, uint64_t tweak, osuCrypto::block *out) {
+    std::vector<osuCrypto::block> in(n);
+    osuCrypto::block t = osuCrypto::toBlock(tweak);
+    for (int k = 0; k < n; k++) in[k] = keys[k] ^ t;
+    osuCrypto::mAesFixedKey.ecbEncBlocks(in.data(), n, out);
+    for (int k = 0; k < n; k++) out[k] = out[k] ^ in[k];
+  }
+
+  // The next n random OTs of pool; the leftover of the last batch comes first
+  static void SendROTs(SenderPool &pool, size_t n, osuCrypto::Channel &chl,
+                       std::vector<std::array<osuCrypto::block, 2>> &out) {
+    if (pool.rots.size() - pool.next < n) {
+      pool.rots.erase(pool.rots.begin(), pool.rots.begin() + pool.next);
+      pool.next = 0;
+#ifdef ENABLE_SILENTOT
+      std::vector<std::array<osuCrypto::block, 2>> fresh(std::max(SILENT_ROT_BATCH, n - pool.rots.size()));
+      if (!pool.ot) pool.ot.reset(new osuCrypto::SilentOtExtSender);
+      osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
+      pool.ot->configure(fresh.size());
+      pool.ot->silentSend(fresh, prng, chl);
+      pool.rots.insert(pool.rots.end(), fresh.begin(), fresh.end());
+#else
+      (void)chl;
+      throw std::runtime_error("Silent OT needs libOTe built with ENABLE_SILENTOT");
+#endif
+    }
+    out.assign(pool.rots.begin() + pool.next, pool.rots.begin() + pool.next + n);
+    pool.next += n;
+  }
+
+  static void RecvROTs(ReceiverPool &pool, size_t n, osuCrypto::Channel &chl, std::vector<uint8_t> &choices,
+                       std::vector<osuCrypto::block> &out) {
+    if (pool.rots.size() - pool.next < n) {
+      pool.rots.erase(pool.rots.begin(), pool.rots.begin() + pool.next);
+      pool.choices.erase(pool.choices.begin(), pool.choices.begin() + pool.next);
+      pool.next = 0;
+#ifdef ENABLE_SILENTOT
+      std::vector<osuCrypto::block> fresh(std::max(SILENT_ROT_BATCH, n - pool.rots.size()));
+      osuCrypto::BitVector bits;
+      if (!pool.ot) pool.ot.reset(new osuCrypto::SilentOtExtReceiver);
+      osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
+      pool.ot->configure(fresh.size());
+      pool.ot->silentReceive(bits, fresh, prng, chl);
+      pool.rots.insert(pool.rots.end(), fresh.begin(), fresh.end());
+      for (size_t i = 0; i < fresh.size(); i++) pool.choices.push_back((uint8_t)bits[i]);
+#else
+      (void)chl;
+      throw std::runtime_error("Silent OT needs libOTe built with ENABLE_SILENTOT");
+#endif
+    }
+    choices.assign(pool.choices.begin() + pool.next, pool.choices.begin() + pool.next + n);
+    out.assign(pool.rots.begin() + pool.next, pool.rots.begin() + pool.next + n);
+    pool.next += n;
+  }
+
+  int party_;
+  osuCrypto::Channel leaf_chl_;
+  osuCrypto::Channel triple_chl_;
+  SenderPool leaf_send_, triple_send_;
+  ReceiverPool leaf_recv_, triple_recv_;
+};
+
+}  // namespace ENCRYPTO
+
+#endif  // SILENT_OT_H__
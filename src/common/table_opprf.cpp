@@ -0,0 +1,167 @@
+#include "table_opprf.h"
+#include "framing.h"
+
+#include "cryptoTools/Crypto/PRNG.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace ENCRYPTO {
+
+namespace {
+
+const std::size_t kMaxSeedAttempts = 64;
+
+inline std::uint64_t Mix64(std::uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+  return x;
+}
+
+inline std::uint64_t KeyLow(const osuCrypto::block& key) {
+  std::uint64_t v;
+  std::memcpy(&v, &key, sizeof(v));
+  return v;
+}
+
+inline std::uint64_t KeyHigh(const osuCrypto::block& key) {
+  std::uint64_t v;
+  std::memcpy(&v, reinterpret_cast<const std::uint8_t*>(&key) + 8, sizeof(v));
+  return v;
+}
+
+// Cell of hash function f: one cell per segment, so the ffuns cells of a key are distinct
+inline std::size_t Position(const osuCrypto::block& key, std::uint64_t seed, std::size_t f,
+                            std::uint64_t segment) {
+  std::uint64_t h = Mix64(KeyHigh(key) ^ Mix64(seed + f));
+  return f * segment + static_cast<std::size_t>((static_cast<unsigned __int128>(h) * segment) >> 64);
+}
+
+// Peels the key hypergraph for seed; on success order holds (key, free cell) pairs in peel order
+bool Peel(const std::vector<osuCrypto::block>& keys, std::uint64_t seed, std::size_t ffuns,
+          std::uint64_t segment, std::vector<std::pair<std::size_t, std::size_t>>& order) {
+  std::size_t cells = ffuns * segment;
+  std::vector<std::uint32_t> count(cells, 0);
+  std::vector<std::uint64_t> xor_index(cells, 0);
+  for (std::size_t k = 0; k < keys.size(); ++k) {
+    for (std::size_t f = 0; f < ffuns; ++f) {
+      std::size_t p = Position(keys[k], seed, f, segment);
+      count[p]++;
+      xor_index[p] ^= k;
+    }
+  }
+
+  std::vector<std::size_t> queue;
+  for (std::size_t p = 0; p < cells; ++p)
+    if (count[p] == 1) queue.push_back(p);
+
+  order.clear();
+  while (!queue.empty()) {
+    std::size_t p = queue.back();
+    queue.pop_back();
+    if (count[p] != 1) continue;
+    std::size_t k = xor_index[p];
+    order.emplace_back(k, p);
+    for (std::size_t f = 0; f < ffuns; ++f) {
+      std::size_t q = Position(keys[k], seed, f, segment);
+      count[q]--;
+      xor_index[q] ^= k;
+      if (count[q] == 1) queue.push_back(q);
+    }
+  }
+  return order.size() == keys.size();
+}
+
+}  // namespace
+
+OpprfHint ProgramOpprfHint(const std::vector<std::vector<osuCrypto::block>>& keys,
+                           const std::vector<std::uint64_t>& targets, std::size_t ffuns,
+                           double fepsilon) {
+  if (keys.size() != targets.size()) {
+    throw std::invalid_argument("ProgramOpprfHint: one target per bin required");
+  }
+
+  // A key repeated within a bin gives the same equation twice and could never be peeled
+  std::vector<osuCrypto::block> flat_keys;
+  std::vector<std::uint64_t> flat_targets;
+  for (std::size_t b = 0; b < keys.size(); ++b) {
+    std::vector<osuCrypto::block> bin(keys[b]);
+    std::sort(bin.begin(), bin.end(), [](const osuCrypto::block& x, const osuCrypto::block& y) {
+      return std::memcmp(&x, &y, sizeof(x)) < 0;
+    });
+    bin.erase(std::unique(bin.begin(), bin.end(),
+                          [](const osuCrypto::block& x, const osuCrypto::block& y) {
+                            return std::memcmp(&x, &y, sizeof(x)) == 0;
+                          }),
+              bin.end());
+    for (const auto& key : bin) {
+      flat_keys.push_back(key);
+      flat_targets.push_back(targets[b]);
+    }
+  }
+
+  OpprfHint hint;
+  hint.ffuns = std::max<std::size_t>(ffuns, 1);
+  hint.segment = std::max<std::uint64_t>(
+      1, static_cast<std::uint64_t>(std::ceil(fepsilon * flat_keys.size() / hint.ffuns)));
+
+  osuCrypto::PRNG prng(osuCrypto::sysRandomSeed());
+  std::vector<std::pair<std::size_t, std::size_t>> order;
+  bool peeled = false;
+  for (std::size_t attempt = 0; attempt < kMaxSeedAttempts && !peeled; ++attempt) {
+    hint.seed = prng.get<std::uint64_t>();
+    peeled = Peel(flat_keys, hint.seed, hint.ffuns, hint.segment, order);
+  }
+  if (!peeled) {
+    throw std::runtime_error("ProgramOpprfHint: hint table did not peel, increase --hint-epsilon");
+  }
+
+  // Cells no key is peeled on stay random; each peeled cell is fixed after all others of its key
+  hint.table.resize(hint.ffuns * hint.segment);
+  prng.get(hint.table.data(), hint.table.size() * sizeof(std::uint64_t));
+  for (auto it = order.rbegin(); it != order.rend(); ++it) {
+    std::size_t k = it->first, cell = it->second;
+    std::uint64_t v = flat_targets[k] ^ KeyLow(flat_keys[k]);
+    for (std::size_t f = 0; f < hint.ffuns; ++f) {
+      std::size_t p = Position(flat_keys[k], hint.seed, f, hint.segment);
+      if (p != cell) v ^= hint.table[p];
+    }
+    hint.table[cell] = v;
+  }
+  return hint;
+}
+
+std::uint64_t EvaluateOpprfHint(const OpprfHint& hint, const osuCrypto::block& key) {
+  std::uint64_t v = KeyLow(key);
+  for (std::size_t f = 0; f < hint.ffuns; ++f) {
+    v ^= hint.table[Position(key, hint.seed, f, hint.segment)];
+  }
+  return v;
+}
+
+void SendOpprfHint(std::unique_ptr<CSocket>& sock, const OpprfHint& hint) {
+  std::uint64_t header[3] = {hint.seed, hint.ffuns, hint.segment};
+  CSocketTransport transport(sock);
+  transport.Write(header, sizeof(header));
+  transport.Write(hint.table.data(), hint.table.size() * sizeof(std::uint64_t));
+}
+
+OpprfHint ReceiveOpprfHint(std::unique_ptr<CSocket>& sock) {
+  CSocketTransport transport(sock);
+  std::uint64_t header[3];
+  transport.Read(header, sizeof(header));
+  OpprfHint hint;
+  hint.seed = header[0];
+  hint.ffuns = header[1];
+  hint.segment = header[2];
+  hint.table.resize(hint.ffuns * hint.segment);
+  transport.Read(hint.table.data(), hint.table.size() * sizeof(std::uint64_t));
+  return hint;
+}
+
+}  // namespace ENCRYPTO
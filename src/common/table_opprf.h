@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cinttypes>
+#include <memory>
+#include <vector>
+
+#include "cryptoTools/Common/Defines.h"
+#include "ENCRYPTO_utils/socket.h"
+
+/*
+ * Table-based OPPRF on top of the KKRT OPRF.
+ *
+ * For every bin b the server holds the OPRF outputs F_b(y) of its bin entries and one
+ * programmed value t_b. It publishes a hint table T with ffuns cells per key such that
+ *   T[h_1(F_b(y))] ^ ... ^ T[h_ffuns(F_b(y))] ^ v(F_b(y)) = t_b   for every y in bin b,
+ * solved by peeling a random ffuns-hypergraph over fepsilon * #keys cells (a garbled cuckoo /
+ * XOR filter). The client evaluates the same expression on its own F_b(x) and obtains t_b if
+ * x is in bin b, a pseudo-random value otherwise.
+ */
+
+namespace ENCRYPTO {
+
+// Statistical security of a false equality on the programmed values
+#define OPPRF_STAT_BITS 40
+
+struct OpprfHint {
+  std::uint64_t seed = 0;
+  std::uint64_t ffuns = 0;
+  std::uint64_t segment = 0;  // cells per hash function, table size is ffuns * segment
+  std::vector<std::uint64_t> table;
+};
+
+// keys[b]: OPRF outputs of bin b, all programmed to targets[b]
+OpprfHint ProgramOpprfHint(const std::vector<std::vector<osuCrypto::block>>& keys,
+                           const std::vector<std::uint64_t>& targets, std::size_t ffuns,
+                           double fepsilon);
+
+std::uint64_t EvaluateOpprfHint(const OpprfHint& hint, const osuCrypto::block& key);
+
+void SendOpprfHint(std::unique_ptr<CSocket>& sock, const OpprfHint& hint);
+
+OpprfHint ReceiveOpprfHint(std::unique_ptr<CSocket>& sock);
+
+}  // namespace ENCRYPTO
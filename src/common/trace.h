@@ -0,0 +1,161 @@
+#ifndef TRACE_H__
+#define TRACE_H__
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Nested timing spans per node thread, exported as Chrome trace JSON (chrome://tracing, Perfetto).
+ *
+ * Each thread that calls BindThread() gets its own fixed-size ring of finished spans, so
+ * recording is a clock read and a store without locks; the oldest spans are overwritten when a
+ * ring is full. Nesting is implied by the time ranges on a thread. Times come from
+ * steady_clock, which is system-wide on Linux, so the files of the server and the client
+ * processes of one run share a time base and can be merged into one view. Nothing is recorded
+ * unless --trace-json is given.
+ */
+
+namespace ENCRYPTO {
+
+using TraceClock = std::chrono::steady_clock;
+
+struct TraceEvent {
+  const char *name;
+  TraceClock::time_point begin, end;
+};
+
+class TraceRing {
+ public:
+  TraceRing(uint32_t role, uint32_t node, size_t capacity)
+      : role(role), node(node), events_(capacity) {}
+
+  void Push(const char *name, TraceClock::time_point begin, TraceClock::time_point end) {
+    events_[next_ % events_.size()] = {name, begin, end};
+    next_++;
+  }
+
+  // Oldest first
+  template <typename F>
+  void ForEach(F f) const {
+    size_t count = std::min(next_, events_.size());
+    for (size_t i = next_ - count; i < next_; i++) f(events_[i % events_.size()]);
+  }
+
+  const uint32_t role, node;
+
+ private:
+  std::vector<TraceEvent> events_;
+  size_t next_ = 0;
+};
+
+class Tracing {
+ public:
+  static Tracing &Instance() {
+    static Tracing tracing;
+    return tracing;
+  }
+
+  // Called once before the node threads start
+  void Enable(size_t ring_capacity = 1 << 14) {
+    capacity_ = ring_capacity;
+    enabled_ = true;
+  }
+
+  bool Enabled() const { return enabled_; }
+
+  // Spans of the calling thread belong to this node from now on
+  void BindThread(uint32_t role, uint32_t node) {
+    if (!enabled_) return;
+    std::lock_guard<std::mutex> lock(m_);
+    rings_.emplace_back(new TraceRing(role, node, capacity_));
+    Ring() = rings_.back().get();
+  }
+
+  void Record(const char *name, TraceClock::time_point begin, TraceClock::time_point end) {
+    TraceRing *ring = Ring();
+    if (ring) ring->Push(name, begin, end);
+  }
+
+  // Call after the node threads have finished
+  bool WriteChromeTrace(const std::string &path) {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+      std::cerr << "Failed to open file: " << path << std::endl;
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(m_);
+    out << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    auto sep = [&]() {
+      if (!first) out << ",";
+      first = false;
+      out << "\n";
+    };
+    std::vector<uint32_t> roles;
+    for (const auto &ring : rings_) {
+      if (std::find(roles.begin(), roles.end(), ring->role) == roles.end()) {
+        roles.push_back(ring->role);
+        sep();
+        out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << ring->role
+            << ",\"args\":{\"name\":\"" << (ring->role == 0 ? "server" : "client") << "\"}}";
+      }
+      sep();
+      out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << ring->role << ",\"tid\":" << ring->node
+          << ",\"args\":{\"name\":\"node " << ring->node << "\"}}";
+      ring->ForEach([&](const TraceEvent &e) {
+        sep();
+        out << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":" << ring->role
+            << ",\"tid\":" << ring->node << ",\"ts\":" << Micros(e.begin)
+            << ",\"dur\":" << Micros(e.end) - Micros(e.begin) << "}";
+      });
+    }
+    out << "\n]}\n";
+    return out.good();
+  }
+
+ private:
+  Tracing() = default;
+
+  static TraceRing *&Ring() {
+    static thread_local TraceRing *ring = nullptr;
+    return ring;
+  }
+
+  static double Micros(TraceClock::time_point t) {
+    return std::chrono::duration<double, std::micro>(t.time_since_epoch()).count();
+  }
+
+  bool enabled_ = false;
+  size_t capacity_ = 0;
+  std::mutex m_;
+  std::vector<std::unique_ptr<TraceRing>> rings_;
+};
+
+// Records [construction, destruction) as `name` on the calling node thread; name must outlive the export
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char *name) : name_(Tracing::Instance().Enabled() ? name : nullptr) {
+    if (name_) begin_ = TraceClock::now();
+  }
+  ~TraceSpan() {
+    if (name_) Tracing::Instance().Record(name_, begin_, TraceClock::now());
+  }
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+
+ private:
+  const char *name_;
+  TraceClock::time_point begin_;
+};
+
+}  // namespace ENCRYPTO
+
+#endif  // TRACE_H__
@@ -0,0 +1,269 @@
+#ifndef TRACE_DUMP_H__
+#define TRACE_DUMP_H__
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+ * Binary dumps of intermediate protocol data, written by a background thread.
+ *
+ * Protocol threads hand over their buffers by move (or by copy where they keep using them); the
+ * writer appends them to DIR/trace_p<role>.bin. Nothing is formatted on the protocol threads
+ * and nothing is done at all for stages that are not enabled. Stages are chosen at runtime with
+ * --trace-dump DIR --trace-stages oprf1,oprf2,...; trace_decode turns a dump back into the CSV
+ * files the old debug builds wrote.
+ *
+ * File: header {u32 magic, u32 version, u32 role, u32 reserved}, then records
+ * {u32 stage, u32 index, u8 type, u8 reserved, u16 elem_size, u32 name_len, u64 rows, name,
+ *  rows x (u64 count, count * elem_size bytes)}.
+ */
+
+namespace ENCRYPTO {
+
+static const uint32_t TRACE_DUMP_MAGIC = 0x52544d44;  // "DMTR"
+static const uint32_t TRACE_DUMP_VERSION = 1;
+
+enum TraceStage : uint32_t {
+  TRACE_OPRF1 = 1 << 0,   // OPRF1 outputs of every node
+  TRACE_OPRF2 = 1 << 1,   // OPRF2 outputs of the center
+  TRACE_MATCH = 1 << 2,   // everything the leader matches on
+  TRACE_BINS = 1 << 3,    // PSM3 comparison inputs
+  TRACE_KEYS = 1 << 4,    // PSM3 zero-sum keys of the servers
+  TRACE_SHARES = 1 << 5,  // PSM3 result shares
+  TRACE_ALL = (1 << 6) - 1
+};
+
+static const char *const TRACE_STAGE_NAMES[] = {"oprf1", "oprf2", "match", "bins", "keys", "shares"};
+
+inline const char *TraceStageName(uint32_t stage) {
+  for (int i = 0; i < 6; i++)
+    if (stage == (1u << i)) return TRACE_STAGE_NAMES[i];
+  return "unknown";
+}
+
+// "all" or a comma-separated list of stage names
+inline uint32_t ParseTraceStages(const std::string &list) {
+  uint32_t mask = 0;
+  std::stringstream ss(list);
+  std::string name;
+  while (std::getline(ss, name, ',')) {
+    if (name.empty()) continue;
+    if (name == "all") {
+      mask |= TRACE_ALL;
+      continue;
+    }
+    uint32_t stage = 0;
+    for (int i = 0; i < 6; i++)
+      if (name == TRACE_STAGE_NAMES[i]) stage = 1u << i;
+    if (stage == 0) throw std::invalid_argument("Unknown trace stage: " + name);
+    mask |= stage;
+  }
+  return mask;
+}
+
+enum TraceType : uint8_t { TRACE_U8 = 1, TRACE_I32 = 2, TRACE_U32 = 3, TRACE_U64 = 4 };
+
+template <typename T>
+struct TraceTypeOf;
+template <>
+struct TraceTypeOf<uint8_t> { static const uint8_t value = TRACE_U8; };
+template <>
+struct TraceTypeOf<int32_t> { static const uint8_t value = TRACE_I32; };
+template <>
+struct TraceTypeOf<uint32_t> { static const uint8_t value = TRACE_U32; };
+template <>
+struct TraceTypeOf<uint64_t> { static const uint8_t value = TRACE_U64; };
+
+struct TraceRecordHeader {
+  uint32_t stage, index;
+  uint8_t type, reserved;
+  uint16_t elem_size;
+  uint32_t name_len;
+  uint64_t rows;
+};
+
+class TraceDump {
+ public:
+  static TraceDump &Instance() {
+    static TraceDump dump;
+    return dump;
+  }
+
+  bool Open(const std::string &dir, uint32_t role, uint32_t stages) {
+    std::string path = dir + "/trace_p" + std::to_string(role) + ".bin";
+    file_.open(path, std::ios::binary | std::ios::trunc);
+    if (!file_.is_open()) {
+      std::cerr << "Failed to open file: " << path << std::endl;
+      return false;
+    }
+    uint32_t header[4] = {TRACE_DUMP_MAGIC, TRACE_DUMP_VERSION, role, 0};
+    file_.write(reinterpret_cast<const char *>(header), sizeof(header));
+    stages_ = stages;
+    writer_ = std::thread(&TraceDump::Run, this);
+    return true;
+  }
+
+  bool Enabled(uint32_t stage) const { return (stages_ & stage) != 0; }
+
+  template <typename T>
+  void Submit(uint32_t stage, uint32_t index, const std::string &name, std::vector<T> &&data) {
+    auto owner = std::make_shared<std::vector<T>>(std::move(data));
+    Record record = MakeRecord<T>(stage, index, name);
+    record.rows.emplace_back(owner->data(), owner->size());
+    record.owner = owner;
+    Push(std::move(record));
+  }
+
+  template <typename T>
+  void Submit(uint32_t stage, uint32_t index, const std::string &name,
+              std::vector<std::vector<T>> &&data) {
+    auto owner = std::make_shared<std::vector<std::vector<T>>>(std::move(data));
+    Record record = MakeRecord<T>(stage, index, name);
+    for (const auto &row : *owner) record.rows.emplace_back(row.data(), row.size());
+    record.owner = owner;
+    Push(std::move(record));
+  }
+
+  // Copying overload for buffers the caller keeps using
+  template <typename T>
+  void Submit(uint32_t stage, uint32_t index, const std::string &name, const T &data) {
+    Submit(stage, index, name, T(data));
+  }
+
+  // Drains the queue and closes the file; later submissions are dropped
+  void Close() {
+    {
+      std::lock_guard<std::mutex> lock(m_);
+      if (!writer_.joinable()) return;
+      closing_ = true;
+    }
+    cv_.notify_all();
+    writer_.join();
+    file_.close();
+    stages_ = 0;
+  }
+
+  ~TraceDump() { Close(); }
+
+ private:
+  struct Record {
+    TraceRecordHeader header;
+    std::string name;
+    std::vector<std::pair<const void *, uint64_t>> rows;
+    std::shared_ptr<void> owner;
+  };
+
+  TraceDump() = default;
+
+  template <typename T>
+  static Record MakeRecord(uint32_t stage, uint32_t index, const std::string &name) {
+    Record record;
+    record.header = {stage, index, TraceTypeOf<T>::value, 0, sizeof(T), (uint32_t)name.size(), 0};
+    record.name = name;
+    return record;
+  }
+
+  void Push(Record &&record) {
+    {
+      std::lock_guard<std::mutex> lock(m_);
+      if (closing_ || !writer_.joinable()) return;
+      queue_.push_back(std::move(record));
+    }
+    cv_.notify_one();
+  }
+
+  void Run() {
+    std::unique_lock<std::mutex> lock(m_);
+    for (;;) {
+      cv_.wait(lock, [this] { return closing_ || !queue_.empty(); });
+      if (queue_.empty()) return;
+      Record record = std::move(queue_.front());
+      queue_.pop_front();
+      lock.unlock();
+      Write(record);
+      lock.lock();
+    }
+  }
+
+  void Write(Record &record) {
+    record.header.rows = record.rows.size();
+    file_.write(reinterpret_cast<const char *>(&record.header), sizeof(record.header));
+    file_.write(record.name.data(), record.name.size());
+    for (const auto &row : record.rows) {
+      file_.write(reinterpret_cast<const char *>(&row.second), sizeof(row.second));
+      file_.write(static_cast<const char *>(row.first), row.second * record.header.elem_size);
+    }
+  }
+
+  std::ofstream file_;
+  uint32_t stages_ = 0;
+  std::thread writer_;
+  std::mutex m_;
+  std::condition_variable cv_;
+  std::deque<Record> queue_;
+  bool closing_ = false;
+};
+
+inline bool TraceEnabled(uint32_t stage) { return TraceDump::Instance().Enabled(stage); }
+
+template <typename Data>
+void TraceSubmit(uint32_t stage, uint32_t index, const std::string &name, Data &&data) {
+  TraceDump::Instance().Submit(stage, index, name, std::forward<Data>(data));
+}
+
+/*
+ * Sequential reader for trace_decode.
+ */
+class TraceReader {
+ public:
+  struct Entry {
+    TraceRecordHeader header;
+    std::string name;
+    std::vector<std::vector<uint8_t>> rows;  // raw elements, header.elem_size bytes each
+  };
+
+  bool Open(const std::string &path) {
+    file_.open(path, std::ios::binary);
+    uint32_t header[4];
+    if (!file_.read(reinterpret_cast<char *>(header), sizeof(header))) return false;
+    role_ = header[2];
+    return header[0] == TRACE_DUMP_MAGIC && header[1] == TRACE_DUMP_VERSION;
+  }
+
+  uint32_t Role() const { return role_; }
+
+  bool Next(Entry &entry) {
+    if (!file_.read(reinterpret_cast<char *>(&entry.header), sizeof(entry.header))) return false;
+    entry.name.resize(entry.header.name_len);
+    file_.read(&entry.name[0], entry.name.size());
+    entry.rows.resize(entry.header.rows);
+    for (auto &row : entry.rows) {
+      uint64_t count = 0;
+      file_.read(reinterpret_cast<char *>(&count), sizeof(count));
+      row.resize(count * entry.header.elem_size);
+      file_.read(reinterpret_cast<char *>(row.data()), row.size());
+    }
+    if (!file_) throw std::runtime_error("Truncated trace record " + entry.name);
+    return true;
+  }
+
+ private:
+  std::ifstream file_;
+  uint32_t role_ = 0;
+};
+
+}  // namespace ENCRYPTO
+
+#endif  // TRACE_DUMP_H__
@@ -0,0 +1,129 @@
+#ifndef TRIPLE_STORE_H__
+#define TRIPLE_STORE_H__
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+ * Preprocessed correlated randomness, kept in DIR/<tag>_<peer>_<key>_p<role>.bin.
+ *
+ * Arithmetic Beaver triples for the PSM3 multiplication tail: --preprocess-triples N makes
+ * every server node deal N triples to its client node once; both keep their shares. Online
+ * runs take the next triples by index and only send that index, so neither the dealing nor its
+ * RNG is on the query path.
+ *
+ * Boolean AND triples for BatchEquality: --preprocess-bool-triples N runs the 16-KKOT triple
+ * generation of every lane ahead of time and keeps the packed shares, so an online comparison
+ * only does the leaf OTs and the AND rounds.
+ *
+ * Every file holds fixed-size records behind a header with the record count and a cursor; the
+ * cursor is advanced on every take.
+ */
+
+namespace ENCRYPTO {
+
+static const uint32_t TRIPLE_STORE_VERSION = 1;
+
+struct ArithTriple {
+  int32_t a, b, c;
+
+  static uint32_t Magic() { return 0x50525442; }  // "BTRP"
+  static const char *Tag() { return "triples"; }
+};
+
+// Eight packed boolean triples, bit k of a, b, c belongs to the same triple
+struct PackedBoolTriples {
+  uint8_t a, b, c;
+
+  static uint32_t Magic() { return 0x42525442; }  // "BTRB"
+  static const char *Tag() { return "bool_triples"; }
+};
+
+// c = a * b for a, b in [100, 10000], split into a dealer share and a peer share
+template <typename RNG>
+void DealArithTriple(RNG &rng, ArithTriple &mine, ArithTriple &peer) {
+  std::uniform_int_distribution<int32_t> value(100, 10000), share(1, 100);
+  int32_t a = value(rng), b = value(rng), c = a * b;
+  peer = {share(rng), share(rng), share(rng)};
+  mine = {a - peer.a, b - peer.b, c - peer.c};
+}
+
+template <typename Record>
+class RecordStore {
+ public:
+  static std::string Path(const std::string &dir, const std::string &peer, const std::string &key,
+                          uint32_t role) {
+    std::string name = peer;
+    for (auto &c : name)
+      if (!isalnum(static_cast<unsigned char>(c)) && c != '.') c = '_';
+    return dir + "/" + Record::Tag() + "_" + name + "_" + key + "_p" + std::to_string(role) + ".bin";
+  }
+
+  // Replaces the file at path with a fresh batch, cursor at 0
+  static bool Write(const std::string &path, uint32_t role, const std::vector<Record> &records) {
+    std::string tmp = path + ".tmp";
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+      std::cerr << "Failed to open file: " << tmp << std::endl;
+      return false;
+    }
+    Header header{Record::Magic(), TRIPLE_STORE_VERSION, role, 0, records.size(), 0};
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(records.data()), sizeof(Record) * records.size());
+    out.close();
+    return out.good() && std::rename(tmp.c_str(), path.c_str()) == 0;
+  }
+
+  bool Open(const std::string &path, uint32_t role) {
+    file_.open(path, std::ios::binary | std::ios::in | std::ios::out);
+    if (!file_.is_open()) return false;
+    file_.read(reinterpret_cast<char *>(&header_), sizeof(header_));
+    if (!file_ || header_.magic != Record::Magic() || header_.version != TRIPLE_STORE_VERSION ||
+        header_.role != role || header_.next > header_.count) {
+      file_.close();
+      return false;
+    }
+    return true;
+  }
+
+  bool IsOpen() const { return file_.is_open(); }
+  uint64_t Next() const { return header_.next; }
+  uint64_t Available() const { return IsOpen() ? header_.count - header_.next : 0; }
+
+  // The next k records; the cursor is persisted before they are handed out
+  std::vector<Record> Take(std::size_t k) {
+    if (k > Available()) throw std::runtime_error(std::string(Record::Tag()) + " store exhausted");
+    std::vector<Record> records(k);
+    file_.seekg(sizeof(Header) + sizeof(Record) * header_.next);
+    file_.read(reinterpret_cast<char *>(records.data()), sizeof(Record) * k);
+    if (!file_) throw std::runtime_error(std::string("Corrupt ") + Record::Tag() + " store");
+    header_.next += k;
+    file_.seekp(0);
+    file_.write(reinterpret_cast<const char *>(&header_), sizeof(header_));
+    file_.flush();
+    return records;
+  }
+
+ private:
+  struct Header {
+    uint32_t magic, version, role, reserved;
+    uint64_t count, next;
+  };
+
+  std::fstream file_;
+  Header header_{};
+};
+
+using TripleStore = RecordStore<ArithTriple>;
+using BoolTriplePool = RecordStore<PackedBoolTriples>;
+
+}  // namespace ENCRYPTO
+
+#endif  // TRIPLE_STORE_H__
@@ -0,0 +1,411 @@
+#include "update_store.h"
+
+#include "HashingTables/simple_hashing/simple_hashing.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <unordered_map>
+
+namespace ENCRYPTO {
+
+namespace {
+
+const char kStoreMagic[8] = {'D', 'M', 'S', 'P', 'S', 'T', '1', '\0'};
+const char kCipherMagic[8] = {'D', 'M', 'S', 'P', 'C', 'T', '1', '\0'};
+const uint32_t kStoreVersion = 1;
+const uint32_t kDead = std::numeric_limits<uint32_t>::max();
+
+struct StoreHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t nfuns;
+  uint64_t nbins;
+  uint64_t positions;
+  uint64_t entries;  // of the simple table
+  uint64_t applied;
+  uint64_t generation;
+};
+static_assert(sizeof(StoreHeader) == 56, "StoreHeader is part of the file format");
+
+struct CipherHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_bytes;  // NumBytes(n^2)
+  uint64_t key_bytes;     // NumBytes(n)
+  uint64_t count;         // ciphertexts stored, of positions [0, count)
+  uint64_t generation;    // of the store they were encrypted for
+};
+static_assert(sizeof(CipherHeader) == 40, "CipherHeader is part of the file format");
+
+struct Entry {
+  uint64_t element;
+  uint64_t position;
+};
+
+// The bins of every element, as buildSimpleTable hashes them: sorted, each element once per bin
+std::vector<std::vector<uint64_t>> HashToBins(const std::vector<uint64_t> &elements, uint64_t nbins,
+                                              uint32_t nfuns) {
+  SimpleTable table(static_cast<std::size_t>(nbins));
+  table.SetNumOfHashFunctions(nfuns);
+  table.Insert(elements);
+  table.MapElements();
+  auto bins = table.AsRaw2DVector();
+  for (auto &bin : bins) {
+    std::sort(bin.begin(), bin.end());
+    bin.erase(std::unique(bin.begin(), bin.end()), bin.end());
+  }
+  return bins;
+}
+
+// Position of element in a sorted bin, or bin.size()
+size_t Find(const std::vector<uint64_t> &bin, uint64_t element) {
+  auto it = std::lower_bound(bin.begin(), bin.end(), element);
+  return it != bin.end() && *it == element ? it - bin.begin() : bin.size();
+}
+
+void ReadExactly(std::FILE *file, void *data, size_t bytes, const std::string &path) {
+  if (bytes && std::fread(data, 1, bytes, file) != bytes) throw std::runtime_error("truncated " + path);
+}
+
+void WriteExactly(std::FILE *file, const void *data, size_t bytes, const std::string &path) {
+  if (bytes && std::fwrite(data, 1, bytes, file) != bytes) throw std::runtime_error("Cannot write " + path);
+}
+
+// Replaces path with what write puts into a file beside it
+template <typename F>
+void ReplaceFile(const std::string &path, F write) {
+  const std::string tmp = path + ".tmp";
+  std::FILE *file = std::fopen(tmp.c_str(), "wb");
+  if (!file) throw std::runtime_error("Cannot create " + tmp);
+  try {
+    write(file, tmp);
+  } catch (...) {
+    std::fclose(file);
+    std::remove(tmp.c_str());
+    throw;
+  }
+  if (std::fclose(file) != 0 || std::rename(tmp.c_str(), path.c_str()) != 0) {
+    std::remove(tmp.c_str());
+    throw std::runtime_error("Cannot write " + path);
+  }
+}
+
+uint32_t NewPosition(size_t positions) {
+  if (positions >= kDead) throw std::runtime_error("Store positions exceed 32 bits");
+  return static_cast<uint32_t>(positions);
+}
+
+}  // namespace
+
+NodeStore::NodeStore(const std::string &dir, uint64_t node, uint64_t nbins, uint32_t nfuns)
+    : dir_(dir), node_(node), nbins_(nbins), nfuns_(nfuns) {}
+
+StoreStats NodeStore::Sync(InputView elements, InputView values) {
+  stats_ = StoreStats();
+  moved_.clear();
+  bool changed = false;
+  if (!Load()) {
+    Build(elements, values);
+    stats_.rebuilt = true;
+    changed = true;
+  }
+
+  std::vector<UpdateRecord> log = ReadLog();
+  if (!log.empty()) {
+    Apply(log);
+    applied_ += log.size();
+    changed = true;
+  }
+  uint64_t live = std::count(live_.begin(), live_.end(), true);
+  if (live_.size() - live > live) {
+    Compact();
+    stats_.compacted = true;
+    changed = true;
+  }
+  if (changed) Write();
+  stats_.live = live;
+  return stats_;
+}
+
+void NodeStore::TakeTable(std::vector<std::vector<uint64_t>> &bins, std::vector<std::vector<uint32_t>> &index) {
+  bins = std::move(bins_);
+  index = std::move(index_);
+  bins_.clear();
+  index_.clear();
+}
+
+std::vector<NTL::ZZ> NodeStore::Ciphertexts(const NTL::ZZ &n, const ValueEncryptor &encrypt) {
+  const size_t positions = values_.size();
+  const long record_bytes = NTL::NumBytes(n * n);
+  std::vector<unsigned char> key(NTL::NumBytes(n));
+  NTL::BytesFromZZ(key.data(), n, key.size());
+
+  std::vector<NTL::ZZ> ciphertexts(positions);
+  std::vector<bool> have(positions, false);
+  const std::string path = StorePath(dir_, node_, "cipher");
+  uint64_t stored = 0;  // ciphertexts of this generation, in place
+  if (std::FILE *file = std::fopen(path.c_str(), "rb")) {
+    CipherHeader header;
+    std::vector<unsigned char> stored_key, record(record_bytes);
+    bool usable = std::fread(&header, sizeof(header), 1, file) == 1 &&
+                  std::memcmp(header.magic, kCipherMagic, sizeof(kCipherMagic)) == 0 &&
+                  header.version == kStoreVersion && header.record_bytes == (uint64_t)record_bytes &&
+                  header.key_bytes == key.size();
+    if (usable) {
+      stored_key.resize(header.key_bytes);
+      usable = std::fread(stored_key.data(), 1, stored_key.size(), file) == stored_key.size() && stored_key == key;
+    }
+    const bool same = usable && header.generation == generation_;
+    const bool moved = usable && !moved_.empty() && header.generation == moved_from_;
+    for (uint64_t p = 0; (same || moved) && p < header.count; p++) {
+      if (std::fread(record.data(), 1, record.size(), file) != record.size()) break;
+      uint64_t q = same ? p : p < moved_.size() ? moved_[p] : kDead;
+      if (q >= positions) continue;
+      ciphertexts[q] = NTL::ZZFromBytes(record.data(), record.size());
+      have[q] = true;
+      if (same) stored = p + 1;
+    }
+    std::fclose(file);
+  }
+
+  // dead positions nothing refers to keep a zero in place of a ciphertext
+  std::vector<uint64_t> missing, plain;
+  for (size_t q = 0; q < positions; q++) {
+    if (have[q] || !live_[q]) continue;
+    missing.push_back(q);
+    plain.push_back(values_[q]);
+  }
+  if (!plain.empty()) {
+    std::vector<NTL::ZZ> encrypted = encrypt(plain);
+    if (encrypted.size() != plain.size()) throw std::logic_error("Encryptor returned a wrong number of ciphertexts");
+    for (size_t i = 0; i < missing.size(); i++) ciphertexts[missing[i]] = std::move(encrypted[i]);
+  }
+  stats_.encrypted = missing.size();
+
+  CipherHeader header;
+  std::memcpy(header.magic, kCipherMagic, sizeof(kCipherMagic));
+  header.version = kStoreVersion;
+  header.record_bytes = record_bytes;
+  header.key_bytes = key.size();
+  header.count = positions;
+  header.generation = generation_;
+  std::vector<unsigned char> record(record_bytes);
+  auto write_records = [&](std::FILE *file, const std::string &name, size_t first) {
+    for (size_t q = first; q < positions; q++) {
+      NTL::BytesFromZZ(record.data(), ciphertexts[q], record.size());
+      WriteExactly(file, record.data(), record.size(), name);
+    }
+  };
+  if (stored > 0 && stored < positions) {
+    // the same key and positions: only the new ones go to the end, then the count
+    std::FILE *file = std::fopen(path.c_str(), "r+b");
+    if (!file) throw std::runtime_error("Cannot open " + path);
+    try {
+      if (std::fseek(file, sizeof(header) + key.size() + stored * record_bytes, SEEK_SET) != 0)
+        throw std::runtime_error("Cannot seek in " + path);
+      write_records(file, path, stored);
+      if (std::fflush(file) != 0 || std::fseek(file, 0, SEEK_SET) != 0) throw std::runtime_error("Cannot write " + path);
+      WriteExactly(file, &header, sizeof(header), path);
+    } catch (...) {
+      std::fclose(file);
+      throw;
+    }
+    if (std::fclose(file) != 0) throw std::runtime_error("Cannot write " + path);
+  } else if (stored < positions || positions == 0) {
+    ReplaceFile(path, [&](std::FILE *file, const std::string &name) {
+      WriteExactly(file, &header, sizeof(header), name);
+      WriteExactly(file, key.data(), key.size(), name);
+      write_records(file, name, 0);
+    });
+  }
+  return ciphertexts;
+}
+
+void NodeStore::Remove(const std::string &dir, uint64_t node) {
+  for (const char *file : {"log", "store", "store.tmp", "cipher", "cipher.tmp"})
+    std::remove(StorePath(dir, node, file).c_str());
+}
+
+// Reads the store file; false if there is none, or none of this table shape
+bool NodeStore::Load() {
+  const std::string path = StorePath(dir_, node_, "store");
+  std::FILE *file = std::fopen(path.c_str(), "rb");
+  if (!file) return false;
+  StoreHeader header;
+  std::vector<uint64_t> offsets;
+  std::vector<Entry> entries;
+  bool valid = std::fread(&header, sizeof(header), 1, file) == 1 &&
+               std::memcmp(header.magic, kStoreMagic, sizeof(kStoreMagic)) == 0 &&
+               header.version == kStoreVersion && header.nbins == nbins_ && header.nfuns == nfuns_ &&
+               header.positions < kDead;
+  try {
+    if (valid) {
+      values_.resize(header.positions);
+      offsets.resize(nbins_ + 1);
+      entries.resize(header.entries);
+      ReadExactly(file, values_.data(), values_.size() * sizeof(uint64_t), path);
+      ReadExactly(file, offsets.data(), offsets.size() * sizeof(uint64_t), path);
+      ReadExactly(file, entries.data(), entries.size() * sizeof(Entry), path);
+    }
+  } catch (const std::runtime_error &) {
+    valid = false;
+  }
+  std::fclose(file);
+  for (uint64_t b = 0; valid && b < nbins_; b++)
+    valid = offsets[b] <= offsets[b + 1];
+  valid = valid && offsets[0] == 0 && offsets[nbins_] == entries.size();
+  if (!valid) return false;
+
+  bins_.assign(nbins_, {});
+  index_.assign(nbins_, {});
+  live_.assign(header.positions, false);
+  for (uint64_t b = 0; b < nbins_; b++) {
+    for (uint64_t k = offsets[b]; k < offsets[b + 1]; k++) {
+      if (entries[k].position >= header.positions) return false;
+      bins_[b].push_back(entries[k].element);
+      index_[b].push_back(static_cast<uint32_t>(entries[k].position));
+      live_[entries[k].position] = true;
+    }
+  }
+  applied_ = header.applied;
+  generation_ = header.generation;
+  return true;
+}
+
+// The table buildSimpleTable builds from the inputs, positions being those of the inputs
+void NodeStore::Build(InputView elements, InputView values) {
+  NewPosition(elements.size());
+  std::mt19937_64 rng(std::random_device{}());
+  std::uniform_int_distribution<uint64_t> random_value(1, 10000);
+  values_.resize(elements.size());
+  for (size_t i = 0; i < values_.size(); i++)
+    values_[i] = values.empty() ? random_value(rng) : i < values.size() ? values[i] : 0;
+
+  // a repeated element keeps its first position, the later ones are dead
+  std::unordered_map<uint64_t, uint32_t> position;
+  std::vector<uint64_t> distinct;
+  live_.assign(elements.size(), false);
+  for (size_t i = 0; i < elements.size(); i++) {
+    if (position.emplace(elements[i], static_cast<uint32_t>(i)).second) {
+      distinct.push_back(elements[i]);
+      live_[i] = true;
+    }
+  }
+  std::sort(distinct.begin(), distinct.end());
+  bins_ = HashToBins(distinct, nbins_, nfuns_);
+  index_.assign(bins_.size(), {});
+  for (size_t b = 0; b < bins_.size(); b++)
+    for (uint64_t v : bins_[b]) index_[b].push_back(position.at(v));
+
+  applied_ = 0;
+  generation_ = rng();
+  std::remove(StorePath(dir_, node_, "cipher").c_str());
+}
+
+void NodeStore::Apply(const std::vector<UpdateRecord> &records) {
+  // only the delta is hashed; an element's bins are those it has in the full table
+  std::vector<uint64_t> delta;
+  for (const auto &r : records) {
+    if (r.op != UPDATE_ADD && r.op != UPDATE_DELETE)
+      throw std::runtime_error("Bad record in update log of node " + std::to_string(node_));
+    delta.push_back(r.element);
+  }
+  std::sort(delta.begin(), delta.end());
+  delta.erase(std::unique(delta.begin(), delta.end()), delta.end());
+  std::unordered_map<uint64_t, std::vector<uint32_t>> bins_of;
+  auto delta_bins = HashToBins(delta, nbins_, nfuns_);
+  for (size_t b = 0; b < delta_bins.size(); b++)
+    for (uint64_t v : delta_bins[b]) bins_of[v].push_back(static_cast<uint32_t>(b));
+
+  for (const auto &r : records) {
+    const std::vector<uint32_t> &bins = bins_of[r.element];
+    if (bins.empty()) continue;
+    size_t k = Find(bins_[bins[0]], r.element);
+    const bool stored = k < bins_[bins[0]].size();
+    if (stored) live_[index_[bins[0]][k]] = false;
+    if (r.op == UPDATE_DELETE) {
+      if (!stored) continue;
+      for (uint32_t b : bins) {
+        k = Find(bins_[b], r.element);
+        bins_[b].erase(bins_[b].begin() + k);
+        index_[b].erase(index_[b].begin() + k);
+      }
+      stats_.deleted++;
+      continue;
+    }
+
+    const uint32_t position = NewPosition(values_.size());
+    values_.push_back(r.value);
+    live_.push_back(true);
+    for (uint32_t b : bins) {
+      k = std::lower_bound(bins_[b].begin(), bins_[b].end(), r.element) - bins_[b].begin();
+      if (stored) {
+        index_[b][k] = position;
+      } else {
+        bins_[b].insert(bins_[b].begin() + k, r.element);
+        index_[b].insert(index_[b].begin() + k, position);
+      }
+    }
+    stats_.added++;
+  }
+}
+
+// Drops the dead positions; Ciphertexts moves the stored ciphertexts along with moved_
+void NodeStore::Compact() {
+  moved_.assign(values_.size(), kDead);
+  std::vector<uint64_t> values;
+  for (size_t p = 0; p < values_.size(); p++) {
+    if (!live_[p]) continue;
+    moved_[p] = static_cast<uint32_t>(values.size());
+    values.push_back(values_[p]);
+  }
+  for (auto &bin : index_)
+    for (auto &p : bin) p = moved_[p];
+  values_ = std::move(values);
+  live_.assign(values_.size(), true);
+  moved_from_ = generation_++;
+}
+
+void NodeStore::Write() const {
+  StoreHeader header;
+  std::memcpy(header.magic, kStoreMagic, sizeof(kStoreMagic));
+  header.version = kStoreVersion;
+  header.nfuns = nfuns_;
+  header.nbins = nbins_;
+  header.positions = values_.size();
+  header.applied = applied_;
+  header.generation = generation_;
+  std::vector<uint64_t> offsets(1, 0);
+  for (const auto &bin : bins_) offsets.push_back(offsets.back() + bin.size());
+  header.entries = offsets.back();
+
+  ReplaceFile(StorePath(dir_, node_, "store"), [&](std::FILE *file, const std::string &name) {
+    WriteExactly(file, &header, sizeof(header), name);
+    WriteExactly(file, values_.data(), values_.size() * sizeof(uint64_t), name);
+    WriteExactly(file, offsets.data(), offsets.size() * sizeof(uint64_t), name);
+    std::vector<Entry> entries;
+    for (size_t b = 0; b < bins_.size(); b++) {
+      entries.clear();
+      for (size_t k = 0; k < bins_[b].size(); k++) entries.push_back({bins_[b][k], index_[b][k]});
+      WriteExactly(file, entries.data(), entries.size() * sizeof(Entry), name);
+    }
+  });
+}
+
+// The records appended since the store was last written; a record still being appended waits
+std::vector<UpdateRecord> NodeStore::ReadLog() const {
+  std::vector<UpdateRecord> records;
+  const std::string path = StorePath(dir_, node_, "log");
+  std::FILE *file = std::fopen(path.c_str(), "rb");
+  if (!file) return records;
+  if (std::fseek(file, applied_ * sizeof(UpdateRecord), SEEK_SET) == 0) {
+    UpdateRecord record;
+    while (std::fread(&record, sizeof(record), 1, file) == 1) records.push_back(record);
+  }
+  std::fclose(file);
+  return records;
+}
+
+}  // namespace ENCRYPTO
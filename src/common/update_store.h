@@ -0,0 +1,143 @@
+#ifndef UPDATE_STORE_H__
+#define UPDATE_STORE_H__
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <NTL/ZZ.h>
+
+#include "dataset.h"
+
+/*
+ * Persistent server state of one PSM1/PSM2 node under --store-dir, kept up to date by an
+ * append/delete log instead of being rebuilt from the inputs for every query:
+ *   node_<i>.log     UpdateRecords, appended by dmsp2cq_update (or anything else)
+ *   node_<i>.store   StoreHeader, the value of every position, then the simple table: bin offsets
+ *                    and {element, position} entries sorted by element within a bin
+ *   node_<i>.cipher  CipherHeader, the client key's n, then one fixed-size ciphertext per position
+ *
+ * A position is the slot of one value and its ciphertext, what bin_index refers to. Positions
+ * are never reused: adding an element gets a new one (re-adding a stored element updates its
+ * value), deleting it only drops its table entries. Once more positions are dead than live the
+ * store compacts them, moving ciphertexts without encrypting them again.
+ *
+ * A query applies the log records it has not seen: it hashes the delta elements alone, as bins
+ * only depend on the element and the table shape, and encrypts only the new positions. The
+ * store file is replaced whole (written aside, then renamed) when it changed, which is a copy,
+ * not a hashing pass. The ciphertexts are of the client's Paillier key; another key encrypts
+ * them all again.
+ *
+ * The first query, or one that finds no valid store of its table shape, builds the store from
+ * the node's inputs and replays the whole log; the node's set is always its inputs plus the log.
+ */
+
+namespace ENCRYPTO {
+
+enum UpdateOp : uint64_t { UPDATE_ADD = 1, UPDATE_DELETE = 2 };
+
+struct UpdateRecord {
+  uint64_t op;  // UpdateOp
+  uint64_t element;
+  uint64_t value;  // of UPDATE_ADD
+};
+static_assert(sizeof(UpdateRecord) == 24, "UpdateRecord is part of the file format");
+
+inline std::string StorePath(const std::string &dir, uint64_t node, const char *file) {
+  return dir + "/node_" + std::to_string(node) + "." + file;
+}
+
+// Appends to the log of node; its next query applies them. Throws std::runtime_error.
+inline void AppendUpdates(const std::string &dir, uint64_t node, const std::vector<UpdateRecord> &records) {
+  const std::string path = StorePath(dir, node, "log");
+  std::FILE *file = std::fopen(path.c_str(), "ab");
+  if (!file) throw std::runtime_error("Cannot open update log " + path);
+  size_t written = std::fwrite(records.data(), sizeof(UpdateRecord), records.size(), file);
+  if (std::fclose(file) != 0 || written != records.size())
+    throw std::runtime_error("Cannot write update log " + path);
+}
+
+/*
+ * count records of churn against a node whose inputs are elements: every other one deletes an
+ * input element at random (which an earlier round may have deleted already), the others add a
+ * fresh random element of bitlen bits with a value in [1, 10000].
+ */
+inline std::vector<UpdateRecord> ChurnRecords(InputView elements, uint64_t count, uint64_t bitlen,
+                                              std::mt19937_64 &rng) {
+  const uint64_t mask = bitlen >= 64 ? ~0ull : (1ull << bitlen) - 1;
+  std::uniform_int_distribution<uint64_t> value(1, 10000);
+  std::vector<UpdateRecord> records;
+  for (uint64_t i = 0; i < count; i++) {
+    if (i % 2 == 0 && !elements.empty())
+      records.push_back({UPDATE_DELETE, elements[rng() % elements.size()], 0});
+    else
+      records.push_back({UPDATE_ADD, rng() & mask, value(rng)});
+  }
+  return records;
+}
+
+struct StoreStats {
+  uint64_t added = 0;      // log records that added an element or changed its value
+  uint64_t deleted = 0;    // log records that deleted a stored element
+  uint64_t live = 0;       // elements in the store
+  uint64_t encrypted = 0;  // positions Ciphertexts encrypted
+  bool rebuilt = false;    // built from the inputs
+  bool compacted = false;
+};
+
+// Encrypts values under the client's key
+using ValueEncryptor = std::function<std::vector<NTL::ZZ>(const std::vector<uint64_t> &)>;
+
+class NodeStore {
+ public:
+  // The table shape is that of buildSimpleTable: nbins bins, nfuns hash functions
+  NodeStore(const std::string &dir, uint64_t node, uint64_t nbins, uint32_t nfuns);
+
+  /*
+   * Brings the store up to date with its log, or builds it from elements and values (random
+   * values in [1, 10000] if there are none) when there is no store of this table shape.
+   * Throws std::runtime_error on I/O errors.
+   */
+  StoreStats Sync(InputView elements, InputView values);
+
+  // The table for the OPRF, and the position of every entry; once, after Sync
+  void TakeTable(std::vector<std::vector<uint64_t>> &bins, std::vector<std::vector<uint32_t>> &index);
+
+  // One ciphertext per position under key n, encrypting those not yet stored; after Sync
+  std::vector<NTL::ZZ> Ciphertexts(const NTL::ZZ &n, const ValueEncryptor &encrypt);
+
+  const StoreStats &Stats() const { return stats_; }
+
+  // Deletes the store of node, its log included
+  static void Remove(const std::string &dir, uint64_t node);
+
+ private:
+  bool Load();
+  void Build(InputView elements, InputView values);
+  void Apply(const std::vector<UpdateRecord> &records);
+  void Compact();
+  void Write() const;
+  std::vector<UpdateRecord> ReadLog() const;
+
+  std::string dir_;
+  uint64_t node_;
+  uint64_t nbins_;
+  uint32_t nfuns_;
+  uint64_t applied_ = 0;     // log records already in the store
+  uint64_t generation_ = 0;  // changes whenever positions move; ciphertexts of another one are stale
+  std::vector<std::vector<uint64_t>> bins_;
+  std::vector<std::vector<uint32_t>> index_;
+  std::vector<uint64_t> values_;
+  std::vector<bool> live_;
+  std::vector<uint32_t> moved_;  // new position of every one of generation moved_from_, UINT32_MAX if dead
+  uint64_t moved_from_ = 0;
+  StoreStats stats_;
+};
+
+}  // namespace ENCRYPTO
+
+#endif  // UPDATE_STORE_H__
@@ -1,7 +1,9 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <utility>
 #include <vector>
+#include "trace.h"
 
 template <class T = std::vector<uint64_t>>
 class globalData {
@@ -20,6 +22,17 @@ class globalData {
     m_Data[pos] = data;
   }
 
+  void add(T &&data, size_t pos) {
+    std::lock_guard<std::mutex> lock(m);
+    if (pos >= m_Data.size()) {
+      m_Data.resize(pos + 1);
+    }
+    m_Data[pos] = std::move(data);
+  }
+
+  // Unlocked access for phases in which a barrier keeps the other nodes off this entry
+  T &at(size_t pos) { return m_Data.at(pos); }
+
   T getByPos(size_t pos) {
     if (pos >= m_Data.size()) throw std::out_of_range("globalData out of range.");
     std::lock_guard<std::mutex> lock(m);
@@ -36,6 +49,13 @@ class globalData {
   }
 
   std::vector<T> data() { return m_Data; }
+  // Hands the entries to the caller, which is then their last reader
+  std::vector<T> take() {
+    std::lock_guard<std::mutex> lock(m);
+    std::vector<T> out = std::move(m_Data);
+    m_Data.resize(out.size());
+    return out;
+  }
   size_t size() { return m_Data.size(); }
   void set(const std::vector<T>& vec) { m_Data=vec; }
 };
@@ -80,27 +100,26 @@ inline void waitFor(globalFlag& listenFlag,std::function<void(void)> funcOfSpeci
 {
   bool isSpec=condition?true:false;
   
-  while(1)
+  // the "wait" span ends before funcOfSpecial, the barrier's work
   {
-    bool shouldQuit=false;
-    shouldQuit=listenFlag.get()==0&&!isSpec||listenFlag.get()==n&&isSpec?true:false;
-
-    if(shouldQuit)
+    ENCRYPTO::TraceSpan span("wait");
+    while(1)
     {
-      if(!isSpec)
+      bool shouldQuit=false;
+      shouldQuit=listenFlag.get()==0&&!isSpec||listenFlag.get()==n&&isSpec?true:false;
+
+      if(shouldQuit)
         break;
       else
-      {
-        funcOfSpecial();
-        listenFlag.reset(0);
-        break;
-      }
-    }
-    else
-    {
-      usleep(10);
+        usleep(10);
     }
   }
+
+  if(isSpec)
+  {
+    funcOfSpecial();
+    listenFlag.reset(0);
+  }
 }
 inline void waitFor2(globalFlag& listenFlag,std::function<void(void)> funcOf1,std::function<void(void)> funcOf2,size_t whoIsEnd,std::function<void(void)> funcOfBegin,std::function<void(void)> funcOfEnd)
 {
@@ -108,16 +127,20 @@ inline void waitFor2(globalFlag& listenFlag,std::function<void(void)> funcOf1,st
 
   size_t i=listenFlag++;
 
-  while(i>=2)
+  // only the polling is traced as "wait", not the callbacks
   {
-    if(listenFlag.get()<2)
+    ENCRYPTO::TraceSpan span("wait");
+    while(i>=2)
     {
-      i=listenFlag++;
-      if(i<2)
-        break;
+      if(listenFlag.get()<2)
+      {
+        i=listenFlag++;
+        if(i<2)
+          break;
+      }
+      else
+        usleep(10);
     }
-    else
-      usleep(10);
   }
 
   // first thread
@@ -137,12 +160,15 @@ inline void waitFor2(globalFlag& listenFlag,std::function<void(void)> funcOf1,st
 
   if(i==whoIsEnd)
   {
-    while(1)
     {
-      if(flagOfWait2.get()==1)
-        break;
-      else
-        usleep(10);
+      ENCRYPTO::TraceSpan span("wait");
+      while(1)
+      {
+        if(flagOfWait2.get()==1)
+          break;
+        else
+          usleep(10);
+      }
     }
 
     funcOfEnd();
@@ -0,0 +1,77 @@
+#include <iostream>
+#include <random>
+
+#include <boost/program_options.hpp>
+
+#include "common/dataset.h"
+
+/*
+ * Writes a dataset for gcf_p2cq --dataset: one partition per node, generated record by record so
+ * even datasets larger than memory never have to fit in it.
+ *   sequence  element i of a node is step * i, as the built-in server inputs
+ *   constant  every element is --value, as the built-in client inputs
+ *   random    uniform elements of --bit-length bits
+ * With --record-size 16 every record also gets a random value in [1, 10000] for PSM2.
+ */
+
+int main(int argc, char **argv) {
+  namespace po = boost::program_options;
+  std::string out, pattern;
+  uint64_t nodes, records, step, value, bitlen, seed;
+  uint32_t record_size;
+  po::options_description allowed("Allowed options");
+  // clang-format off
+  allowed.add_options()("help,h", "produce this message")
+  ("out,o",         po::value<std::string>(&out)->required(),                  "Dataset file to write")
+  ("nodes,n",       po::value<uint64_t>(&nodes)->default_value(10u),           "Partitions, one per node")
+  ("records,r",     po::value<uint64_t>(&records)->default_value(4096u),       "Records per partition")
+  ("record-size",   po::value<uint32_t>(&record_size)->default_value(8u),      "Bytes per record: 8 (element) or 16 (element, value)")
+  ("pattern,p",     po::value<std::string>(&pattern)->default_value("sequence"), "Elements {sequence, constant, random}")
+  ("step",          po::value<uint64_t>(&step)->default_value(2000u),          "Distance of consecutive elements of the sequence pattern")
+  ("value",         po::value<uint64_t>(&value)->default_value(8000u),         "Element of the constant pattern")
+  ("bit-length,b",  po::value<uint64_t>(&bitlen)->default_value(58u),          "Bit-length of the random pattern")
+  ("seed",          po::value<uint64_t>(&seed)->default_value(1u),             "Seed of the random elements and values");
+  // clang-format on
+
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, allowed), vm);
+    if (vm.count("help")) {
+      std::cout << allowed << "\n";
+      return EXIT_SUCCESS;
+    }
+    po::notify(vm);
+  } catch (const po::error &e) {
+    std::cout << e.what() << std::endl;
+    std::cout << allowed << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (pattern != "sequence" && pattern != "constant" && pattern != "random") {
+    std::cerr << "Unknown pattern: " << pattern << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (bitlen == 0 || bitlen > 64) {
+    std::cerr << "Bit-length must be in [1, 64]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::mt19937_64 prng(seed);
+  const uint64_t mask = bitlen == 64 ? ~0ull : (1ull << bitlen) - 1;
+  std::uniform_int_distribution<uint64_t> values(1, 10000);
+  try {
+    ENCRYPTO::DatasetWriter writer(out, record_size, nodes);
+    for (uint64_t p = 0; p < nodes; p++) {
+      writer.BeginPartition();
+      for (uint64_t i = 0; i < records; i++) {
+        uint64_t element = pattern == "sequence" ? step * i : pattern == "constant" ? value : prng() & mask;
+        writer.Add(element, record_size == 16 ? values(prng) : 0);
+      }
+    }
+    writer.Close();
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << "Wrote " << nodes << " x " << records << " records of " << record_size << " bytes to " << out << "\n";
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,486 @@
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "common/bench_stats.h"
+#include "common/config.h"
+#include "common/functionalities.h"
+#include "common/memory_budget.h"
+#include "common/net_emulator.h"
+#include "common/party.h"
+#include "common/silent_ot.h"
+#include "common/update_store.h"
+
+/*
+ * Benchmark driver: runs server and client over loopback for every combination of the swept
+ * parameters and reports mean, p50, p95 and standard deviation of every phase timing and byte
+ * counter. Options after "--" are gcf_p2cq options and fix everything that is not swept.
+ *
+ * Every repetition forks one process per party, so the process-wide state of the nodes starts
+ * fresh and a crashed or hung run is reported as failed instead of ending the sweep. The parties
+ * send their metrics to the driver as "name value" lines over a pipe.
+ *
+ * With a --store-dir among the party options, every configuration starts from an empty store, so
+ * its first run (a warmup) builds it, and --store-churn appends a churn round to every server
+ * node's log before each later run: those runs measure a query after the change.
+ */
+
+using Metrics = std::map<std::string, double>;
+
+struct BenchConfig {
+  std::string psm;
+  uint64_t n, sneles, cneles, bitlen, radix;
+  std::string net;
+  std::string ot;
+};
+
+struct PartyRun {
+  pid_t pid;
+  int fd;
+  std::string output;
+  bool done;
+};
+
+template <typename T>
+static std::vector<T> parseList(const std::string &list) {
+  std::vector<T> values;
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (item.empty()) continue;
+    std::stringstream is(item);
+    T value;
+    if (!(is >> value)) throw std::invalid_argument("Bad list entry: " + item);
+    values.push_back(value);
+  }
+  return values;
+}
+
+static void setPsmType(ENCRYPTO::PsiAnalyticsContext &context, const std::string &type) {
+  if (type == "PSM1") {
+    context.psm_type = ENCRYPTO::PsiAnalyticsContext::PSM1;
+  } else if (type == "PSM2") {
+    context.psm_type = ENCRYPTO::PsiAnalyticsContext::PSM2;
+  } else if (type == "PSM3") {
+    context.psm_type = ENCRYPTO::PsiAnalyticsContext::PSM3;
+  } else {
+    throw std::invalid_argument("Unknown PSM type: " + type);
+  }
+}
+
+static const char *psmName(const ENCRYPTO::PsiAnalyticsContext &context) {
+  static const char *names[] = {"PSM1", "PSM2", "PSM3"};
+  return names[context.psm_type];
+}
+
+static void setOtBackend(ENCRYPTO::PsiAnalyticsContext &context, const std::string &backend) {
+  if (backend == "iknp") {
+    context.ot_backend = ENCRYPTO::PsiAnalyticsContext::OT_IKNP;
+  } else if (backend == "silent") {
+    if (!ENCRYPTO::SILENT_OT_AVAILABLE)
+      throw std::invalid_argument("--ot-backend silent needs libOTe built with ENABLE_SILENTOT");
+    context.ot_backend = ENCRYPTO::PsiAnalyticsContext::OT_SILENT;
+  } else {
+    throw std::invalid_argument("Unknown OT backend: " + backend);
+  }
+}
+
+static const char *otBackendName(const ENCRYPTO::PsiAnalyticsContext &context) {
+  static const char *names[] = {"iknp", "silent"};
+  return names[context.ot_backend];
+}
+
+// The timings PrintTimings shows, every non-empty counter of the party's CommReport and the
+// memory peaks of its stages
+static void collectMetrics(const std::vector<ENCRYPTO::PsiAnalyticsContext> &contexts, std::ostream &out) {
+  const auto avg = ENCRYPTO::AverageContexts(contexts);
+  const bool server = avg.role == SERVER;
+  const std::string role = server ? "server." : "client.";
+  auto put = [&](const std::string &name, double value) { out << role << name << " " << value << "\n"; };
+
+  if (server) put("time.vrf", avg.timings.vrf);
+  if (avg.psm_type != ENCRYPTO::PsiAnalyticsContext::PSM3) {
+    put("time.oprf1", avg.timings.oprf1);
+    put("time.oprf2", avg.timings.oprf2);
+    put("time.total_wo_ot", avg.timings.totalWithoutOT);
+  } else {
+    put("time.base_ots_sci", avg.timings.base_ots_sci);
+    if (avg.psm3_opprf) put("time.hint_transmission", avg.timings.hint_transmission);
+  }
+  if (avg.psm_type == ENCRYPTO::PsiAnalyticsContext::PSM2)
+    put(server ? "time.encrypt" : "time.decrypt", server ? avg.timings.encrypt : avg.timings.decrypt);
+  if (server && !avg.store_dir.empty() && avg.psm_type != ENCRYPTO::PsiAnalyticsContext::PSM3)
+    put("time.update", avg.timings.update);
+  if (server && avg.oprf_mode == ENCRYPTO::PsiAnalyticsContext::OPRF_DH) put("time.oprf_encode", avg.timings.oprf_encode);
+  put("time.hint_computation", avg.timings.hint_computation);
+  put("time.psm", avg.timings.psm);
+  put("time.total", avg.timings.total);
+
+  ENCRYPTO::CommReport report;
+  for (const auto &c : contexts) report += c.comm;
+  for (int p = 0; p < ENCRYPTO::COMM_PHASES; p++) {
+    for (int l = 0; l < ENCRYPTO::COMM_LINKS; l++) {
+      const auto &c = report.counters[p][l];
+      if (c.Empty()) continue;
+      std::string key = std::string(ENCRYPTO::COMM_PHASE_NAMES[p]) + "." + ENCRYPTO::COMM_LINK_NAMES[l];
+      put("bytes." + key + ".sent", c.sent);
+      put("bytes." + key + ".recv", c.recv);
+      if (ENCRYPTO::COMM_LINK_MESSAGES[l]) put("msgs." + key + ".sent", c.sent_msgs);
+      if (ENCRYPTO::COMM_LINK_ROUNDS[l]) put("rounds." + key, c.rounds);
+    }
+  }
+  ENCRYPTO::CommCounter total = report.Total();
+  put("bytes.total.sent", total.sent);
+  put("bytes.total.recv", total.recv);
+
+  const auto &budget = ENCRYPTO::MemoryBudget::Instance();
+  for (int s = 0; s < ENCRYPTO::MEM_STAGES; s++) {
+    auto r = budget.Report((ENCRYPTO::MemStage)s);
+    if (r.peak == 0 && !r.external) continue;
+    put(std::string("mem.") + ENCRYPTO::MEM_STAGE_NAMES[s] + ".peak", r.peak);
+    put(std::string("mem.") + ENCRYPTO::MEM_STAGE_NAMES[s] + ".external", r.external);
+  }
+  put("mem.peak", budget.Peak());
+}
+
+static PartyRun startParty(const ENCRYPTO::PsiAnalyticsContext &context, bool verbose) {
+  int fds[2];
+  if (pipe(fds) != 0) throw std::runtime_error("pipe failed");
+  // the child must not write out what is still buffered here, or it is written twice
+  std::cout.flush();
+  std::fflush(nullptr);
+  pid_t pid = fork();
+  if (pid < 0) throw std::runtime_error("fork failed");
+  if (pid == 0) {
+    close(fds[0]);
+    if (!verbose) {
+      FILE *null = freopen("/dev/null", "w", stdout);
+      (void)null;
+    }
+    std::ostringstream out;
+    out << std::setprecision(17);
+    collectMetrics(ENCRYPTO::RunParty(context), out);
+    const std::string text = out.str();
+    // _exit skips the stdio flush, and the party's output is buffered once stdout is a pipe or file
+    std::cout.flush();
+    std::fflush(nullptr);
+    size_t written = 0;
+    while (written < text.size()) {
+      ssize_t w = write(fds[1], text.data() + written, text.size() - written);
+      if (w <= 0) _exit(EXIT_FAILURE);
+      written += w;
+    }
+    _exit(EXIT_SUCCESS);
+  }
+  close(fds[1]);
+  return {pid, fds[0], "", false};
+}
+
+// Waits for both parties; false if one of them failed or the run timed out
+static bool finishParties(std::vector<PartyRun> &parties, double timeout_s, Metrics &metrics) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeout_s);
+  bool ok = true;
+  char buffer[4096];
+  while (std::any_of(parties.begin(), parties.end(), [](const PartyRun &p) { return !p.done; })) {
+    double left = std::chrono::duration<double, std::milli>(deadline - std::chrono::steady_clock::now()).count();
+    if (left <= 0) {
+      std::cerr << "Run timed out after " << timeout_s << " s\n";
+      ok = false;
+      break;
+    }
+    std::vector<pollfd> fds;
+    for (auto &p : parties)
+      if (!p.done) fds.push_back({p.fd, POLLIN, 0});
+    if (poll(fds.data(), fds.size(), (int)std::min(left, 1000.0)) < 0) continue;
+    for (auto &p : parties) {
+      if (p.done) continue;
+      for (const auto &f : fds) {
+        if (f.fd != p.fd || !(f.revents & (POLLIN | POLLHUP | POLLERR))) continue;
+        ssize_t r = read(p.fd, buffer, sizeof(buffer));
+        if (r > 0)
+          p.output.append(buffer, r);
+        else
+          p.done = true;
+      }
+    }
+  }
+
+  for (auto &p : parties) {
+    if (!p.done) kill(p.pid, SIGKILL);
+    close(p.fd);
+    int status = 0;
+    waitpid(p.pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+      if (p.done) std::cerr << "Party process " << p.pid << " failed\n";
+      ok = false;
+    }
+    std::istringstream in(p.output);
+    std::string name;
+    double value;
+    while (in >> name >> value) metrics[name] = value;
+  }
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  namespace po = boost::program_options;
+  std::string n_list, sneles_list, cneles_list, psm_list, bitlen_list, radix_list, net_list, ot_list, csv_path, json_path, label;
+  std::string server_dataset, client_dataset;
+  uint32_t warmup, reps;
+  double timeout_s, store_churn;
+  bool verbose = false;
+  po::options_description allowed("Allowed options (gcf_p2cq options follow after --)");
+  // clang-format off
+  allowed.add_options()("help,h", "produce this message")
+  ("n",           po::value<std::string>(&n_list)->default_value(""),          "Comma-separated node counts (default: the -n of the base options)")
+  ("sneles",      po::value<std::string>(&sneles_list)->default_value(""),     "Comma-separated server set sizes")
+  ("cneles",      po::value<std::string>(&cneles_list)->default_value(""),     "Comma-separated client set sizes")
+  ("psm-type",    po::value<std::string>(&psm_list)->default_value(""),        "Comma-separated PSM types {PSM1, PSM2, PSM3}")
+  ("bit-length",  po::value<std::string>(&bitlen_list)->default_value(""),     "Comma-separated element bit-lengths")
+  ("radix",       po::value<std::string>(&radix_list)->default_value(""),      "Comma-separated PSM3 radices")
+  ("net-profile", po::value<std::string>(&net_list)->default_value(""),        "Comma-separated emulated links {none, lan, wan, <latency_ms>:<mbps>[:<jitter_ms>]}")
+  ("ot-backend",  po::value<std::string>(&ot_list)->default_value(""),         "Comma-separated OT backends of the PSM3 leaf OTs and AND triples {iknp, silent}")
+  ("server-dataset", po::value<std::string>(&server_dataset)->default_value(""), "Dataset of the server (dataset_gen), instead of the built-in inputs")
+  ("client-dataset", po::value<std::string>(&client_dataset)->default_value(""), "Dataset of the client (dataset_gen), instead of the built-in inputs")
+  ("store-churn", po::value<double>(&store_churn)->default_value(0.0),        "Fraction of each server node's set changed in its --store-dir log before every run but the first, e.g. 0.01")
+  ("warmup",      po::value<uint32_t>(&warmup)->default_value(1u),             "Unrecorded runs per configuration")
+  ("reps",        po::value<uint32_t>(&reps)->default_value(5u),               "Recorded runs per configuration")
+  ("timeout",     po::value<double>(&timeout_s)->default_value(600.0),         "Seconds before a run is killed and counted as failed")
+  ("csv",         po::value<std::string>(&csv_path)->default_value(""),        "Write the summary as CSV to this file")
+  ("json",        po::value<std::string>(&json_path)->default_value(""),       "Write the summary as JSON to this file")
+  ("label",       po::value<std::string>(&label)->default_value(""),           "Tag of this benchmark, e.g. the commit, in every CSV row and the JSON")
+  ("verbose,v",   po::bool_switch(&verbose),                                   "Keep the output of the parties");
+  // clang-format on
+
+  // everything after "--" goes to the party option parser
+  int split = argc;
+  for (int i = 1; i < argc; i++)
+    if (std::strcmp(argv[i], "--") == 0) {
+      split = i;
+      break;
+    }
+  po::variables_map vm;
+  try {
+    po::store(po::command_line_parser(split, argv).options(allowed).run(), vm);
+    if (vm.count("help")) {
+      std::cout << allowed << "\n";
+      return EXIT_SUCCESS;
+    }
+    po::notify(vm);
+  } catch (const po::error &e) {
+    std::cout << e.what() << std::endl;
+    std::cout << allowed << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (reps == 0) reps = 1;
+  if (store_churn < 0 || store_churn > 1) {
+    std::cerr << "--store-churn must be in [0, 1]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::vector<std::string> party_args = {argv[0], "--role", "0"};
+  for (int i = split + 1; i < argc; i++) party_args.push_back(argv[i]);
+  std::vector<char *> party_argv;
+  for (auto &a : party_args) party_argv.push_back(&a[0]);
+  const ENCRYPTO::PsiAnalyticsContext base = ENCRYPTO::ParsePartyOptions(party_argv.size(), party_argv.data());
+  if (store_churn > 0 && base.store_dir.empty()) {
+    std::cerr << "--store-churn needs a --store-dir party option" << std::endl;
+    return EXIT_FAILURE;
+  }
+  // churn deletes elements of the server's inputs
+  std::unique_ptr<ENCRYPTO::Dataset> server_data;
+  const std::string &server_inputs_path = server_dataset.empty() ? base.dataset : server_dataset;
+  if (store_churn > 0 && !server_inputs_path.empty()) {
+    try {
+      server_data.reset(new ENCRYPTO::Dataset(server_inputs_path));
+    } catch (const std::runtime_error &e) {
+      std::cerr << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::vector<BenchConfig> configs;
+  {
+    auto ns = n_list.empty() ? std::vector<uint64_t>{base.n} : parseList<uint64_t>(n_list);
+    auto ss = sneles_list.empty() ? std::vector<uint64_t>{base.sneles} : parseList<uint64_t>(sneles_list);
+    auto cs = cneles_list.empty() ? std::vector<uint64_t>{base.cneles} : parseList<uint64_t>(cneles_list);
+    auto ps = psm_list.empty() ? std::vector<std::string>{psmName(base)} : parseList<std::string>(psm_list);
+    auto bs = bitlen_list.empty() ? std::vector<uint64_t>{base.bitlen} : parseList<uint64_t>(bitlen_list);
+    auto rs = radix_list.empty() ? std::vector<uint64_t>{base.radix} : parseList<uint64_t>(radix_list);
+    auto ls = net_list.empty() ? std::vector<std::string>{base.net_profile} : parseList<std::string>(net_list);
+    auto os = ot_list.empty() ? std::vector<std::string>{otBackendName(base)} : parseList<std::string>(ot_list);
+    for (auto &l : ls) ENCRYPTO::ParseNetProfile(l);
+    ENCRYPTO::PsiAnalyticsContext check = base;
+    for (auto &o : os) setOtBackend(check, o);
+    for (auto &l : ls)
+      for (auto &o : os)
+        for (auto &p : ps)
+          for (auto n : ns)
+            for (auto s : ss)
+              for (auto c : cs)
+                for (auto b : bs)
+                  for (auto r : rs) configs.push_back({p, n, s, c, b, r, l, o});
+  }
+
+  std::ofstream csv, json;
+  if (!csv_path.empty()) {
+    csv.open(csv_path);
+    if (!csv.is_open()) {
+      std::cerr << "Failed to open file: " << csv_path << std::endl;
+      return EXIT_FAILURE;
+    }
+    csv << "label,net,ot_backend,psm,n,sneles,cneles,bitlen,radix,reps,failed,metric,mean,p50,p95,stddev,min,max\n";
+  }
+  if (!json_path.empty()) {
+    json.open(json_path);
+    if (!json.is_open()) {
+      std::cerr << "Failed to open file: " << json_path << std::endl;
+      return EXIT_FAILURE;
+    }
+    json << "{\"label\":" << ENCRYPTO::JsonString(label) << ",\"configs\":[";
+  }
+
+  uint64_t run_index = 0, total_failed = 0;
+  for (size_t ci = 0; ci < configs.size(); ci++) {
+    const BenchConfig &cfg = configs[ci];
+    ENCRYPTO::PsiAnalyticsContext context = base;
+    setPsmType(context, cfg.psm);
+    context.n = cfg.n;
+    context.sneles = cfg.sneles;
+    context.cneles = cfg.cneles;
+    context.bitlen = cfg.bitlen;
+    context.radix = cfg.radix;
+    context.net_profile = cfg.net;
+    setOtBackend(context, cfg.ot);
+    ENCRYPTO::DeriveTableSizes(context);
+
+    // consecutive runs use different port blocks, so no run waits for the sockets of the last;
+    // an emulated link takes a second span for the client's relay
+    uint32_t span = ENCRYPTO::PartyPortSpan(context);
+    if (ENCRYPTO::ParseNetProfile(cfg.net).Enabled()) span *= 2;
+    if (base.port + 8ull * span > 65535) {
+      std::cerr << "Port range of n = " << cfg.n << " does not fit above port " << base.port << "\n";
+      return EXIT_FAILURE;
+    }
+
+    std::vector<uint64_t> server_inputs;
+    if (!base.store_dir.empty()) {
+      for (uint64_t i = 0; i < cfg.n; i++) ENCRYPTO::NodeStore::Remove(base.store_dir, i);
+      if (store_churn > 0 && !server_data) {
+        ENCRYPTO::PsiAnalyticsContext server = context;
+        server.role = SERVER;
+        server_inputs = ENCRYPTO::DefaultInputs(server);
+      }
+    }
+    std::mt19937_64 churn_rng(ci + 1);
+
+    std::vector<Metrics> samples;
+    uint32_t failed = 0;
+    for (uint32_t rep = 0; rep < warmup + reps; rep++) {
+      if (store_churn > 0 && rep > 0) {
+        for (uint64_t i = 0; i < cfg.n; i++) {
+          ENCRYPTO::InputView elements = server_inputs;
+          if (server_data) {
+            uint64_t parts = server_data->Partitions();
+            elements = parts == 1 ? server_data->Elements(0) : i < parts ? server_data->Elements(i) : ENCRYPTO::InputView();
+          }
+          elements = elements.first(cfg.sneles);
+          ENCRYPTO::AppendUpdates(base.store_dir, i,
+                                  ENCRYPTO::ChurnRecords(elements, (uint64_t)std::ceil(store_churn * elements.size()),
+                                                         cfg.bitlen, churn_rng));
+        }
+      }
+      ENCRYPTO::PsiAnalyticsContext server = context, client = context;
+      server.port = client.port = base.port + (run_index++ % 8) * span;
+      server.role = SERVER;
+      client.role = CLIENT;
+      client.address = "127.0.0.1";
+      if (!server_dataset.empty()) server.dataset = server_dataset;
+      if (!client_dataset.empty()) client.dataset = client_dataset;
+
+      auto start = std::chrono::steady_clock::now();
+      std::vector<PartyRun> parties;
+      parties.push_back(startParty(server, verbose));
+      parties.push_back(startParty(client, verbose));
+      Metrics metrics;
+      bool ok = finishParties(parties, timeout_s, metrics);
+      metrics["wall"] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      if (!ok) {
+        failed++;
+        continue;
+      }
+      if (rep >= warmup) samples.push_back(metrics);
+    }
+    total_failed += failed;
+
+    std::map<std::string, ENCRYPTO::BenchSummary> summary;
+    std::vector<std::string> names;
+    for (const auto &s : samples)
+      for (const auto &m : s)
+        if (std::find(names.begin(), names.end(), m.first) == names.end()) names.push_back(m.first);
+    std::sort(names.begin(), names.end());
+    for (const auto &name : names) {
+      std::vector<double> values;
+      for (const auto &s : samples) {
+        auto it = s.find(name);
+        values.push_back(it == s.end() ? 0 : it->second);
+      }
+      summary[name] = ENCRYPTO::Summarize(values);
+    }
+
+    std::cout << (cfg.net.empty() ? "" : cfg.net + " ") << cfg.ot << " " << cfg.psm << " n=" << cfg.n << " sneles=" << cfg.sneles << " cneles=" << cfg.cneles
+              << " bitlen=" << cfg.bitlen << " radix=" << cfg.radix << ": " << samples.size() << " runs, "
+              << failed << " failed\n";
+    for (const auto &name : names) {
+      if (name != "wall" && name.find(".time.") == std::string::npos && name.find("bytes.total") == std::string::npos)
+        continue;
+      const ENCRYPTO::BenchSummary &s = summary[name];
+      std::cout << "  " << std::left << std::setw(36) << name << std::right << " mean " << s.mean << ", p50 "
+                << s.p50 << ", p95 " << s.p95 << ", sd " << s.stddev << "\n";
+    }
+
+    for (const auto &name : names) {
+      const ENCRYPTO::BenchSummary &s = summary[name];
+      if (csv.is_open())
+        csv << label << "," << cfg.net << "," << cfg.ot << "," << cfg.psm << "," << cfg.n << "," << cfg.sneles << "," << cfg.cneles << ","
+            << cfg.bitlen << "," << cfg.radix << "," << samples.size() << "," << failed << "," << name << ","
+            << s.mean << "," << s.p50 << "," << s.p95 << "," << s.stddev << "," << s.min << "," << s.max << "\n";
+    }
+    if (json.is_open()) {
+      json << (ci ? "," : "") << "\n{\"net\":" << ENCRYPTO::JsonString(cfg.net)
+           << ",\"ot_backend\":" << ENCRYPTO::JsonString(cfg.ot)
+           << ",\"psm\":" << ENCRYPTO::JsonString(cfg.psm) << ",\"n\":" << cfg.n << ",\"sneles\":" << cfg.sneles
+           << ",\"cneles\":" << cfg.cneles << ",\"bitlen\":" << cfg.bitlen
+           << ",\"radix\":" << cfg.radix << ",\"reps\":" << samples.size() << ",\"failed\":" << failed
+           << ",\"metrics\":{";
+      for (size_t i = 0; i < names.size(); i++) {
+        const ENCRYPTO::BenchSummary &s = summary[names[i]];
+        json << (i ? "," : "") << ENCRYPTO::JsonString(names[i]) << ":{\"mean\":" << s.mean
+             << ",\"p50\":" << s.p50 << ",\"p95\":" << s.p95 << ",\"stddev\":" << s.stddev
+             << ",\"min\":" << s.min << ",\"max\":" << s.max << "}";
+      }
+      json << "}}";
+    }
+  }
+  if (json.is_open()) json << "\n]}\n";
+
+  return total_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,610 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/program_options.hpp>
+#include <NTL/ZZ.h>
+
+#include "common/batch_equality.h"
+#include "common/bench_stats.h"
+#include "common/block.hpp"
+#include "common/constants.h"
+#include "common/match.h"
+#include "common/otpack_plan.h"
+#include "common/update_store.h"
+#include "common/KA.hpp"
+#include "common/Paillier.hpp"
+#include "common/VRF.hpp"
+#include "cryptoTools/Network/Channel.h"
+#include "cryptoTools/Network/IOService.h"
+#include "cryptoTools/Network/Session.h"
+#include "libOTe/NChooseOne/Kkrt/KkrtNcoOtReceiver.h"
+#include "libOTe/NChooseOne/Kkrt/KkrtNcoOtSender.h"
+
+/*
+ * Microbenchmarks of the kernels below the protocol level: Paillier, KKRT encoding, the
+ * BatchEquality phases over an in-process loopback pair, the leader's match loop, the OPRF
+ * output conversions, the DH key agreement, the VRF ordering and the server store update.
+ *
+ * A kernel call reports the seconds of each of its phases (or is timed as a whole, "call").
+ * Every repetition calls the kernel until --min-time has passed and records the mean per call;
+ * the repetitions are summarized like dmsp2cq_bench does, in ns per call plus the item rate.
+ */
+
+using Clock = std::chrono::steady_clock;
+using Phases = std::map<std::string, double>;  // seconds per phase of one call
+
+struct Kernel {
+  std::string name;    // group/kernel
+  std::string params;  // k=v,... of the parameters it was built with
+  uint64_t items;      // elements one call processes
+  std::function<Phases()> call;  // empty result: the call is timed as a whole
+};
+
+struct BenchParams {
+  std::vector<uint64_t> sizes;
+  uint64_t nodes, bitlen, radix, bin_load;
+  uint16_t port;
+  double churn;
+  std::string store_dir;
+};
+
+// Keeps a result the call would otherwise be free to drop
+template <typename T>
+static void Keep(const T &value) {
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+static double Since(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Kernels are only built, with their keys and connections, when --filter selects them
+class Registry {
+ public:
+  explicit Registry(std::vector<std::string> filters) : filters_(std::move(filters)) {}
+
+  // One of name and a filter is a prefix of the other, so "kkrt" selects "kkrt/..." and back
+  bool Wants(const std::string &name) const {
+    if (filters_.empty()) return true;
+    for (const auto &f : filters_)
+      if (name.compare(0, f.size(), f) == 0 || f.compare(0, name.size(), name) == 0) return true;
+    return false;
+  }
+
+  void Add(Kernel kernel) {
+    if (Wants(kernel.name)) kernels_.push_back(std::move(kernel));
+  }
+
+  std::vector<Kernel> &Kernels() { return kernels_; }
+
+ private:
+  std::vector<std::string> filters_;
+  std::vector<Kernel> kernels_;
+};
+
+static void AddPaillier(Registry &reg) {
+  if (!reg.Wants("paillier/")) return;
+  struct State {
+    Paillier::Paillier key;
+    NTL::ZZ n, g, n2, lambda, lambda_inverse, m, c1, c2;
+  };
+  auto s = std::make_shared<State>();
+  s->n = s->key.getN();
+  s->g = s->key.getG();
+  s->n2 = s->n * s->n;
+  s->lambda = s->key.getLambda();
+  s->lambda_inverse = s->key.getLambdaInverse();
+  s->m = NTL::ZZ(8000);
+  s->c1 = Paillier::encryptNumber(s->m, s->n, s->g);
+  s->c2 = Paillier::encryptNumber(NTL::ZZ(1), s->n, s->g);
+  std::string params = "nbits=" + std::to_string(NTL::NumBits(s->n));
+
+  reg.Add({"paillier/encrypt", params, 1, [s] {
+             NTL::ZZ c = Paillier::encryptNumber(s->m, s->n, s->g);
+             Keep(c);
+             return Phases();
+           }});
+  reg.Add({"paillier/decrypt", params, 1, [s] {
+             NTL::ZZ m = Paillier::decryptNumber(s->c1, s->n, s->lambda, s->lambda_inverse);
+             Keep(m);
+             return Phases();
+           }});
+  reg.Add({"paillier/multiply", params, 1, [s] {
+             NTL::ZZ c = (s->c1 * s->c2) % s->n2;
+             Keep(c);
+             return Phases();
+           }});
+}
+
+/*
+ * KKRT over an in-process session pair. The base OTs are dealt locally and init runs outside
+ * the timed phases, so the phases are the receiver's encodes, the correction transfer and the
+ * sender's encodes of one value per OT.
+ */
+static void AddKkrt(Registry &reg, const BenchParams &bp) {
+  if (!reg.Wants("kkrt/")) return;
+  struct State {
+    osuCrypto::IOService ios;
+    std::unique_ptr<osuCrypto::Session> server, client;
+    osuCrypto::Channel send_chl, recv_chl;
+
+    ~State() {
+      send_chl.close();
+      recv_chl.close();
+      server->stop();
+      client->stop();
+      ios.stop();
+    }
+  };
+  auto s = std::make_shared<State>();
+  s->server.reset(new osuCrypto::Session(s->ios, "127.0.0.1", bp.port + 2, osuCrypto::SessionMode::Server, "kkrt"));
+  s->client.reset(new osuCrypto::Session(s->ios, "127.0.0.1", bp.port + 2, osuCrypto::SessionMode::Client, "kkrt"));
+  s->send_chl = s->server->addChannel("kkrt", "kkrt");
+  s->recv_chl = s->client->addChannel("kkrt", "kkrt");
+
+  for (uint64_t size : bp.sizes) {
+    auto inputs = std::make_shared<std::vector<osuCrypto::block>>(size);
+    for (uint64_t i = 0; i < size; i++) (*inputs)[i] = osuCrypto::toBlock(2000 * i);
+
+    reg.Add({"kkrt/encode", "ots=" + std::to_string(size), size, [s, inputs, size] {
+               osuCrypto::PRNG prng(_mm_set_epi32(4253465, 3434565, 234435, 23987025));
+               osuCrypto::KkrtNcoOtSender sender;
+               osuCrypto::KkrtNcoOtReceiver recv;
+               sender.configure(false, 40, 128);
+               recv.configure(false, 40, ENCRYPTO::symsecbits);
+
+               osuCrypto::u64 base_count = sender.getBaseOTCount();
+               std::vector<std::array<osuCrypto::block, 2>> base_send(base_count);
+               std::vector<osuCrypto::block> base_recv(base_count);
+               osuCrypto::BitVector choices(base_count);
+               choices.randomize(prng);
+               for (osuCrypto::u64 i = 0; i < base_count; i++) {
+                 base_send[i] = {prng.get<osuCrypto::block>(), prng.get<osuCrypto::block>()};
+                 base_recv[i] = base_send[i][choices[i]];
+               }
+               sender.setBaseOts(base_recv, choices);
+               recv.setBaseOts(base_send);
+
+               osuCrypto::PRNG send_prng(osuCrypto::toBlock(1)), recv_prng(osuCrypto::toBlock(2));
+               std::thread init([&] { sender.init(size, send_prng, s->send_chl); });
+               recv.init(size, recv_prng, s->recv_chl);
+               init.join();
+
+               Phases p;
+               std::vector<osuCrypto::block> encodings(size), outputs(size);
+               auto start = Clock::now();
+               for (uint64_t k = 0; k < size; k++)
+                 recv.encode(k, &(*inputs)[k], reinterpret_cast<uint8_t *>(&encodings[k]), sizeof(osuCrypto::block));
+               p["recv_encode"] = Since(start);
+
+               start = Clock::now();
+               std::thread correction([&] { recv.sendCorrection(s->recv_chl, size); });
+               sender.recvCorrection(s->send_chl, size);
+               correction.join();
+               p["correction"] = Since(start);
+
+               start = Clock::now();
+               for (uint64_t k = 0; k < size; k++)
+                 sender.encode(k, &(*inputs)[k], &outputs[k], sizeof(osuCrypto::block));
+               p["send_encode"] = Since(start);
+               return p;
+             }});
+  }
+}
+
+/*
+ * BatchEquality of PSM3 between two parties in this process, on the NetIO/OTPack layout of one
+ * lane: leaf OTs on the first NetIO, triples on the second. Each phase runs on both parties
+ * before the next starts and counts with the slower party's time.
+ */
+static void AddBatchEquality(Registry &reg, const BenchParams &bp) {
+  if (!reg.Wants("batch_equality/")) return;
+  struct State {
+    int l, b;
+    sci::NetIO *io[2][2] = {};
+    sci::OTPack<sci::NetIO> *pack[2][2] = {};
+
+    ~State() {
+      for (auto &party : pack)
+        for (auto p : party) delete p;
+      for (auto &party : io)
+        for (auto i : party) delete i;
+    }
+  };
+  auto s = std::make_shared<State>();
+  s->l = (int)bp.bitlen;
+  s->b = (int)bp.radix;
+  auto connect = [&](int party) {
+    int k = party - 1;
+    const char *address = party == sci::ALICE ? nullptr : "127.0.0.1";
+    s->io[k][0] = new sci::NetIO(address, bp.port, true);
+    s->io[k][1] = new sci::NetIO(address, bp.port + 1, true);
+    s->pack[k][0] = ENCRYPTO::MakePlannedOTPack(s->io[k][0], party, s->b, s->l, ENCRYPTO::LeafOTPlan(s->l, s->b, false));
+    s->pack[k][1] = ENCRYPTO::MakePlannedOTPack(s->io[k][1], 3 - party, s->b, s->l, ENCRYPTO::TripleOTPlan());
+  };
+  std::thread bob(connect, sci::BOB);
+  connect(sci::ALICE);
+  bob.join();
+
+  const int batch = 8;
+  for (uint64_t size : bp.sizes) {
+    int num_cmps = (int)std::max<uint64_t>(8, (size + 7) / 8 * 8);
+    auto alice_data = std::make_shared<std::vector<uint64_t>>((size_t)batch * num_cmps);
+    auto bob_data = std::make_shared<std::vector<uint64_t>>(num_cmps);
+    std::mt19937_64 rng(1);
+    uint64_t mask = s->l == 64 ? ~0ull : (1ull << s->l) - 1;
+    for (auto &v : *alice_data) v = rng() & mask;
+    for (int j = 0; j < num_cmps; j++) (*bob_data)[j] = (*alice_data)[(size_t)j * batch + j % batch];
+
+    std::string params = "cmps=" + std::to_string(num_cmps) + ",l=" + std::to_string(s->l) +
+                         ",radix=" + std::to_string(s->b) + ",batch=" + std::to_string(batch);
+    reg.Add({"batch_equality/phases", params, (uint64_t)num_cmps, [s, alice_data, bob_data, num_cmps, batch] {
+               Phases mine[2];
+               auto run = [&](int party) {
+                 int k = party - 1;
+                 Phases &p = mine[k];
+                 BatchEquality<sci::NetIO> compare(party, s->l, s->b, batch, num_cmps, s->io[k][0], s->io[k][1],
+                                                   s->pack[k][0], s->pack[k][1], nullptr, false);
+                 std::vector<uint8_t> res(num_cmps);
+                 auto start = Clock::now();
+                 compare.setLeafMessages(party == sci::ALICE ? alice_data->data() : bob_data->data());
+                 p["set_leaf_messages"] = Since(start);
+                 start = Clock::now();
+                 compare.computeLeafOTs();
+                 p["leaf_ots"] = Since(start);
+                 start = Clock::now();
+                 compare.generate_triples();
+                 p["triples"] = Since(start);
+                 start = Clock::now();
+                 compare.traverse_and_compute_ANDs(res.data());
+                 p["and_tree"] = Since(start);
+               };
+               std::thread bob(run, sci::BOB);
+               run(sci::ALICE);
+               bob.join();
+               Phases p = mine[0];
+               for (auto &e : p) e.second = std::max(e.second, mine[1][e.first]);
+               return p;
+             }});
+  }
+}
+
+/*
+ * The leader's match over nodes x size bins with bin_load server values each. The client value
+ * of every 64th bin matches one of them; PSM2 multiplies the ciphertexts of those matches.
+ */
+static void AddMatch(Registry &reg, const BenchParams &bp) {
+  if (!reg.Wants("match/")) return;
+  const uint64_t pool = 64;  // distinct ciphertexts per node, reused across its entries
+  std::shared_ptr<Paillier::Paillier> key;
+  NTL::ZZ n, g;
+  if (reg.Wants("match/paillier")) {
+    key = std::make_shared<Paillier::Paillier>();
+    n = key->getN();
+    g = key->getG();
+  }
+  for (uint64_t size : bp.sizes) {
+    struct Tables {
+      std::vector<std::vector<std::vector<uint64_t>>> server;
+      std::vector<std::vector<std::vector<uint32_t>>> index;
+      std::vector<uint64_t> client;
+      std::vector<std::vector<NTL::ZZ>> ciphertexts;
+      NTL::ZZ zero, n2;
+    };
+    auto t = std::make_shared<Tables>();
+    std::mt19937_64 rng(2);
+    t->server.resize(bp.nodes);
+    t->index.resize(bp.nodes);
+    t->client.resize(bp.nodes * size);
+    for (uint64_t i = 0; i < bp.nodes; i++) {
+      t->server[i].resize(size);
+      t->index[i].resize(size);
+      for (uint64_t b = 0; b < size; b++) {
+        for (uint64_t k = 0; k < bp.bin_load; k++) {
+          t->server[i][b].push_back(rng());
+          t->index[i][b].push_back((uint32_t)(rng() % pool));
+        }
+        t->client[i * size + b] = b % 64 == 0 && bp.bin_load > 0 ? t->server[i][b][0] : rng();
+      }
+    }
+    if (key) {
+      t->n2 = n * n;
+      t->zero = Paillier::encryptNumber(NTL::ZZ(0), n, g);
+      std::vector<NTL::ZZ> shared(pool);
+      for (auto &c : shared) c = Paillier::encryptNumber(NTL::ZZ(1), n, g);
+      t->ciphertexts.assign(bp.nodes, shared);
+    }
+
+    std::string params = "nodes=" + std::to_string(bp.nodes) + ",bins=" + std::to_string(size) +
+                         ",load=" + std::to_string(bp.bin_load);
+    uint64_t items = bp.nodes * size * bp.bin_load;
+    reg.Add({"match/count", params, items, [t, size] {
+               Keep(ENCRYPTO::CountBinMatches(t->server, t->client, size));
+               return Phases();
+             }});
+    if (key)
+      reg.Add({"match/paillier", params, items, [t, size] {
+                 NTL::ZZ sum = ENCRYPTO::MultiplyBinMatches(t->zero, t->server, t->index, t->client, size,
+                                                            t->ciphertexts, t->n2);
+                 return Phases();
+               }});
+  }
+}
+
+// OPRF outputs to the 64-bit values the match compares, size OTs of bin_load entries each
+static void AddConvert(Registry &reg, const BenchParams &bp) {
+  if (!reg.Wants("convert/")) return;
+  for (uint64_t size : bp.sizes) {
+    osuCrypto::PRNG prng(osuCrypto::toBlock(3));
+    auto blocks = std::make_shared<std::vector<osuCrypto::block>>(size);
+    auto bins = std::make_shared<std::vector<std::vector<osuCrypto::block>>>(size);
+    auto values = std::make_shared<std::vector<std::vector<uint64_t>>>(size);
+    for (uint64_t i = 0; i < size; i++) {
+      (*blocks)[i] = prng.get<osuCrypto::block>();
+      for (uint64_t k = 0; k < bp.bin_load; k++) {
+        (*bins)[i].push_back(prng.get<osuCrypto::block>());
+        (*values)[i].push_back(prng.get<uint64_t>());
+      }
+    }
+    std::string params = "ots=" + std::to_string(size) + ",load=" + std::to_string(bp.bin_load);
+    reg.Add({"convert/client_oprf", params, size, [blocks, size] {
+               Keep(fromClientOprfData(*blocks, size));
+               return Phases();
+             }});
+    reg.Add({"convert/server_oprf", params, size * bp.bin_load, [bins] {
+               Keep(fromServerOprfBins(*bins));
+               return Phases();
+             }});
+    reg.Add({"convert/flatten", params, size * bp.bin_load, [values] {
+               Keep(flatten(*values));
+               return Phases();
+             }});
+  }
+}
+
+static void AddKeyAgreement(Registry &reg, const BenchParams &bp) {
+  if (reg.Wants("ka/")) {
+    struct State {
+      KA::KA ka;
+      EVP_PKEY *peer = nullptr;
+      ~State() { EVP_PKEY_free(peer); }
+    };
+    auto s = std::make_shared<State>();
+    s->ka.key();
+    s->peer = s->ka.key(true);
+    reg.Add({"ka/shared_secret", "dh=1024", 1, [s] {
+               auto secret = KA::compute_shared_secret(s->ka.key(), s->peer);
+               return Phases();
+             }});
+  }
+  reg.Add({"vrf/sequence", "nodes=" + std::to_string(bp.nodes), bp.nodes, [bp] {
+             VRF vrf;
+             auto seq = vrf.sequence(bp.nodes);
+             return Phases();
+           }});
+}
+
+/*
+ * A node store of size elements (update_store.h) with the table shape of cneles = size: apply
+ * appends a churn round to the log and brings the store and its ciphertexts up to date, so each
+ * call pays for one round's delta; rebuild builds store and ciphertexts from scratch, what every
+ * query pays without a store.
+ */
+static void AddUpdate(Registry &reg, const BenchParams &bp) {
+  if (!reg.Wants("update/")) return;
+  struct State {
+    Paillier::Paillier key;
+    NTL::ZZ n, g;
+    std::string dir;
+    std::vector<uint64_t> nodes;
+    std::vector<std::vector<uint64_t>> inputs;
+    std::mt19937_64 rng{4};
+    ~State() {
+      for (uint64_t node : nodes) ENCRYPTO::NodeStore::Remove(dir, node);
+      rmdir(dir.c_str());
+    }
+  };
+  auto s = std::make_shared<State>();
+  s->n = s->key.getN();
+  s->g = s->key.getG();
+  std::string tmpl = bp.store_dir + "/dmsp2cq_microbench_XXXXXX";
+  if (!mkdtemp(&tmpl[0])) throw std::runtime_error("Cannot create a directory in " + bp.store_dir);
+  s->dir = tmpl;
+  ENCRYPTO::ValueEncryptor encrypt = [s](const std::vector<uint64_t> &plain) {
+    std::vector<NTL::ZZ> numbers(plain.size());
+    for (size_t i = 0; i < plain.size(); i++) numbers[i] = NTL::conv<NTL::ZZ>(plain[i]);
+    return Paillier::encrypt(numbers, s->n, s->g);
+  };
+
+  for (uint64_t size : bp.sizes) {
+    const size_t input = s->inputs.size();
+    s->inputs.emplace_back();
+    for (uint64_t i = 0; i < size; i++) s->inputs[input].push_back(2000 * i);
+    const uint64_t apply_node = s->nodes.size(), rebuild_node = apply_node + 1;
+    s->nodes.push_back(apply_node);
+    s->nodes.push_back(rebuild_node);
+    // the first call of apply pays the build, the warmup repetition absorbs it
+    auto sync = [s, size, input, encrypt](uint64_t node, Phases &p) {
+      auto start = Clock::now();
+      ENCRYPTO::NodeStore store(s->dir, node, size, 3);
+      store.Sync(s->inputs[input], ENCRYPTO::InputView());
+      std::vector<std::vector<uint64_t>> bins;
+      std::vector<std::vector<uint32_t>> index;
+      store.TakeTable(bins, index);
+      p["sync"] = Since(start);
+      start = Clock::now();
+      Keep(store.Ciphertexts(s->n, encrypt));
+      p["encrypt"] = Since(start);
+    };
+
+    const uint64_t round = std::max<uint64_t>(1, (uint64_t)std::ceil(bp.churn * size));
+    std::string params = "elements=" + std::to_string(size) + ",churn=" + std::to_string(round);
+    const uint64_t bitlen = bp.bitlen;
+    reg.Add({"update/apply", params, round, [s, sync, input, round, apply_node, bitlen] {
+               Phases p;
+               auto start = Clock::now();
+               ENCRYPTO::AppendUpdates(s->dir, apply_node,
+                                       ENCRYPTO::ChurnRecords(s->inputs[input], round, bitlen, s->rng));
+               p["log"] = Since(start);
+               sync(apply_node, p);
+               return p;
+             }});
+    reg.Add({"update/rebuild", "elements=" + std::to_string(size), size, [s, sync, rebuild_node] {
+               Phases p;
+               ENCRYPTO::NodeStore::Remove(s->dir, rebuild_node);
+               sync(rebuild_node, p);
+               return p;
+             }});
+  }
+}
+
+static Phases Measure(const Kernel &kernel, double min_time) {
+  Phases total;
+  uint64_t calls = 0;
+  auto start = Clock::now();
+  do {
+    auto call_start = Clock::now();
+    Phases p = kernel.call();
+    if (p.empty()) p["call"] = Since(call_start);
+    for (const auto &e : p) total[e.first] += e.second;
+    calls++;
+  } while (Since(start) < min_time);
+  for (auto &e : total) e.second /= calls;
+  return total;
+}
+
+int main(int argc, char **argv) {
+  namespace po = boost::program_options;
+  std::string filter, sizes, csv_path, json_path, label;
+  BenchParams bp;
+  uint32_t warmup, reps;
+  double min_time;
+  po::options_description allowed("Allowed options");
+  // clang-format off
+  allowed.add_options()("help,h", "produce this message")
+  ("filter",      po::value<std::string>(&filter)->default_value(""),          "Comma-separated kernel name prefixes, e.g. paillier,batch_equality/ (default: all)")
+  ("sizes",       po::value<std::string>(&sizes)->default_value("1024,16384"), "Comma-separated element counts: OTs, comparisons or bins per node")
+  ("nodes",       po::value<uint64_t>(&bp.nodes)->default_value(20u),          "Nodes of the match and VRF kernels")
+  ("bit-length",  po::value<uint64_t>(&bp.bitlen)->default_value(58u),         "Element bit-length of BatchEquality")
+  ("radix",       po::value<uint64_t>(&bp.radix)->default_value(5u),           "Radix of BatchEquality")
+  ("bin-load",    po::value<uint64_t>(&bp.bin_load)->default_value(3u),        "Server values per bin in the match and conversion kernels")
+  ("port",        po::value<uint16_t>(&bp.port)->default_value(47000),         "First of the three loopback ports of the BatchEquality and KKRT pairs")
+  ("churn",       po::value<double>(&bp.churn)->default_value(0.01),          "Fraction of the store's elements one update/apply call changes")
+  ("store-dir",   po::value<std::string>(&bp.store_dir)->default_value("/tmp"), "Directory of the update kernels' stores")
+  ("min-time",    po::value<double>(&min_time)->default_value(0.5),            "Seconds each repetition keeps calling a kernel")
+  ("warmup",      po::value<uint32_t>(&warmup)->default_value(1u),             "Unrecorded repetitions per kernel")
+  ("reps",        po::value<uint32_t>(&reps)->default_value(5u),               "Recorded repetitions per kernel")
+  ("csv",         po::value<std::string>(&csv_path)->default_value(""),        "Write the summary as CSV to this file")
+  ("json",        po::value<std::string>(&json_path)->default_value(""),       "Write the summary as JSON to this file")
+  ("label",       po::value<std::string>(&label)->default_value(""),           "Tag of this run, e.g. the commit, in every CSV row and the JSON");
+  // clang-format on
+
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, allowed), vm);
+    if (vm.count("help")) {
+      std::cout << allowed << "\n";
+      return EXIT_SUCCESS;
+    }
+    po::notify(vm);
+  } catch (const po::error &e) {
+    std::cout << e.what() << std::endl;
+    std::cout << allowed << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (reps == 0) reps = 1;
+
+  std::vector<std::string> filters;
+  {
+    std::stringstream ss(filter);
+    std::string item;
+    while (std::getline(ss, item, ','))
+      if (!item.empty()) filters.push_back(item);
+    std::stringstream zs(sizes);
+    while (std::getline(zs, item, ','))
+      if (!item.empty()) bp.sizes.push_back(std::stoull(item));
+  }
+
+  Registry reg(filters);
+  AddPaillier(reg);
+  AddKkrt(reg, bp);
+  AddBatchEquality(reg, bp);
+  AddMatch(reg, bp);
+  AddConvert(reg, bp);
+  AddKeyAgreement(reg, bp);
+  AddUpdate(reg, bp);
+  if (reg.Kernels().empty()) {
+    std::cerr << "No kernel matches --filter " << filter << "\n";
+    return EXIT_FAILURE;
+  }
+
+  std::ofstream csv, json;
+  if (!csv_path.empty()) {
+    csv.open(csv_path);
+    if (!csv.is_open()) {
+      std::cerr << "Failed to open file: " << csv_path << std::endl;
+      return EXIT_FAILURE;
+    }
+    csv << "label,kernel,params,phase,reps,items,mean_ns,p50_ns,p95_ns,stddev_ns,min_ns,max_ns,items_per_s\n";
+  }
+  if (!json_path.empty()) {
+    json.open(json_path);
+    if (!json.is_open()) {
+      std::cerr << "Failed to open file: " << json_path << std::endl;
+      return EXIT_FAILURE;
+    }
+    json << "{\"label\":" << ENCRYPTO::JsonString(label) << ",\"kernels\":[";
+  }
+
+  for (size_t ki = 0; ki < reg.Kernels().size(); ki++) {
+    const Kernel &kernel = reg.Kernels()[ki];
+    std::map<std::string, std::vector<double>> samples;  // ns per call
+    for (uint32_t rep = 0; rep < warmup + reps; rep++) {
+      Phases p = Measure(kernel, min_time);
+      if (rep < warmup) continue;
+      for (const auto &e : p) samples[e.first].push_back(e.second * 1e9);
+    }
+
+    std::cout << kernel.name << " " << kernel.params << "\n";
+    if (json.is_open())
+      json << (ki ? "," : "") << "\n{\"kernel\":" << ENCRYPTO::JsonString(kernel.name)
+           << ",\"params\":" << ENCRYPTO::JsonString(kernel.params) << ",\"items\":" << kernel.items
+           << ",\"reps\":" << reps << ",\"phases\":{";
+    bool first = true;
+    for (const auto &e : samples) {
+      ENCRYPTO::BenchSummary s = ENCRYPTO::Summarize(e.second);
+      double rate = s.mean > 0 ? kernel.items * 1e9 / s.mean : 0;
+      std::cout << "  " << std::left << std::setw(20) << e.first << std::right << " mean " << s.mean << " ns, p50 "
+                << s.p50 << ", p95 " << s.p95 << ", sd " << s.stddev << ", " << rate << " items/s\n";
+      if (csv.is_open())
+        csv << label << "," << kernel.name << ",\"" << kernel.params << "\"," << e.first << "," << reps << ","
+            << kernel.items << "," << s.mean << "," << s.p50 << "," << s.p95 << "," << s.stddev << "," << s.min
+            << "," << s.max << "," << rate << "\n";
+      if (json.is_open())
+        json << (first ? "" : ",") << ENCRYPTO::JsonString(e.first) << ":{\"mean_ns\":" << s.mean
+             << ",\"p50_ns\":" << s.p50 << ",\"p95_ns\":" << s.p95 << ",\"stddev_ns\":" << s.stddev
+             << ",\"min_ns\":" << s.min << ",\"max_ns\":" << s.max << ",\"items_per_s\":" << rate << "}";
+      first = false;
+    }
+    if (json.is_open()) json << "}}";
+  }
+  if (json.is_open()) json << "\n]}\n";
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,111 @@
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+#include <boost/program_options.hpp>
+
+#include "common/config.h"
+#include "common/dataset.h"
+#include "common/functionalities.h"
+#include "common/party.h"
+#include "common/update_store.h"
+
+/*
+ * Appends to the update log of a server node under --store-dir; gcf_p2cq applies it at the
+ * node's next PSM1/PSM2 query. Records go in this order: --delete, --add, then --churn, a
+ * fraction of the node's inputs deleted and added at random (see ChurnRecords). The inputs are
+ * partition --node of --dataset, or the built-in server inputs of --sneles elements.
+ */
+
+static std::vector<std::string> split(const std::string &list) {
+  std::vector<std::string> items;
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ','))
+    if (!item.empty()) items.push_back(item);
+  return items;
+}
+
+int main(int argc, char **argv) {
+  namespace po = boost::program_options;
+  std::string store_dir, adds, deletes, dataset_path;
+  uint64_t node, sneles, bitlen, seed;
+  double churn;
+  po::options_description allowed("Allowed options");
+  // clang-format off
+  allowed.add_options()("help,h", "produce this message")
+  ("store-dir",     po::value<std::string>(&store_dir)->required(),           "--store-dir of the server")
+  ("node",          po::value<uint64_t>(&node)->default_value(0u),            "Server node whose log to append to")
+  ("add",           po::value<std::string>(&adds)->default_value(""),         "Comma-separated element[:value] to add, or to give a new value (default value: random in [1, 10000])")
+  ("delete",        po::value<std::string>(&deletes)->default_value(""),      "Comma-separated elements to delete")
+  ("churn",         po::value<double>(&churn)->default_value(0.0),            "Fraction of the node's inputs to change at random, e.g. 0.01")
+  ("dataset",       po::value<std::string>(&dataset_path)->default_value(""), "Server dataset the node was started on (empty = built-in inputs)")
+  ("sneles,s",      po::value<uint64_t>(&sneles)->default_value(1024u),       "Number of server elements")
+  ("bit-length,b",  po::value<uint64_t>(&bitlen)->default_value(58u),         "Bit-length of the elements --churn adds")
+  ("seed",          po::value<uint64_t>(&seed)->default_value(1u),            "Seed of the random values and of --churn");
+  // clang-format on
+
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, allowed), vm);
+    if (vm.count("help")) {
+      std::cout << allowed << "\n";
+      return EXIT_SUCCESS;
+    }
+    po::notify(vm);
+  } catch (const po::error &e) {
+    std::cout << e.what() << std::endl;
+    std::cout << allowed << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (churn < 0 || churn > 1) {
+    std::cerr << "--churn must be in [0, 1]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::mt19937_64 prng(seed);
+  std::uniform_int_distribution<uint64_t> values(1, 10000);
+  std::vector<ENCRYPTO::UpdateRecord> records;
+  try {
+    for (const auto &item : split(deletes)) records.push_back({ENCRYPTO::UPDATE_DELETE, std::stoull(item), 0});
+    for (const auto &item : split(adds)) {
+      size_t colon = item.find(':');
+      uint64_t element = std::stoull(item.substr(0, colon));
+      uint64_t value = colon == std::string::npos ? values(prng) : std::stoull(item.substr(colon + 1));
+      records.push_back({ENCRYPTO::UPDATE_ADD, element, value});
+    }
+
+    if (churn > 0) {
+      ENCRYPTO::Dataset dataset;
+      std::vector<uint64_t> builtin;
+      ENCRYPTO::InputView inputs;
+      if (!dataset_path.empty()) {
+        dataset.Open(dataset_path);
+        if (dataset.Partitions() != 1 && node >= dataset.Partitions())
+          throw std::runtime_error("Dataset has no partition " + std::to_string(node));
+        inputs = dataset.Elements(dataset.Partitions() == 1 ? 0 : node);
+      } else {
+        ENCRYPTO::PsiAnalyticsContext context;
+        context.role = SERVER;
+        context.psm_type = ENCRYPTO::PsiAnalyticsContext::PSM2;
+        context.sneles = sneles;
+        builtin = ENCRYPTO::DefaultInputs(context);
+        inputs = builtin;
+      }
+      inputs = inputs.first(sneles);
+      auto round = ENCRYPTO::ChurnRecords(inputs, (uint64_t)std::ceil(churn * inputs.size()), bitlen, prng);
+      records.insert(records.end(), round.begin(), round.end());
+    }
+
+    ENCRYPTO::AppendUpdates(store_dir, node, records);
+  } catch (const std::logic_error &e) {
+    std::cerr << "Bad element or value: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << "Appended " << records.size() << " records to the log of node " << node << " in " << store_dir << "\n";
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,303 @@
+#include "dh_oprf.h"
+
+#include "common/Timer.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+#ifdef ENABLE_RELIC
+#include "cryptoTools/Crypto/PRNG.h"
+#include "cryptoTools/Crypto/RCurve.h"
+#include "cryptoTools/Crypto/RandomOracle.h"
+#endif
+
+namespace ENCRYPTO {
+
+namespace {
+
+const char kCacheMagic[8] = {'D', 'M', 'S', 'P', 'D', 'H', '1', '\0'};
+const uint32_t kCacheVersion = 2;
+
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t domain;  // 1 = OPRF1, 2 = OPRF2
+  uint64_t key_id;
+  uint64_t count;
+};
+static_assert(sizeof(CacheHeader) == 32, "CacheHeader is part of the file format");
+
+std::string KeyPath(const std::string &dir, uint64_t node, const char *file) {
+  return dir + "/dh_oprf_" + std::to_string(node) + "." + file;
+}
+
+#ifdef ENABLE_RELIC
+// Seeds from the system, unlike the fixed seeds of the KKRT runs: these scalars must stay secret
+osuCrypto::PRNG SystemPrng() {
+  std::random_device rd;
+  return osuCrypto::PRNG(osuCrypto::toBlock((uint64_t(rd()) << 32) | rd(), (uint64_t(rd()) << 32) | rd()));
+}
+
+// H(x) of OPRF1 or OPRF2
+void HashToCurve(osuCrypto::REccPoint &point, std::uint64_t x, bool second_oprf) {
+  point.randomize(osuCrypto::toBlock(second_oprf ? 2 : 1, x));
+}
+
+// H' of a point, the 64-bit output
+std::uint64_t Output(const osuCrypto::REccPoint &point, std::vector<std::uint8_t> &buf) {
+  buf.resize(point.sizeBytes());
+  point.toBytes(buf.data());
+  osuCrypto::RandomOracle ro(sizeof(std::uint64_t));
+  ro.Update(buf.data(), buf.size());
+  std::uint64_t out;
+  ro.Final(reinterpret_cast<std::uint8_t *>(&out));
+  return out;
+}
+#endif
+
+void NoRelic() {
+  throw std::runtime_error("--oprf-mode dh needs libOTe built with ENABLE_RELIC");
+}
+
+}  // namespace
+
+DhOprfKey::DhOprfKey(const std::string &dir, uint64_t node) {
+#ifdef ENABLE_RELIC
+  osuCrypto::REllipticCurve curve;
+  osuCrypto::REccNumber k;
+  scalar_.resize(k.sizeBytes());
+  const std::string path = dir.empty() ? "" : KeyPath(dir, node, "key");
+  bool loaded = false;
+  if (!path.empty()) {
+    if (std::FILE *file = std::fopen(path.c_str(), "rb")) {
+      loaded = std::fread(scalar_.data(), 1, scalar_.size(), file) == scalar_.size() && std::fgetc(file) == EOF;
+      std::fclose(file);
+      if (!loaded) throw std::runtime_error("OPRF key " + path + " is not a key of this curve");
+      k.fromBytes(scalar_.data());
+    }
+  }
+  if (!loaded) {
+    osuCrypto::PRNG prng = SystemPrng();
+    k.randomize(prng);
+    k.toBytes(scalar_.data());
+    if (!path.empty()) {
+      // only the owner may read it, and a crash never leaves half a key behind
+      const std::string tmp = path + ".tmp";
+      int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+      bool ok = fd >= 0 && write(fd, scalar_.data(), scalar_.size()) == (ssize_t)scalar_.size();
+      if (fd >= 0 && close(fd) != 0) ok = false;
+      if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("Cannot write OPRF key " + path);
+      }
+    }
+  }
+  std::vector<std::uint8_t> buf;
+  id_ = Output(curve.getGenerator() * k, buf);
+#else
+  (void)dir;
+  (void)node;
+  id_ = 0;
+  NoRelic();
+#endif
+}
+
+std::vector<std::uint64_t> DhOprfKey::Evaluate(const std::vector<std::uint64_t> &inputs, bool second_oprf) const {
+  std::vector<std::uint64_t> outputs(inputs.size());
+#ifdef ENABLE_RELIC
+  osuCrypto::REllipticCurve curve;
+  osuCrypto::REccNumber k;
+  k.fromBytes(scalar_.data());
+  osuCrypto::REccPoint point;
+  std::vector<std::uint8_t> buf;
+  for (std::size_t i = 0; i < inputs.size(); ++i) {
+    HashToCurve(point, inputs[i], second_oprf);
+    outputs[i] = Output(point * k, buf);
+  }
+#else
+  (void)second_oprf;
+  NoRelic();
+#endif
+  return outputs;
+}
+
+DhOprfCache::DhOprfCache(const std::string &dir, uint64_t node, uint64_t key_id, bool second_oprf)
+    : path_(dir.empty() ? "" : KeyPath(dir, node, second_oprf ? "cache2" : "cache1")),
+      key_id_(key_id),
+      domain_(second_oprf ? 2 : 1) {
+  if (path_.empty()) return;
+  std::FILE *file = std::fopen(path_.c_str(), "rb");
+  if (!file) return;
+  CacheHeader header{};
+  if (std::fread(&header, sizeof(header), 1, file) == 1 &&
+      std::memcmp(header.magic, kCacheMagic, sizeof(kCacheMagic)) == 0 && header.version == kCacheVersion &&
+      header.domain == domain_ && header.key_id == key_id) {
+    entries_.resize(header.count);
+    if (std::fread(entries_.data(), sizeof(entries_[0]), entries_.size(), file) != entries_.size()) entries_.clear();
+  }
+  std::fclose(file);
+  // a cache of another key or OPRF, or a damaged one, is rewritten
+  changed_ = entries_.size() != header.count || header.key_id != key_id || header.domain != domain_;
+}
+
+std::vector<std::uint64_t> DhOprfCache::Missing(std::vector<std::uint64_t> inputs) const {
+  std::sort(inputs.begin(), inputs.end());
+  inputs.erase(std::unique(inputs.begin(), inputs.end()), inputs.end());
+  std::vector<std::uint64_t> missing;
+  auto it = entries_.begin();
+  for (std::uint64_t x : inputs) {
+    it = std::lower_bound(it, entries_.end(), x,
+                          [](const std::pair<std::uint64_t, std::uint64_t> &e, std::uint64_t v) { return e.first < v; });
+    if (it == entries_.end() || it->first != x) missing.push_back(x);
+  }
+  return missing;
+}
+
+void DhOprfCache::Add(const std::vector<std::uint64_t> &inputs, const std::vector<std::uint64_t> &outputs) {
+  if (inputs.empty()) return;
+  const std::size_t old = entries_.size();
+  for (std::size_t i = 0; i < inputs.size(); ++i) entries_.emplace_back(inputs[i], outputs.at(i));
+  std::sort(entries_.begin() + old, entries_.end());
+  std::inplace_merge(entries_.begin(), entries_.begin() + old, entries_.end());
+  changed_ = true;
+}
+
+std::uint64_t DhOprfCache::Get(std::uint64_t input) const {
+  auto it = std::lower_bound(entries_.begin(), entries_.end(), input,
+                             [](const std::pair<std::uint64_t, std::uint64_t> &e, std::uint64_t v) { return e.first < v; });
+  if (it == entries_.end() || it->first != input) throw std::logic_error("No cached OPRF output");
+  return it->second;
+}
+
+void DhOprfCache::Save(const std::vector<std::uint64_t> &used) {
+  std::size_t kept = 0;
+  auto u = used.begin();
+  for (const auto &e : entries_) {
+    u = std::lower_bound(u, used.end(), e.first);
+    if (u != used.end() && *u == e.first) entries_[kept++] = e;
+  }
+  changed_ |= kept != entries_.size();
+  entries_.resize(kept);
+  if (!changed_ || path_.empty()) return;
+
+  CacheHeader header;
+  std::memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+  header.version = kCacheVersion;
+  header.domain = domain_;
+  header.key_id = key_id_;
+  header.count = entries_.size();
+  const std::string tmp = path_ + ".tmp";
+  std::FILE *file = std::fopen(tmp.c_str(), "wb");
+  bool ok = file && std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+            std::fwrite(entries_.data(), sizeof(entries_[0]), entries_.size(), file) == entries_.size();
+  if (file && std::fclose(file) != 0) ok = false;
+  if (!ok || std::rename(tmp.c_str(), path_.c_str()) != 0) {
+    std::remove(tmp.c_str());
+    throw std::runtime_error("Cannot write OPRF cache " + path_);
+  }
+  changed_ = false;
+}
+
+// Client
+std::vector<std::uint64_t> dh_oprf_receiver(const std::vector<std::uint64_t> &inputs, osuCrypto::Channel &recvChl,
+                                            ENCRYPTO::PsiAnalyticsContext &context, bool second_oprf) {
+  std::vector<std::uint64_t> outputs(inputs.size());
+#ifdef ENABLE_RELIC
+  // no base OTs in this mode
+  context.timings.base_ots_libote = 0;
+  Timer oprf(second_oprf ? "oprf2" : "oprf1");
+
+  osuCrypto::REllipticCurve curve;
+  osuCrypto::PRNG prng = SystemPrng();
+  osuCrypto::REccPoint point;
+  const std::size_t size = point.sizeBytes();
+  const std::size_t chunk = context.oprf_chunk ? context.oprf_chunk : inputs.size();
+  // blinds of the chunk in flight and of the next one: one chunk is sent ahead of each reply
+  std::vector<osuCrypto::REccNumber> unblind[2];
+  auto send = [&](std::size_t first) {
+    std::size_t count = std::min(chunk, inputs.size() - first);
+    std::vector<osuCrypto::REccNumber> &inverse = unblind[(first / chunk) % 2];
+    inverse.resize(count);
+    std::vector<std::uint8_t> buf(count * size);
+    osuCrypto::REccNumber r;
+    for (std::size_t j = 0; j < count; ++j) {
+      r.randomize(prng);
+      inverse[j] = r.inverse();
+      HashToCurve(point, inputs[first + j], second_oprf);
+      (point * r).toBytes(buf.data() + j * size);
+    }
+    recvChl.asyncSend(std::move(buf));
+  };
+
+  if (!inputs.empty()) send(0);
+  std::vector<std::uint8_t> buf, out;
+  for (std::size_t first = 0; first < inputs.size(); first += chunk) {
+    if (first + chunk < inputs.size()) send(first + chunk);
+    std::vector<osuCrypto::REccNumber> &inverse = unblind[(first / chunk) % 2];
+    recvChl.recv(buf);
+    if (buf.size() != inverse.size() * size) throw std::runtime_error("DH OPRF reply of the wrong size");
+    for (std::size_t j = 0; j < inverse.size(); ++j) {
+      point.fromBytes(buf.data() + j * size);
+      outputs[first + j] = Output(point * inverse[j], out);
+    }
+  }
+
+  if (!second_oprf)
+    context.timings.oprf1 = oprf.end();
+  else
+    context.timings.oprf2 = oprf.end();
+#else
+  (void)recvChl;
+  (void)context;
+  (void)second_oprf;
+  NoRelic();
+#endif
+  return outputs;
+}
+
+// Server
+void dh_oprf_sender(const DhOprfKey &key, osuCrypto::Channel &sendChl, ENCRYPTO::PsiAnalyticsContext &context,
+                    std::size_t numOTs, bool second_oprf) {
+#ifdef ENABLE_RELIC
+  context.timings.base_ots_libote = 0;
+  Timer oprf(second_oprf ? "oprf2" : "oprf1");
+
+  osuCrypto::REllipticCurve curve;
+  osuCrypto::REccNumber k;
+  k.fromBytes(key.Scalar().data());
+  osuCrypto::REccPoint point;
+  const std::size_t size = point.sizeBytes();
+  // the receiver picks the chunks; each one is answered as it arrives
+  std::size_t done = 0;
+  while (done < numOTs) {
+    std::vector<std::uint8_t> buf;
+    sendChl.recv(buf);
+    if (buf.empty() || buf.size() % size != 0 || done + buf.size() / size > numOTs)
+      throw std::runtime_error("DH OPRF request of the wrong size");
+    for (std::size_t j = 0; j < buf.size() / size; ++j) {
+      point.fromBytes(buf.data() + j * size);
+      (point * k).toBytes(buf.data() + j * size);
+    }
+    done += buf.size() / size;
+    sendChl.asyncSend(std::move(buf));
+  }
+
+  if (!second_oprf)
+    context.timings.oprf1 = oprf.end();
+  else
+    context.timings.oprf2 = oprf.end();
+#else
+  (void)key;
+  (void)sendChl;
+  (void)context;
+  (void)numOTs;
+  (void)second_oprf;
+  NoRelic();
+#endif
+}
+
+}  // namespace ENCRYPTO
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include "cryptoTools/Common/config.h"
+#include "cryptoTools/Network/Channel.h"
+
+#include "common/config.h"
+
+/*
+ * Key-reusable OPRF for PSM1/PSM2 (--oprf-mode dh): F_k(x) = H'(H(x)^k) on an elliptic curve,
+ * truncated to the 64-bit values the protocol compares. The receiver blinds H(x) with a fresh
+ * scalar per element and the sender only ever sees and returns blinded points, so k can be
+ * long-lived: a server node evaluates its own elements once and keeps the results (DhOprfCache),
+ * and a query costs it one scalar multiplication per client bin instead of encoding its table.
+ *
+ * OPRF1 and OPRF2 hash into separate domains, as they are separate functions of the KKRT mode.
+ */
+
+namespace ENCRYPTO {
+
+#ifdef ENABLE_RELIC
+static const bool DH_OPRF_AVAILABLE = true;
+#else
+static const bool DH_OPRF_AVAILABLE = false;
+#endif
+
+// The long-lived key of one server node, dir/dh_oprf_<node>.key; created on first use, and for
+// this run only without a dir
+class DhOprfKey {
+ public:
+  DhOprfKey(const std::string &dir, uint64_t node);
+
+  // Public fingerprint of the key, which values cached under it are tagged with
+  uint64_t Id() const { return id_; }
+
+  // F_k of the server's own elements, no receiver involved
+  std::vector<std::uint64_t> Evaluate(const std::vector<std::uint64_t> &inputs, bool second_oprf) const;
+
+  const std::vector<std::uint8_t> &Scalar() const { return scalar_; }
+
+ private:
+  std::vector<std::uint8_t> scalar_;
+  uint64_t id_;
+};
+
+/*
+ * Outputs of one key and OPRF for the inputs a node evaluated before, dir/dh_oprf_<node>.cache1
+ * (OPRF1) or .cache2 (OPRF2): sorted {input, output} pairs behind a header that names the key and
+ * the OPRF. Another key or OPRF empties it. Whether a node evaluates OPRF1, or OPRF2 as the
+ * center, depends on n, so it keeps one cache per OPRF.
+ */
+class DhOprfCache {
+ public:
+  DhOprfCache(const std::string &dir, uint64_t node, uint64_t key_id, bool second_oprf);
+
+  // Distinct inputs without an output, sorted
+  std::vector<std::uint64_t> Missing(std::vector<std::uint64_t> inputs) const;
+
+  // Adds outputs for inputs, which Missing returned
+  void Add(const std::vector<std::uint64_t> &inputs, const std::vector<std::uint64_t> &outputs);
+
+  // Output of an input that has one
+  std::uint64_t Get(std::uint64_t input) const;
+
+  // Drops the inputs not among used (sorted, distinct) and writes the file if anything changed;
+  // throws std::runtime_error if it cannot
+  void Save(const std::vector<std::uint64_t> &used);
+
+  std::size_t Size() const { return entries_.size(); }
+
+ private:
+  std::string path_;
+  uint64_t key_id_;
+  uint32_t domain_;  // 1 or 2, as the OPRF hashes to the curve
+  std::vector<std::pair<std::uint64_t, std::uint64_t>> entries_;
+  bool changed_ = false;
+};
+
+// Client: F_k of every input under the key of the server node on chl, in the order of inputs; the
+// blinded points go in messages of --oprf-chunk points, one ahead of the reply being read
+std::vector<std::uint64_t> dh_oprf_receiver(const std::vector<std::uint64_t> &inputs, osuCrypto::Channel &recvChl,
+                                            ENCRYPTO::PsiAnalyticsContext &context, bool second_oprf = false);
+
+// Server: answers the numOTs blinded points of dh_oprf_receiver with key
+void dh_oprf_sender(const DhOprfKey &key, osuCrypto::Channel &sendChl, ENCRYPTO::PsiAnalyticsContext &context,
+                    std::size_t numOTs, bool second_oprf = false);
+}
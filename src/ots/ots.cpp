@@ -2,20 +2,18 @@
 
 #include "common/constants.h"
 #include "common/config.h"
+#include "common/Timer.hpp"
 #include <iomanip>
 #include <iostream>
 #include <vector>
 #include <sstream>
 #include <fstream>
 
-using milliseconds_ratio = std::ratio<1, 1000>;
-using duration_millis = std::chrono::duration<double, milliseconds_ratio>;
-
 namespace ENCRYPTO {
 
 // Client
   std::vector<osuCrypto::block> ot_receiver(const std::vector<std::uint64_t> &inputs, osuCrypto::Channel& recvChl,
-                                       ENCRYPTO::PsiAnalyticsContext &context,std::size_t numOTs) {
+                                       ENCRYPTO::PsiAnalyticsContext &context,std::size_t numOTs,bool second_oprf) {
   osuCrypto::PRNG prng(_mm_set_epi32(4253233465, 334565, 0, 235));
 
   osuCrypto::KkrtNcoOtReceiver recv;
@@ -26,7 +24,7 @@ namespace ENCRYPTO {
   //  3) numOTs = number of OTs that we will perform
   recv.configure(false, 40, symsecbits);
 
-  const auto baseots_start_time = std::chrono::system_clock::now();
+  Timer baseOTsTime("base OT");
   // the number of base OT that need to be done
   osuCrypto::u64 baseCount = recv.getBaseOTCount();
   std::vector<osuCrypto::block> baseRecv(baseCount);
@@ -36,9 +34,7 @@ namespace ENCRYPTO {
   osuCrypto::DefaultBaseOT baseOTs;
   baseOTs.send(baseSend, prng, recvChl, 1);
   recv.setBaseOts(baseSend);
-  const auto baseots_end_time = std::chrono::system_clock::now();
-  const duration_millis baseOTs_duration = baseots_end_time - baseots_start_time;
-  context.timings.base_ots_libote = baseOTs_duration.count();
+  context.timings.base_ots_libote = baseOTsTime.end();
   // std::cout << "Client Base OTs time: " << baseOTs_duration.count() << " ms" << std::endl;
 
   // const auto OPRF_start_time = std::chrono::system_clock::now();
@@ -50,7 +46,7 @@ namespace ENCRYPTO {
     blocks.at(i) = osuCrypto::toBlock(inputs[i]);
   }
 
-  const auto OPRF_start_time = std::chrono::system_clock::now();
+  Timer oprf(second_oprf ? "oprf2" : "oprf1");
 
   for (auto k = 0ull; k < numOTs && k < inputs.size(); ++k) {
     recv.encode(k, &blocks.at(k), reinterpret_cast<uint8_t *>(&receiver_encoding.at(k)),
@@ -59,29 +55,25 @@ namespace ENCRYPTO {
 
   recv.sendCorrection(recvChl, numOTs);
 
-  const auto OPRF_end_time = std::chrono::system_clock::now();
-  const duration_millis OPRF_duration = OPRF_end_time - OPRF_start_time;
-
-  if(numOTs!=context.n)
-    context.timings.oprf1 = OPRF_duration.count();
+  if(!second_oprf)
+    context.timings.oprf1 = oprf.end();
   else
-    context.timings.oprf2 = OPRF_duration.count();
+    context.timings.oprf2 = oprf.end();
 
   return receiver_encoding;
 }
 
-// Server
-  std::vector<std::vector<osuCrypto::block>> ot_sender(
-  const std::vector<std::vector<std::uint64_t>> &inputs, osuCrypto::Channel& sendChl, ENCRYPTO::PsiAnalyticsContext &context,std::size_t numOTs) {
+// Base OTs and init of the KKRT sender, shared by both sender variants
+static void setup_sender(osuCrypto::KkrtNcoOtSender &sender, osuCrypto::Channel &sendChl,
+                         ENCRYPTO::PsiAnalyticsContext &context, std::size_t numOTs) {
   osuCrypto::PRNG prng(_mm_set_epi32(4253465, 3434565, 234435, 23987025));
-  osuCrypto::KkrtNcoOtSender sender;
   // get up the parameters and get some information back.
   //  1) false = semi-honest
   //  2) 40  =  statistical security param.
   //  3) numOTs = number of OTs that we will perform
   sender.configure(false, 40, 128);
 
-  const auto baseots_start_time = std::chrono::system_clock::now();
+  Timer baseOTsTime("base OT");
 
   osuCrypto::u64 baseCount = sender.getBaseOTCount();
   osuCrypto::DefaultBaseOT baseOTs;
@@ -91,13 +83,18 @@ namespace ENCRYPTO {
 
   baseOTs.receive(choices, baseRecv, prng, sendChl, 1);
   sender.setBaseOts(baseRecv, choices);
-  const auto baseots_end_time = std::chrono::system_clock::now();
-  const duration_millis baseOTs_duration = baseots_end_time - baseots_start_time;
-  context.timings.base_ots_libote = baseOTs_duration.count();
+  context.timings.base_ots_libote = baseOTsTime.end();
   // std::cout << "Server Base OTs time: " << baseOTs_duration.count() << " ms" << std::endl;
 
   // const auto OPRF_start_time = std::chrono::system_clock::now();
   sender.init(numOTs, prng, sendChl);
+}
+
+// Server
+  std::vector<std::vector<osuCrypto::block>> ot_sender(
+  const std::vector<std::vector<std::uint64_t>> &inputs, osuCrypto::Channel& sendChl, ENCRYPTO::PsiAnalyticsContext &context,std::size_t numOTs,bool second_oprf) {
+  osuCrypto::KkrtNcoOtSender sender;
+  setup_sender(sender, sendChl, context, numOTs);
 
   std::vector<std::vector<osuCrypto::block>> inputs_as_blocks(numOTs), outputs_as_blocks(numOTs);
   for (auto i = 0ull; i < numOTs; ++i) {
@@ -107,7 +104,7 @@ namespace ENCRYPTO {
     }
   }
 
-  const auto OPRF_start_time = std::chrono::system_clock::now();
+  Timer oprf(second_oprf ? "oprf2" : "oprf1");
 
   sender.recvCorrection(sendChl, numOTs);
 
@@ -118,15 +115,52 @@ namespace ENCRYPTO {
     }
   }
 
-  const auto OPRF_end_time = std::chrono::system_clock::now();
-  const duration_millis OPRF_duration = OPRF_end_time - OPRF_start_time;
-  if(numOTs!=context.n)
-    context.timings.oprf1 = OPRF_duration.count();
+  if(!second_oprf)
+    context.timings.oprf1 = oprf.end();
   else
-    context.timings.oprf2 = OPRF_duration.count();
+    context.timings.oprf2 = oprf.end();
 
   return outputs_as_blocks;
 }
 
+void ot_sender_stream(const OprfBinSource &inputs, const OprfBinSink &outputs, osuCrypto::Channel &sendChl,
+                      ENCRYPTO::PsiAnalyticsContext &context, std::size_t numOTs, bool second_oprf) {
+  osuCrypto::KkrtNcoOtSender sender;
+  setup_sender(sender, sendChl, context, numOTs);
+
+  Timer oprf(second_oprf ? "oprf2" : "oprf1");
+
+  // the corrections are one per bin, not per element, so they still arrive in one message
+  sender.recvCorrection(sendChl, numOTs);
+
+  const std::size_t chunk = context.oprf_chunk ? context.oprf_chunk : SIZE_MAX;
+  std::vector<std::vector<std::uint64_t>> encoded;
+  std::size_t first = 0;
+  while (first < numOTs) {
+    // whole bins, at least one, until the chunk is full
+    std::size_t end = first, elements = 0;
+    while (end < numOTs && (end == first || elements + inputs(end).size() <= chunk))
+      elements += inputs(end++).size();
+
+    encoded.resize(end - first);
+    for (auto i = first; i < end; ++i) {
+      const auto &bin = inputs(i);
+      auto &out = encoded[i - first];
+      out.resize(bin.size());
+      for (auto j = 0ull; j < bin.size(); ++j) {
+        osuCrypto::block input = osuCrypto::toBlock(bin[j]), output;
+        sender.encode(i, &input, &output, sizeof(osuCrypto::block));
+        out[j] = _mm_extract_epi64(output, 0) ^ _mm_extract_epi64(output, 1);
+      }
+    }
+    outputs(first, encoded);
+    first = end;
+  }
+
+  if(!second_oprf)
+    context.timings.oprf1 = oprf.end();
+  else
+    context.timings.oprf2 = oprf.end();
 }
 
+}
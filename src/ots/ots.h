@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cinttypes>
+#include <functional>
 #include <string>
 #include <vector>
 #include "cryptoTools/Network/Channel.h"
@@ -12,12 +13,25 @@
 #include "libOTe/NChooseOne/Kkrt/KkrtNcoOtSender.h"
 #include "common/config.h"
 #include "common/constants.h"
+#include "common/dataset.h"
 
 namespace ENCRYPTO {
 
+// second_oprf: the run is the center's OPRF2 over all nodes, timed as oprf2 instead of oprf1
 std::vector<osuCrypto::block> ot_receiver(const std::vector<std::uint64_t>& inputs, osuCrypto::Channel& recvChl,
-                                       ENCRYPTO::PsiAnalyticsContext& context,std::size_t numOTs=1);
+                                       ENCRYPTO::PsiAnalyticsContext& context,std::size_t numOTs=1,bool second_oprf=false);
 
 std::vector<std::vector<osuCrypto::block>> ot_sender(
-    const std::vector<std::vector<std::uint64_t>>& inputs, osuCrypto::Channel& sendChl, ENCRYPTO::PsiAnalyticsContext& context,std::size_t numOTs=1);
+    const std::vector<std::vector<std::uint64_t>>& inputs, osuCrypto::Channel& sendChl, ENCRYPTO::PsiAnalyticsContext& context,std::size_t numOTs=1,bool second_oprf=false);
+
+// Elements of OT (bin) i, from memory or from a mapped file
+using OprfBinSource = std::function<InputView(std::size_t)>;
+// Outputs of the bins first_bin, first_bin+1, ... as the 64-bit values the protocol compares;
+// a source bin is no longer read once its chunk went to the sink, so the sink may overwrite it
+using OprfBinSink = std::function<void(std::size_t first_bin, std::vector<std::vector<std::uint64_t>>& outputs)>;
+
+// ot_sender for the OPRF runs of the PSM1/PSM2 server: encodes context.oprf_chunk elements at a
+// time, so neither the inputs as blocks nor the 128-bit encodings of the whole table are held
+void ot_sender_stream(const OprfBinSource& inputs, const OprfBinSink& outputs, osuCrypto::Channel& sendChl,
+                      ENCRYPTO::PsiAnalyticsContext& context, std::size_t numOTs, bool second_oprf=false);
 }
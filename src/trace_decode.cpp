@@ -0,0 +1,93 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <boost/program_options.hpp>
+
+#include "common/trace_dump.h"
+
+/*
+ * Decodes a --trace-dump file: lists its records, or writes each record as <name>.csv in the
+ * layout of the former debug dumps (one line per row, comma-separated).
+ */
+
+template <typename T>
+static void writeRow(std::ofstream &file, const std::vector<uint8_t> &row) {
+  size_t count = row.size() / sizeof(T);
+  for (size_t i = 0; i < count; ++i) {
+    T value;
+    std::memcpy(&value, row.data() + i * sizeof(T), sizeof(T));
+    file << +value;
+    if (i < count - 1) file << ",";
+  }
+  file << "\n";
+}
+
+int main(int argc, char **argv) {
+  namespace po = boost::program_options;
+  std::string input, out_dir, stages;
+  bool list = false;
+  po::options_description allowed("Allowed options");
+  // clang-format off
+  allowed.add_options()("help,h", "produce this message")
+  ("input,i",    po::value<std::string>(&input)->required(),                "Trace file written with --trace-dump")
+  ("out,o",      po::value<std::string>(&out_dir)->default_value("."),      "Directory for the decoded CSV files")
+  ("stages,s",   po::value<std::string>(&stages)->default_value("all"),     "Stages to decode {oprf1, oprf2, match, bins, keys, shares, all}")
+  ("list,l",     po::bool_switch(&list),                                    "Only list the records");
+  // clang-format on
+
+  po::positional_options_description positional;
+  positional.add("input", 1);
+  po::variables_map vm;
+  try {
+    po::store(po::command_line_parser(argc, argv).options(allowed).positional(positional).run(), vm);
+    if (vm.count("help")) {
+      std::cout << allowed << "\n";
+      return EXIT_SUCCESS;
+    }
+    po::notify(vm);
+  } catch (const po::error &e) {
+    std::cout << e.what() << std::endl;
+    std::cout << allowed << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  uint32_t mask = ENCRYPTO::ParseTraceStages(stages);
+  ENCRYPTO::TraceReader reader;
+  if (!reader.Open(input)) {
+    std::cerr << "Not a trace file: " << input << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  ENCRYPTO::TraceReader::Entry entry;
+  while (reader.Next(entry)) {
+    if (!(entry.header.stage & mask)) continue;
+    if (list) {
+      uint64_t elems = 0;
+      for (const auto &row : entry.rows) elems += row.size() / entry.header.elem_size;
+      std::cout << ENCRYPTO::TraceStageName(entry.header.stage) << "\tnode " << entry.header.index
+                << "\t" << entry.name << "\t" << entry.rows.size() << " rows, " << elems
+                << " elements\n";
+      continue;
+    }
+
+    std::string path = out_dir + "/" + entry.name + ".csv";
+    std::ofstream file(path);
+    if (!file.is_open()) {
+      std::cerr << "Failed to open file: " << path << std::endl;
+      return EXIT_FAILURE;
+    }
+    for (const auto &row : entry.rows) {
+      switch (entry.header.type) {
+        case ENCRYPTO::TRACE_U8: writeRow<uint8_t>(file, row); break;
+        case ENCRYPTO::TRACE_I32: writeRow<int32_t>(file, row); break;
+        case ENCRYPTO::TRACE_U32: writeRow<uint32_t>(file, row); break;
+        case ENCRYPTO::TRACE_U64: writeRow<uint64_t>(file, row); break;
+        default:
+          std::cerr << "Unknown element type in " << entry.name << std::endl;
+          return EXIT_FAILURE;
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}